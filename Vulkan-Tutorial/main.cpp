@@ -13,11 +13,182 @@
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <cmath>
+#include <atomic>
+#include <cfloat>
+#include <cctype>
+#include <cstdio>
+#include <exception>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // global const
 const int		WIDTH		= 800;
 const int		HEIGHT		= 600;
-const int		MAX_FRAMES  = 2;
+const uint32_t	MAX_FRAMES_IN_FLIGHT = 4;	// upper bound of AppConfig::framesInFlight
+
+// offscreen (headless) render targets
+const uint32_t	OFFSCREEN_IMAGE_COUNT = 3;
+const VkFormat	OFFSCREEN_FORMAT = VK_FORMAT_B8G8R8A8_UNORM;
+
+// on-disk pipeline cache, validated against the physical device on load
+const char*		PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+// device micro-benchmark results, one line per device UUID + driver version
+const char*		DEVICE_BENCHMARK_FILE = "device_benchmark.txt";
+const uint32_t	DEVICE_BENCH_WORKGROUP_SIZE = 64;		// matches devicebench.comp
+const uint32_t	DEVICE_BENCH_ITERATIONS = 1024;			// spec constant 0 of devicebench.comp
+const uint32_t	DEVICE_BENCH_FLOPS_PER_ITERATION = 16;	// two vec4 fma
+
+// persistently mapped staging ring used by the upload path
+const VkDeviceSize	STAGING_RING_SIZE = 16ull * 1024 * 1024;
+
+// per frame-in-flight region of the persistently mapped uniform ring
+const VkDeviceSize	UNIFORM_RING_FRAME_SIZE = 256 * 1024;
+
+// bindless table sizes: with descriptor indexing the arrays are partially bound and written after bind,
+// without it every slot is written, so the fallback stays at the guaranteed per-stage minimums
+const uint32_t	BINDLESS_TEXTURE_CAPACITY = 4096;
+const uint32_t	BINDLESS_BUFFER_CAPACITY = 64;
+const uint32_t	FALLBACK_TEXTURE_CAPACITY = 16;
+const uint32_t	FALLBACK_BUFFER_CAPACITY = 4;
+const uint32_t	MATERIAL_TABLE_SLOT = 0;		// storage buffer slot holding the material table
+const uint32_t	MAX_MATERIALS = 4096;
+
+// streamed textures are decoded to RGBA8
+const VkFormat	TEXTURE_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+const uint32_t	TEXTURE_TEXEL_SIZE = 4;
+
+// pipeline statistics collected per frame when enabled
+const VkQueryPipelineStatisticFlags GPU_STATISTICS_FLAGS = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+// where per-object draw decisions are made
+enum class CullMode
+{
+	None,		// one instanced draw per mesh chunk, nothing culled
+	Cpu,		// cpu frustum test, one draw per visible object
+	Gpu,		// compute shader frustum test writing indirect draws
+};
+
+// how a pipeline uses the depth buffer
+enum class DepthState
+{
+	TestWrite,	// nearest fragment wins, writes depth
+	Equal,		// after the pre-pass: only the fragment that laid down the depth is shaded
+	Prepass,	// depth-only pre-pass: no fragment shader, no color attachment
+};
+
+// how vertices are packed in the vertex buffer, see the Vertex Layouts section
+enum class VertexFormat
+{
+	Float,		// 32-bit float position and color, 20 bytes
+	Half,		// 16-bit float position, 8-bit unorm color, 8 bytes
+	Snorm16,	// 16-bit snorm position (needs positions within [-1, 1]), 8-bit unorm color, 8 bytes
+};
+
+// command-line names of the present modes that can be requested
+const std::pair<const char*, VkPresentModeKHR> PRESENT_MODE_NAMES[] =
+{
+	{ "immediate", VK_PRESENT_MODE_IMMEDIATE_KHR },
+	{ "mailbox", VK_PRESENT_MODE_MAILBOX_KHR },
+	{ "fifo", VK_PRESENT_MODE_FIFO_KHR },
+	{ "fifo-relaxed", VK_PRESENT_MODE_FIFO_RELAXED_KHR },
+};
+
+static const char* presentModeName(VkPresentModeKHR presentMode)
+{
+	for (const auto& entry : PRESENT_MODE_NAMES)
+	{
+		if (entry.second == presentMode)
+			return entry.first;
+	}
+	return "unknown";
+}
+
+// runtime options, filled from the command line
+struct AppConfig
+{
+	bool		headless = false;		// render into offscreen images, no window/surface/swapchain
+	uint32_t	frameCount = 1000;		// frames rendered in headless mode
+	uint32_t	width = WIDTH;
+	uint32_t	height = HEIGHT;
+	std::string	benchmark;				// named benchmark to run instead of the interactive loop
+	uint32_t	drawCount = 1;			// draw calls recorded per frame
+	uint32_t	recordThreads = 1;		// 1 records inline on the render thread, more use secondary command buffers
+	uint32_t	instanceCount = 1;		// instances per draw call, laid out on a grid
+	uint32_t	gridSize = 0;			// draw a procedural size x size quad grid instead of the triangle
+	bool		pipelineStatistics = false;	// collect vertex/fragment invocation counts next to gpu timestamps
+	std::string	gpuReport;				// if set, gpu timings are written to <gpuReport>.csv and .json at exit
+	std::string	meshFile;				// .vmesh file streamed in instead of the built-in geometry
+	std::string	writeMeshFile;			// if set, the built-in geometry is written here as .vmesh
+	uint32_t	shaderFeatures = 1;		// SHADER_FEATURE_* bits of the pipeline used for drawing
+	CullMode	cullMode = CullMode::None;
+	float		zoom = 1.0f;			// view scale, objects pushed off screen get culled
+	uint32_t	framesInFlight = 2;		// 1..MAX_FRAMES_IN_FLIGHT, more hides cpu/gpu stalls at the cost of latency
+	VkPresentModeKHR	presentMode = VK_PRESENT_MODE_MAILBOX_KHR;	// FIFO is used when the surface lacks it
+	bool		timelineSync = true;	// pace frames and uploads with one timeline semaphore when supported, fences otherwise
+	uint32_t	materialCount = 1;		// materials cycled over the draw calls
+	std::vector<std::string>	textureFiles;	// binary .ppm files streamed in as textures
+	uint32_t	streamedTextureCount = 0;	// procedural textures streamed in next to textureFiles
+	uint32_t	textureSize = 1024;		// width and height of the procedural textures
+	uint32_t	textureBudgetKiB = 1024;	// texture bytes copied into the staging ring per frame
+	bool		deviceBenchmark = false;	// benchmark devices missing from DEVICE_BENCHMARK_FILE when several are usable
+	float		memoryReportSeconds = 5.0f;	// per-heap usage vs. budget printed this often, 0 = only at exit
+	VertexFormat	vertexFormat = VertexFormat::Float;	// packing of the vertex buffer, falls back to Half/Float when unusable
+	float		renderScale = 1.0f;		// scene resolution relative to the swapchain, blitted up/down when not 1
+	bool		frontToBack = true;		// record the draws nearest first instead of in submission order
+	bool		depthPrepass = false;	// lay down depth in a depth-only pass, then shade with an EQUAL test
+	uint32_t	msaaSamples = 1;		// MSAA sample count, lowered to what the device supports
+};
+
+// shader feature toggles, passed to both shaders as specialization constant 0
+const uint32_t	SHADER_FEATURE_INSTANCE_COLOR = 1u << 0;	// tint vertices with the per-instance color
+const uint32_t	SHADER_FEATURE_GRAYSCALE = 1u << 1;			// write luminance instead of color
+
+// fixed-function state and shader features that make up one pipeline permutation
+struct PipelineVariant
+{
+	VkCullModeFlags			cullMode = VK_CULL_MODE_BACK_BIT;
+	VkPrimitiveTopology		topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	bool					blend = false;			// blended variants test depth but do not write it
+	uint32_t				shaderFeatures = SHADER_FEATURE_INSTANCE_COLOR;
+	DepthState				depthState = DepthState::TestWrite;
+
+	bool operator==(const PipelineVariant& other) const
+	{
+		return cullMode == other.cullMode && topology == other.topology && blend == other.blend && shaderFeatures == other.shaderFeatures &&
+			depthState == other.depthState;
+	}
+};
+
+// bytes of mesh chunks streamed into the staging ring per frame
+const VkDeviceSize	MESH_STREAM_BYTES_PER_FRAME = STAGING_RING_SIZE / 4;
+
+// device-local usage / budget above which streamed textures drop a mip, and below which they get it back
+const double		MEMORY_PRESSURE_HIGH = 0.9;
+const double		MEMORY_PRESSURE_LOW = 0.7;
+const uint32_t		MEMORY_PRESSURE_MAX_MIP_BIAS = 4;
+// frames between two bias changes, so freed versions have retired before pressure is measured again
+const uint32_t		MEMORY_PRESSURE_REACTION_FRAMES = 60;
 
 // for validation layer
 const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
@@ -25,6 +196,10 @@ const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation
 // for device layer
 const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
+// enabled when the device has them, features depending on them check _enabledDeviceExtensions
+const std::vector<const char*> optionalDeviceExtensions = { VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+	VK_KHR_MAINTENANCE3_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME };
+
 #ifdef _DEBUG
 const bool enableValidationLayer = true;
 #else
@@ -33,39 +208,330 @@ const bool enableValidationLayer = false;
 
 
 // shader stuff
+// CPU-side vertex, what meshes are built, optimized and stored in .vmesh files as; the vertex buffer holds
+// it packed by one of the layouts below
 struct Vertex
 {
 	glm::vec2 pos;
 	glm::vec3 color;
+};
+
+//====================== Vertex Layouts ==========================
+static uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint32_t sign = (bits >> 16) & 0x8000;
+	const uint32_t floatExponent = (bits >> 23) & 0xFF;
+	uint32_t mantissa = bits & 0x7FFFFF;
+	const int32_t exponent = static_cast<int32_t>(floatExponent) - 127 + 15;
+
+	if (floatExponent == 0xFF)
+		return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));	// inf, nan
+	if (exponent >= 31)
+		return static_cast<uint16_t>(sign | 0x7C00);	// too large, inf
+	if (exponent <= 0)
+	{
+		// subnormal half, or zero when even that is too small
+		if (exponent < -10)
+			return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000;
+		const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		const uint32_t rest = mantissa & ((1u << shift) - 1);
+		const uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	// round to nearest even, a carry out of the mantissa correctly bumps the exponent
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	const uint32_t rest = mantissa & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return static_cast<uint16_t>(half);
+}
+
+static int16_t floatToSnorm16(float value)
+{
+	return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint8_t floatToUnorm8(float value)
+{
+	return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+// unit vector -> point on the octahedron folded into [-1, 1]^2
+static void encodeOctahedral(const float* normal, float* encoded)
+{
+	float length = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+	float x = normal[0] / length;
+	float y = normal[1] / length;
+	if (normal[2] < 0.0f)
+	{
+		float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+	encoded[0] = x;
+	encoded[1] = y;
+}
+
+// the inverse; shaders reading an octahedral attribute need the same few lines
+static void decodeOctahedral(const float* encoded, float* normal)
+{
+	float x = encoded[0];
+	float y = encoded[1];
+	float z = 1.0f - std::abs(x) - std::abs(y);
+	if (z < 0.0f)
+	{
+		float unfoldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float unfoldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = unfoldedX;
+		y = unfoldedY;
+	}
+	float length = std::sqrt(x * x + y * y + z * z);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = z / length;
+}
+
+// Encodings: how one attribute is stored. The input assembler expands each format to the float vector the shader
+// declares, so the shaders stay the same for every layout; only Octahedral16 has to be decoded by the shader.
+struct Float32x2
+{
+	static constexpr VkFormat format = VK_FORMAT_R32G32_SFLOAT;
+	static constexpr uint32_t size = 8;
+	static void encode(const float* value, uint8_t* out) { memcpy(out, value, size); }
+};
+
+struct Float32x3
+{
+	static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;
+	static constexpr uint32_t size = 12;
+	static void encode(const float* value, uint8_t* out) { memcpy(out, value, size); }
+};
+
+struct Half16x2
+{
+	static constexpr VkFormat format = VK_FORMAT_R16G16_SFLOAT;
+	static constexpr uint32_t size = 4;
+	static void encode(const float* value, uint8_t* out)
+	{
+		const uint16_t packed[2] = { floatToHalf(value[0]), floatToHalf(value[1]) };
+		memcpy(out, packed, size);
+	}
+};
+
+struct Snorm16x2
+{
+	static constexpr VkFormat format = VK_FORMAT_R16G16_SNORM;
+	static constexpr uint32_t size = 4;
+	static void encode(const float* value, uint8_t* out)
+	{
+		const int16_t packed[2] = { floatToSnorm16(value[0]), floatToSnorm16(value[1]) };
+		memcpy(out, packed, size);
+	}
+};
+
+// three components plus an opaque alpha, read as vec3 or vec4
+struct Unorm8x4
+{
+	static constexpr VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+	static constexpr uint32_t size = 4;
+	static void encode(const float* value, uint8_t* out)
+	{
+		out[0] = floatToUnorm8(value[0]);
+		out[1] = floatToUnorm8(value[1]);
+		out[2] = floatToUnorm8(value[2]);
+		out[3] = 255;
+	}
+};
+
+// unit vector in 4 bytes instead of 12, arrives in the shader as the folded vec2
+struct Octahedral16
+{
+	static constexpr VkFormat format = VK_FORMAT_R16G16_SNORM;
+	static constexpr uint32_t size = 4;
+	static void encode(const float* value, uint8_t* out)
+	{
+		float encoded[2];
+		encodeOctahedral(value, encoded);
+		Snorm16x2::encode(encoded, out);
+	}
+};
+
+// Attributes: shader location and where the values come from
+struct PositionAttribute
+{
+	static constexpr uint32_t location = 0;
+	static const float* read(const Vertex& vertex) { return &vertex.pos.x; }
+};
+
+struct ColorAttribute
+{
+	static constexpr uint32_t location = 1;
+	static const float* read(const Vertex& vertex) { return &vertex.color.x; }
+};
+
+template<typename AttributeType, typename EncodingType>
+struct VertexField
+{
+	using Attribute = AttributeType;
+	using Encoding = EncodingType;
+};
+
+// Packed vertex made of the fields in order, without padding. Stride and the Vulkan input descriptions are
+// computed at compile time, encode() packs Vertex data accordingly.
+template<typename... Fields>
+struct VertexLayout
+{
+	static constexpr uint32_t fieldCount = sizeof...(Fields);
+	static constexpr uint32_t stride = (Fields::Encoding::size + ...);
+
+	static constexpr VkVertexInputBindingDescription bindingDescription(uint32_t binding)
+	{
+		return { binding, stride, VK_VERTEX_INPUT_RATE_VERTEX };
+	}
+
+	static constexpr std::array<VkVertexInputAttributeDescription, fieldCount> attributeDescriptions(uint32_t binding)
+	{
+		std::array<VkVertexInputAttributeDescription, fieldCount> attributes = {};
+		uint32_t offset = 0;
+		size_t index = 0;
+		((attributes[index++] = VkVertexInputAttributeDescription{ Fields::Attribute::location, binding, Fields::Encoding::format, offset },
+			offset += Fields::Encoding::size), ...);
+		return attributes;
+	}
+
+	static void encode(const Vertex* vertices, size_t count, uint8_t* out)
+	{
+		for (size_t i = 0; i < count; i++, out += stride)
+		{
+			uint8_t* field = out;
+			((Fields::Encoding::encode(Fields::Attribute::read(vertices[i]), field), field += Fields::Encoding::size), ...);
+		}
+	}
+};
+
+using FloatVertexLayout = VertexLayout<VertexField<PositionAttribute, Float32x2>, VertexField<ColorAttribute, Float32x3>>;
+using HalfVertexLayout = VertexLayout<VertexField<PositionAttribute, Half16x2>, VertexField<ColorAttribute, Unorm8x4>>;
+using Snorm16VertexLayout = VertexLayout<VertexField<PositionAttribute, Snorm16x2>, VertexField<ColorAttribute, Unorm8x4>>;
+
+static_assert(FloatVertexLayout::stride == sizeof(Vertex), "the float layout is Vertex as is");
+static_assert(FloatVertexLayout::attributeDescriptions(0)[1].offset == offsetof(Vertex, color), "the float layout is Vertex as is");
+static_assert(HalfVertexLayout::stride == 8 && Snorm16VertexLayout::stride == 8, "packed layouts are 8 bytes");
+
+// a compile-time layout in the form the pipeline and the uploads pick at runtime
+struct VertexLayoutInfo
+{
+	VertexFormat	format = VertexFormat::Float;
+	const char*		name = "";
+	uint32_t		stride = 0;
+	VkVertexInputBindingDescription					binding = {};	// binding 0
+	std::vector<VkVertexInputAttributeDescription>	attributes;		// binding 0
+	void			(*encode)(const Vertex* vertices, size_t count, uint8_t* out) = nullptr;
+
+	template<typename Layout>
+	static VertexLayoutInfo make(VertexFormat format, const char* name)
+	{
+		constexpr VkVertexInputBindingDescription binding = Layout::bindingDescription(0);
+		constexpr auto attributes = Layout::attributeDescriptions(0);
+
+		VertexLayoutInfo info;
+		info.format = format;
+		info.name = name;
+		info.stride = Layout::stride;
+		info.binding = binding;
+		info.attributes.assign(attributes.begin(), attributes.end());
+		info.encode = &Layout::encode;
+		return info;
+	}
+};
+
+static VertexLayoutInfo vertexLayoutInfo(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::Half:	return VertexLayoutInfo::make<HalfVertexLayout>(format, "half");
+	case VertexFormat::Snorm16:	return VertexLayoutInfo::make<Snorm16VertexLayout>(format, "snorm16");
+	default:					return VertexLayoutInfo::make<FloatVertexLayout>(VertexFormat::Float, "float");
+	}
+}
+
+// per-instance attributes, binding 1, advanced once per instance
+struct InstanceData
+{
+	glm::vec2 offset;
+	float scale;
+	glm::vec3 color;
 
 	static VkVertexInputBindingDescription getBindingDescription()
 	{
 		VkVertexInputBindingDescription bindingDescription = {};
 
-		bindingDescription.binding = 0;
-		bindingDescription.stride = sizeof(Vertex);
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
 		return bindingDescription;
 	}
 
-	static std::array<VkVertexInputAttributeDescription,2> getAttributeDescriptions()
+	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
 	{
-		std::array<VkVertexInputAttributeDescription,2> attributeDescriptions = {};
-		attributeDescriptions[0].binding = 0;
-		attributeDescriptions[0].location = 0;
+		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+		attributeDescriptions[0].binding = 1;
+		attributeDescriptions[0].location = 2;
 		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescriptions[0].offset = offsetof(Vertex, pos);
+		attributeDescriptions[0].offset = offsetof(InstanceData, offset);
 
-		attributeDescriptions[1].binding = 0;
-		attributeDescriptions[1].location = 1;
-		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[1].offset = offsetof(Vertex, color);
+		attributeDescriptions[1].binding = 1;
+		attributeDescriptions[1].location = 3;
+		attributeDescriptions[1].format = VK_FORMAT_R32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(InstanceData, scale);
+
+		attributeDescriptions[2].binding = 1;
+		attributeDescriptions[2].location = 4;
+		attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(InstanceData, color);
 
 		return attributeDescriptions;
 	}
 };
 
+// count instances on a square grid covering clip space; a single instance is the identity transform
+static std::vector<InstanceData> makeInstanceGrid(uint32_t count)
+{
+	std::vector<InstanceData> instances(count);
+	if (count == 1)
+	{
+		instances[0] = { { 0.0f, 0.0f }, 1.0f, { 1.0f, 1.0f, 1.0f } };
+		return instances;
+	}
+
+	uint32_t side = 1;
+	while (side * side < count)
+	{
+		side++;
+	}
+
+	const float cell = 2.0f / side;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t x = i % side;
+		uint32_t y = i / side;
+
+		instances[i].offset = { -1.0f + (x + 0.5f) * cell, -1.0f + (y + 0.5f) * cell };
+		instances[i].scale = cell;
+		instances[i].color = { (float)x / side, (float)y / side, 1.0f - (float)x / side };
+	}
+	return instances;
+}
+
 const std::vector<Vertex> vertices = {
 	{{ 0.0f, -0.5f},{1.0f, 0.0f, 0.0f}},
 	{{ 0.5f,  0.5f},{0.0f, 1.0f, 0.0f}},
@@ -117,1214 +583,8898 @@ static std::vector<char> readFile(const std::string& filename)
 	return buffer;
 }
 
-class HelloTriangleApplication
+// read-only memory mapping of a whole file; pages are read from disk when they are first touched
+class MappedFile
 {
-	struct QueueFamilyIndices
+public:
+	explicit MappedFile(const std::string& filename)
 	{
-		std::optional<uint32_t> graphicsFamily;
-		std::optional<uint32_t> presentFamily;
+#ifdef _WIN32
+		_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER fileSize;
+		if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &fileSize))
+		{
+			_close();
+			throw std::runtime_error("Failed to open file " + filename);
+		}
+		_size = static_cast<size_t>(fileSize.QuadPart);
 
-		bool isComplete()
+		if (_size > 0)
 		{
-			return graphicsFamily.has_value() && presentFamily.has_value();
+			_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			_data = _mapping ? static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
 		}
-	};
+#else
+		_fd = open(filename.c_str(), O_RDONLY);
+		struct stat fileStat;
+		if (_fd < 0 || fstat(_fd, &fileStat) != 0)
+		{
+			_close();
+			throw std::runtime_error("Failed to open file " + filename);
+		}
+		_size = static_cast<size_t>(fileStat.st_size);
 
-	struct SwapchainSupportDetails
-	{
-		VkSurfaceCapabilitiesKHR capabilities;
-		std::vector<VkSurfaceFormatKHR> formats;
-		std::vector<VkPresentModeKHR> presentModes;
-	};
-public:
-	void Run()
-	{
-		_initWindow();
-		_initVulkan();
-		_mainLoop();
-		_cleanup();
+		if (_size > 0)
+		{
+			void* mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+			if (mapped != MAP_FAILED)
+			{
+				// the file is consumed front to back
+				madvise(mapped, _size, MADV_SEQUENTIAL);
+				_data = static_cast<const char*>(mapped);
+			}
+		}
+#endif
+		if (_size > 0 && _data == nullptr)
+		{
+			_close();
+			throw std::runtime_error("Failed to map file " + filename);
+		}
 	}
 
-private:
-	GLFWwindow*							_window;
-
-	// vulkan
-	VkInstance							_instance;
-
-	// debug messenger
-	VkDebugUtilsMessengerEXT			debugMessenger;
-
-	// physical device-->gpu graphics card
-	VkPhysicalDevice					_physicalDevice = VK_NULL_HANDLE;
+	~MappedFile()
+	{
+		_close();
+	}
 
-	// logic device
-	VkDevice							_device;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
 
-	// queue handle
-	VkQueue								_graphicsQueue;
-	VkQueue								_presentQueue;
+	const char* data() const
+	{
+		return _data;
+	}
 
-	// surface
-	VkSurfaceKHR						_surface;
+	size_t size() const
+	{
+		return _size;
+	}
 
-	// swapchain
-	VkSwapchainKHR						_swapChain;
-	std::vector<VkImage>				_swapChainImages;
-	VkFormat							_swapChainImageFormat;
-	VkExtent2D							_swapChainExtent;
+private:
+	void _close()
+	{
+#ifdef _WIN32
+		if (_data) UnmapViewOfFile(_data);
+		if (_mapping) CloseHandle(_mapping);
+		if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+		_mapping = nullptr;
+		_file = INVALID_HANDLE_VALUE;
+#else
+		if (_data) munmap(const_cast<char*>(_data), _size);
+		if (_fd >= 0) close(_fd);
+		_fd = -1;
+#endif
+		_data = nullptr;
+	}
 
-	// image view
-	std::vector<VkImageView>			_swapChainImageViews;
+#ifdef _WIN32
+	HANDLE			_file = INVALID_HANDLE_VALUE;
+	HANDLE			_mapping = nullptr;
+#else
+	int				_fd = -1;
+#endif
+	const char*		_data = nullptr;
+	size_t			_size = 0;
+};
 
-	// pipeline layout
-	VkPipelineLayout					_pipelineLayout;
+// collects per-frame timings (milliseconds) and reports throughput and percentiles
+struct FrameStats
+{
+	std::vector<double> samples;
 
-	// render pass
-	VkRenderPass						_renderPass;
+	void add(double ms)
+	{
+		samples.push_back(ms);
+	}
 
-	// graphics pipeline
-	VkPipeline							_graphicsPipeline;
+	double percentile(double p) const
+	{
+		if (samples.empty())
+			return 0.0;
 
-	// frame buffers
-	std::vector<VkFramebuffer>			_swapChainFrameBuffers;
+		std::vector<double> sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
 
-	// command pool
-	VkCommandPool						_commandPool;
+		size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
 
-	// command buffers
-	std::vector<VkCommandBuffer>		_commandBuffers;
+	void report(const char* label, double totalMs) const
+	{
+		double fps = totalMs > 0.0 ? samples.size() * 1000.0 / totalMs : 0.0;
 
-	// semaphores
-	std::vector<VkSemaphore>			_imageAvailableSemaphores;
-	std::vector<VkSemaphore>			_renderFinishedSemaphores;
-	std::vector<VkFence>				_inFlightFences;
-	std::vector<VkFence>                _imagesInFlight;
+		std::cout << label << ": " << samples.size() << " frames in " << totalMs << " ms, "
+			<< fps << " frames/sec, p50 " << percentile(0.50) << " ms, p99 " << percentile(0.99) << " ms" << std::endl;
+	}
+};
 
-	// current frame
-	size_t								_currentFrame = 0;
+// rolling window of per-frame gpu measurements, with a fixed-bucket histogram of the window's gpu times
+struct GpuFrameHistory
+{
+	struct Sample
+	{
+		uint64_t	frame;
+		double		gpuMs;
+		uint64_t	vertexInvocations;		// 0 when pipeline statistics are off
+		uint64_t	fragmentInvocations;
+	};
 
-	// resized
-	bool								_framebufferResized = false;
+	static const size_t		WINDOW_SIZE = 1024;
+	static constexpr double	BUCKET_MS = 0.25;
+	static const size_t		BUCKET_COUNT = 64;	// the last bucket also takes everything slower
 
-	// vertex buffer
-	VkBuffer							_vertexBuffer;
-	VkDeviceMemory						_vertexBufferMemory;
-private:
+	std::deque<Sample>					window;
+	std::array<uint32_t, BUCKET_COUNT>	buckets = {};
+	uint64_t							totalSamples = 0;
 
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-		VkDebugUtilsMessageTypeFlagsEXT messageType,
-		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-		void* pUserdata)
+	static size_t bucketOf(double ms)
 	{
-		std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
-
-		return VK_FALSE;
+		return std::min(BUCKET_COUNT - 1, static_cast<size_t>(ms / BUCKET_MS));
 	}
-	void _initWindow()
-	{
-		glfwInit();
 
-		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);	// no openGL api
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);		// no resize
-
-		_window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-		glfwSetWindowUserPointer(_window, this);
-		glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
+	void add(const Sample& sample)
+	{
+		if (window.size() == WINDOW_SIZE)
+		{
+			buckets[bucketOf(window.front().gpuMs)]--;
+			window.pop_front();
+		}
+		window.push_back(sample);
+		buckets[bucketOf(sample.gpuMs)]++;
+		totalSamples++;
 	}
 
-	static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
+	FrameStats gpuStats() const
 	{
-		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-		app->_framebufferResized = true;
+		FrameStats stats;
+		for (const Sample& sample : window)
+		{
+			stats.add(sample.gpuMs);
+		}
+		return stats;
 	}
 
-	bool _checkValidationLayerSupport()
+	void writeCsv(const std::string& path) const
 	{
-		uint32_t layerCount = 0;
-		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-
-		std::vector<VkLayerProperties> availibleLayers(layerCount);
-		vkEnumerateInstanceLayerProperties(&layerCount, availibleLayers.data());
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open " + path);
+		}
 
-		bool layerFound = false;
-		for (const char* layerName : validationLayers)
+		file << "frame,gpu_ms,vertex_invocations,fragment_invocations\n";
+		for (const Sample& sample : window)
 		{
-			for (const auto& layerProperties : availibleLayers)
-			{
-				if (strcmp(layerName, layerProperties.layerName) == 0)
-				{
-					layerFound = true;
-					break;
-				}
-			}
+			file << sample.frame << "," << sample.gpuMs << "," << sample.vertexInvocations << "," << sample.fragmentInvocations << "\n";
+		}
+	}
 
+	void writeJson(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Failed to open " + path);
 		}
-		if (!layerFound)
-			return false;
 
-		return true;
+		FrameStats stats = gpuStats();
+		file << "{\n";
+		file << "  \"total_frames\": " << totalSamples << ",\n";
+		file << "  \"window_frames\": " << window.size() << ",\n";
+		file << "  \"gpu_ms_p50\": " << stats.percentile(0.50) << ",\n";
+		file << "  \"gpu_ms_p99\": " << stats.percentile(0.99) << ",\n";
+		file << "  \"bucket_ms\": " << BUCKET_MS << ",\n";
+		file << "  \"histogram\": [";
+		for (size_t i = 0; i < BUCKET_COUNT; i++)
+		{
+			file << (i ? ", " : "") << buckets[i];
+		}
+		file << "],\n";
+		file << "  \"samples\": [";
+		for (size_t i = 0; i < window.size(); i++)
+		{
+			const Sample& sample = window[i];
+			file << (i ? "," : "") << "\n    { \"frame\": " << sample.frame << ", \"gpu_ms\": " << sample.gpuMs
+				<< ", \"vertex_invocations\": " << sample.vertexInvocations << ", \"fragment_invocations\": " << sample.fragmentInvocations << " }";
+		}
+		file << "\n  ]\n}\n";
 	}
+};
 
-	std::vector<const char*> getRequiredExtensions()
-	{
-		uint32_t gfwExtensionCount = 0;
-		const char** glfwExtensions;
+// 2d view transform applied after the instance and draw transforms
+struct ViewConstants
+{
+	glm::vec2 scale;
+	glm::vec2 offset;
+};
 
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&gfwExtensionCount);
+// per-frame shader data, written into the uniform ring once per frame (std140, matches shader.vert)
+struct FrameUniforms
+{
+	ViewConstants	view;
+	float			time;			// seconds since startup
+	uint32_t		frameNumber;
+};
 
-		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + gfwExtensionCount);
-		if (enableValidationLayer)
+// per-draw transform applied before the view, the draw's material and texture, push constant of the graphics pipeline.
+// Texture slots change while frames are in flight (streaming swaps versions), so they are resolved at record time
+// instead of living in the material table.
+struct DrawConstants
+{
+	glm::vec2	offset;
+	glm::vec2	scale;
+	uint32_t	materialId;
+	uint32_t	textureIndex;		// slot in the bindless texture array
+	float		depth;				// of the draw's first instance
+	float		depthStep;			// subtracted per instance index
+};
+
+// one entry of the material table (std430, matches shader.frag)
+struct Material
+{
+	glm::vec4	tint;
+};
+
+// fully saturated color for a hue in [0, 1)
+static glm::vec3 hueToRgb(float hue)
+{
+	float r = std::clamp(std::abs(hue * 6.0f - 3.0f) - 1.0f, 0.0f, 1.0f);
+	float g = std::clamp(2.0f - std::abs(hue * 6.0f - 2.0f), 0.0f, 1.0f);
+	float b = std::clamp(2.0f - std::abs(hue * 6.0f - 4.0f), 0.0f, 1.0f);
+	return glm::vec3(r, g, b);
+}
+
+//====================== Culling ==========================
+const uint32_t	CULL_WORKGROUP_SIZE = 64;
+
+// per-object input of cull.comp (std430): world-space bounds and the indexed draw it turns into
+struct CullObject
+{
+	glm::vec4	boundsMin;
+	glm::vec4	boundsMax;
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+	int32_t		vertexOffset;
+	uint32_t	instance;
+};
+
+struct CullConstants
+{
+	glm::vec2	viewScale;
+	glm::vec2	viewOffset;
+	uint32_t	objectCount;
+	uint32_t	compact;
+};
+
+// bounds against the [-1, 1] clip-space square after the view transform; mirrors cull.comp
+static bool isObjectVisible(const CullObject& object, const ViewConstants& view)
+{
+	float loX = object.boundsMin.x * view.scale.x + view.offset.x;
+	float loY = object.boundsMin.y * view.scale.y + view.offset.y;
+	float hiX = object.boundsMax.x * view.scale.x + view.offset.x;
+	float hiY = object.boundsMax.y * view.scale.y + view.offset.y;
+	return std::min(loX, hiX) <= 1.0f && std::min(loY, hiY) <= 1.0f && std::max(loX, hiX) >= -1.0f && std::max(loY, hiY) >= -1.0f;
+}
+
+//====================== Mesh Optimization ==========================
+// indexed triangle list
+struct Mesh
+{
+	std::vector<Vertex>		vertices;
+	std::vector<uint32_t>	indices;
+};
+
+// LRU cache size the triangle reordering optimizes for (Forsyth)
+const uint32_t	VERTEX_CACHE_SIZE = 32;
+
+// FIFO cache size used when measuring ACMR, close to what current hardware does
+const uint32_t	ACMR_FIFO_SIZE = 16;
+
+// turns a non-indexed triangle list into unique vertices + indices, merging bitwise identical vertices
+static Mesh deduplicateVertices(const std::vector<Vertex>& triangleList)
+{
+	struct VertexHash
+	{
+		size_t operator()(const Vertex& v) const
 		{
-			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+			// FNV-1a over the raw bytes, Vertex has no padding
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+			size_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < sizeof(Vertex); i++)
+			{
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+			return hash;
+		}
+	};
+	struct VertexEqual
+	{
+		bool operator()(const Vertex& a, const Vertex& b) const
+		{
+			return memcmp(&a, &b, sizeof(Vertex)) == 0;
 		}
+	};
 
-		return extensions;
-	}
+	Mesh mesh;
+	mesh.indices.reserve(triangleList.size());
 
-	void _createInstance()
+	std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> uniqueVertices;
+	uniqueVertices.reserve(triangleList.size());
+	for (const Vertex& vertex : triangleList)
 	{
-		if (enableValidationLayer && !_checkValidationLayerSupport())
+		auto inserted = uniqueVertices.emplace(vertex, static_cast<uint32_t>(mesh.vertices.size()));
+		if (inserted.second)
 		{
-			throw std::runtime_error("validation layers requested, but not availible");
+			mesh.vertices.push_back(vertex);
 		}
-		VkApplicationInfo appInfo = {};
-		appInfo.sType				= VK_STRUCTURE_TYPE_APPLICATION_INFO;
-		appInfo.pApplicationName	= "Hello Triangle";
-		appInfo.applicationVersion	= VK_MAKE_VERSION(1, 0, 0);
-		appInfo.pEngineName			= "No Engine";
-		appInfo.engineVersion		= VK_MAKE_VERSION(1, 0, 0);
-		appInfo.apiVersion			= VK_API_VERSION_1_0;
+		mesh.indices.push_back(inserted.first->second);
+	}
+	return mesh;
+}
 
-		VkInstanceCreateInfo createInfo = {};
-		createInfo.sType			= VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-		createInfo.pApplicationInfo = &appInfo;
+// average cache miss ratio: transformed vertices per triangle with a FIFO post-transform cache (0.5 .. 3.0, lower is better)
+static double computeACMR(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = ACMR_FIFO_SIZE)
+{
+	if (indices.empty())
+		return 0.0;
 
-		auto extensions = getRequiredExtensions();
+	// a vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	uint32_t misses = 0;
+	for (uint32_t index : indices)
+	{
+		if (loadedAt[index] == 0 || misses + 1 - loadedAt[index] > cacheSize)
+		{
+			misses++;
+			loadedAt[index] = misses;
+		}
+	}
+	return static_cast<double>(misses) / (indices.size() / 3);
+}
 
-		createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
-		createInfo.ppEnabledExtensionNames  = extensions.data();
+// Forsyth's linear-speed vertex cache optimization: greedily emits the triangle with the best score, where
+// vertices score high when they are recently used (cache position) or have few triangles left (valence).
+static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
 
-		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-		if (enableValidationLayer)
-		{
-			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-			createInfo.ppEnabledLayerNames = validationLayers.data();
+	auto vertexScore = [](int cachePosition, uint32_t remainingTriangles) -> float
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
 
-			_populateDebugMessengerCreateInfo(debugCreateInfo);
-			createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&debugCreateInfo;
-		}
-		else
+		float score = 0.0f;
+		if (cachePosition >= 0)
 		{
-			createInfo.enabledLayerCount = 0;
+			// the last triangle's vertices get a fixed score so the next one does not just reuse its edge
+			score = cachePosition < 3 ? 0.75f : std::pow(1.0f - float(cachePosition - 3) / (VERTEX_CACHE_SIZE - 3), 1.5f);
 		}
+		return score + 2.0f * std::pow(float(remainingTriangles), -0.5f);
+	};
 
-		
-		if (vkCreateInstance(&createInfo, nullptr, &_instance) != VK_SUCCESS)
+	// vertex -> triangles adjacency, remaining triangles are kept at the front of each vertex's range
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (uint32_t index : indices)
+	{
+		remaining[index]++;
+	}
+	std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (size_t k = 0; k < 3; k++)
 		{
-			throw std::runtime_error("failed to create instance!");
-		}		
+			uint32_t v = indices[t * 3 + k];
+			adjacency[fill[v]++] = static_cast<uint32_t>(t);
+		}
 	}
 
-	void _populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo)
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> score(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
 	{
-		createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-		createInfo.pfnUserCallback = debugCallback;
+		score[v] = vertexScore(-1, remaining[v]);
 	}
 
-	void _drawFrame()
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++)
 	{
-		vkWaitForFences(_device, 1, &_inFlightFences[_currentFrame], VK_TRUE, UINT64_MAX);
+		triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+	}
 
-		// acquiring an image
-		uint32_t imageIndex;
-		VkResult result = vkAcquireNextImageKHR(_device, _swapChain, UINT64_MAX, _imageAvailableSemaphores[_currentFrame], VK_NULL_HANDLE, &imageIndex);
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
 
-		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+	newCache.reserve(VERTEX_CACHE_SIZE + 3);
+
+	size_t cursor = 0;
+	int64_t best = -1;
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		if (best < 0)
 		{
-			_recreateSwapChain();
-			return;
+			// nothing adjacent to the cache left, restart from the next unemitted triangle
+			while (emitted[cursor])
+			{
+				cursor++;
+			}
+			best = static_cast<int64_t>(cursor);
 		}
-		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+
+		const uint32_t* triangle = &indices[best * 3];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		// drop the triangle from its vertices' remaining lists
+		for (size_t k = 0; k < 3; k++)
 		{
-			throw std::runtime_error("Failed to acquire swap chain image!");
+			uint32_t v = triangle[k];
+			uint32_t* begin = &adjacency[adjacencyOffset[v]];
+			uint32_t* end = begin + remaining[v];
+			*std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+			remaining[v]--;
 		}
 
-		if (_imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+		// the triangle's vertices move to the front of the LRU cache
+		newCache.assign(triangle, triangle + 3);
+		for (uint32_t v : cache)
 		{
-			vkWaitForFences(_device, 1, &_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+			{
+				newCache.push_back(v);
+			}
+		}
+		for (size_t i = 0; i < newCache.size(); i++)
+		{
+			uint32_t v = newCache[i];
+			cachePosition[v] = i < VERTEX_CACHE_SIZE ? static_cast<int>(i) : -1;
+			score[v] = vertexScore(cachePosition[v], remaining[v]);
 		}
 
-		_imagesInFlight[imageIndex] = _inFlightFences[_currentFrame];
-
-		// submitting the command buffer
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		// rescore triangles touching the cache (and the vertices just evicted), pick the next one among them
+		best = -1;
+		float bestScore = -1.0f;
+		for (uint32_t v : newCache)
+		{
+			for (uint32_t a = 0; a < remaining[v]; a++)
+			{
+				uint32_t t = adjacency[adjacencyOffset[v] + a];
+				triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
 
-		VkSemaphore watsSemaphores[] = { _imageAvailableSemaphores[_currentFrame] };
-		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = watsSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
+		if (newCache.size() > VERTEX_CACHE_SIZE)
+		{
+			newCache.resize(VERTEX_CACHE_SIZE);
+		}
+		cache.swap(newCache);
+	}
 
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &_commandBuffers[imageIndex];
+	indices.swap(output);
+}
 
-		VkSemaphore signalSemaphores[] = { _renderFinishedSemaphores[_currentFrame] };
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
+// renumbers vertices in first-use order so vertex fetch walks memory linearly; unreferenced vertices are dropped
+static void optimizeVertexFetch(Mesh& mesh)
+{
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<Vertex> ordered;
+	ordered.reserve(mesh.vertices.size());
 
-		vkResetFences(_device, 1, &_inFlightFences[_currentFrame]);
-		if (vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _inFlightFences[_currentFrame]) != VK_SUCCESS)
+	for (uint32_t& index : mesh.indices)
+	{
+		if (remap[index] == UINT32_MAX)
 		{
-			throw std::runtime_error("Failed to submit draw command buffer");
+			remap[index] = static_cast<uint32_t>(ordered.size());
+			ordered.push_back(mesh.vertices[index]);
 		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(ordered);
+}
 
-		VkPresentInfoKHR presentInfo = {};
-		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+// size x size quads over most of clip space as a non-indexed triangle list. Quads are emitted in a
+// scrambled order, like an unoptimized export, so the cache optimization has something to do.
+static std::vector<Vertex> makeGridTriangleList(uint32_t size)
+{
+	std::vector<uint32_t> quadOrder(size * size);
+	for (uint32_t i = 0; i < quadOrder.size(); i++)
+	{
+		quadOrder[i] = i;
+	}
+	uint32_t seed = 12345;
+	for (size_t i = quadOrder.size(); i > 1; i--)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		std::swap(quadOrder[i - 1], quadOrder[seed % i]);
+	}
 
-		presentInfo.waitSemaphoreCount = 1;
-		presentInfo.pWaitSemaphores = signalSemaphores;
+	auto corner = [size](uint32_t x, uint32_t y) -> Vertex
+	{
+		float u = float(x) / size;
+		float v = float(y) / size;
+		return { { -0.9f + 1.8f * u, -0.9f + 1.8f * v }, { u, v, 1.0f - u } };
+	};
 
-		VkSwapchainKHR swapChains[] = { _swapChain };
-		presentInfo.swapchainCount = 1;
-		presentInfo.pSwapchains = swapChains;
-		presentInfo.pImageIndices = &imageIndex;
+	std::vector<Vertex> triangleList;
+	triangleList.reserve(quadOrder.size() * 6);
+	for (uint32_t quad : quadOrder)
+	{
+		uint32_t x = quad % size;
+		uint32_t y = quad / size;
+		Vertex v00 = corner(x, y), v10 = corner(x + 1, y), v01 = corner(x, y + 1), v11 = corner(x + 1, y + 1);
+		triangleList.insert(triangleList.end(), { v00, v10, v11, v00, v11, v01 });
+	}
+	return triangleList;
+}
 
-		presentInfo.pResults = nullptr;
+//====================== GPU Memory ==========================
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
 
-		result = vkQueuePresentKHR(_presentQueue, &presentInfo);
-		if (result == VK_ERROR_OUT_OF_POOL_MEMORY_KHR || result == VK_SUBOPTIMAL_KHR || _framebufferResized)
+// a range of a larger VkDeviceMemory block handed out by GpuAllocator
+struct GpuAllocation
+{
+	VkDeviceMemory	memory = VK_NULL_HANDLE;
+	VkDeviceSize	offset = 0;
+	VkDeviceSize	size = 0;
+	void*			mapped = nullptr;		// persistent host pointer, only for host-visible memory
+	uint32_t		memoryTypeIndex = 0;
+	uint32_t		blockIndex = 0;
+	bool			image = false;			// optimal-tiling resource, accounted separately from buffers
+};
+
+// Block based sub-allocator. Grabs large VkDeviceMemory blocks per memory type and hands out aligned
+// ranges from a sorted free-list (first fit, neighbours are coalesced on free). Requests bigger than
+// half a block get a dedicated allocation.
+// bufferImageGranularity: optimal-tiling resources are padded to whole granularity pages, so linear
+// and optimal resources never share a page.
+// Every block and allocation is also accounted per memory heap. With VK_EXT_memory_budget the driver's
+// process-wide usage and budget are fetched by updateBudget(), blocks created since then are added on top;
+// without it the budget is a fixed share of the heap and usage is what this allocator holds.
+class GpuAllocator
+{
+public:
+	// one memory heap as seen by the renderer
+	struct HeapBudget
+	{
+		VkDeviceSize	heapSize = 0;
+		bool			deviceLocal = false;
+		VkDeviceSize	blockBytes = 0;			// VkDeviceMemory blocks of this allocator
+		VkDeviceSize	bufferBytes = 0;		// handed out to buffers, including alignment padding
+		VkDeviceSize	imageBytes = 0;			// handed out to images, including granularity padding
+		uint32_t		allocationCount = 0;
+		VkDeviceSize	usage = 0;				// estimated bytes in use by the process
+		VkDeviceSize	budget = 0;				// bytes the process should stay within
+
+		double pressure() const
 		{
-			_framebufferResized = false;
-			_recreateSwapChain();
+			return budget > 0 ? (double)usage / (double)budget : 0.0;
 		}
-		else if (result != VK_SUCCESS)
+	};
+
+	struct Stats
+	{
+		uint32_t		blockCount = 0;
+		uint32_t		allocationCount = 0;
+		VkDeviceSize	reservedBytes = 0;		// sum of all VkDeviceMemory blocks
+		VkDeviceSize	usedBytes = 0;			// bytes handed out, including alignment padding
+		VkDeviceSize	freeBytes = 0;
+		VkDeviceSize	largestFreeRange = 0;
+		uint32_t		freeRangeCount = 0;
+
+		// 0 = all free memory is one contiguous range, close to 1 = free memory is scattered
+		double fragmentation() const
 		{
-			throw std::runtime_error("Failed to present swap chain image!");
+			return freeBytes > 0 ? 1.0 - (double)largestFreeRange / (double)freeBytes : 0.0;
 		}
+	};
+
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize blockSize = 64ull * 1024 * 1024)
+	{
+		_device = device;
+		_blockSize = blockSize;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		_bufferImageGranularity = properties.limits.bufferImageGranularity;
+		_maxAllocationCount = properties.limits.maxMemoryAllocationCount;
 
-		_currentFrame = (_currentFrame + 1) % MAX_FRAMES;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_memProperties);
+		_heaps.assign(_memProperties.memoryHeapCount, HeapState());
 	}
 
-	void _initVulkan()
+	// enables driver budgets; getMemoryProperties2 is the VK_KHR_get_physical_device_properties2 entry point
+	void enableBudgetQuery(VkPhysicalDevice physicalDevice, PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2)
 	{
-		_createInstance();
-		_createSurface(); // The window surface needs to be created right after the instance creation
-		_setupMessenger();
-		_pickPhysicalDevice();
-		_createLogicDevice();
-		_createSwapchain();
-		_createImageViews();
-		_createRenderPass();
-		_createGraphicsPipeline();
-		_createFrameBuffers();
-		_createCommandPool();
-		_createVertexBuffers();
-		_createCommandBuffers();
-		_createSyncObjects();
+		_physicalDevice = physicalDevice;
+		_getMemoryProperties2 = getMemoryProperties2;
+		updateBudget();
 	}
 
-	uint32_t _findeMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+	bool hasDriverBudget() const
 	{
-		VkPhysicalDeviceMemoryProperties memProperties;
-		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memProperties);
+		return _getMemoryProperties2 != nullptr;
+	}
 
-		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+	// refetches the driver's usage and budget; cheap, but not free, so once per frame rather than per allocation
+	void updateBudget()
+	{
+		if (!_getMemoryProperties2)
+			return;
+
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+		VkPhysicalDeviceMemoryProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties2.pNext = &budgetProperties;
+		_getMemoryProperties2(_physicalDevice, &properties2);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (uint32_t i = 0; i < _heaps.size(); i++)
 		{
-			if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-			{
-				return i;
-			}
+			_heaps[i].driverUsage = budgetProperties.heapUsage[i];
+			_heaps[i].driverBudget = budgetProperties.heapBudget[i];
+			_heaps[i].blockBytesAtFetch = _heaps[i].blockBytes;
 		}
-
-		throw std::runtime_error("Failed to find suitable memory type!");
 	}
 
-	void _createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+	uint32_t heapIndex(uint32_t memoryTypeIndex) const
 	{
-		VkBufferCreateInfo vertexBufferInfo = {};
-		vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		vertexBufferInfo.size = size;
+		return _memProperties.memoryTypes[memoryTypeIndex].heapIndex;
+	}
 
-		vertexBufferInfo.usage = usage;
-		vertexBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	std::vector<HeapBudget> getBudgets() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
 
-		if (vkCreateBuffer(_device, &vertexBufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		std::vector<HeapBudget> budgets(_heaps.size());
+		for (uint32_t i = 0; i < _heaps.size(); i++)
 		{
-			throw std::runtime_error("Failed to create vertex buffer!");
+			budgets[i] = _heapBudget(i);
 		}
+		return budgets;
+	}
 
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
-
-		VkMemoryAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = _findeMemoryType(memRequirements.memoryTypeBits, properties);
-
-		if (vkAllocateMemory(_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+	// highest usage / budget over the device-local heaps, the ones streamed resources compete for
+	double deviceLocalPressure() const
+	{
+		double pressure = 0.0;
+		for (const HeapBudget& heap : getBudgets())
 		{
-			throw std::runtime_error("Failed to allocate vertex buffer memory!");
+			if (heap.deviceLocal)
+			{
+				pressure = std::max(pressure, heap.pressure());
+			}
 		}
+		return pressure;
+	}
 
-		vkBindBufferMemory(_device, buffer, bufferMemory, 0);
+	void printBudgets() const
+	{
+		std::vector<HeapBudget> budgets = getBudgets();
+		for (uint32_t i = 0; i < budgets.size(); i++)
+		{
+			const HeapBudget& heap = budgets[i];
+			std::cout << "memory heap " << i << (heap.deviceLocal ? " (device local)" : "") << ": " << heap.usage / (1024 * 1024) << " of "
+				<< heap.budget / (1024 * 1024) << " MiB budget (" << static_cast<int>(heap.pressure() * 100.0) << "%), this allocator "
+				<< heap.blockBytes / (1024 * 1024) << " MiB in blocks, " << heap.bufferBytes / 1024 << " KiB buffers, "
+				<< heap.imageBytes / 1024 << " KiB images in " << heap.allocationCount << " allocations" << std::endl;
+		}
 	}
 
-	void _copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+	GpuAllocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool optimalTiling)
 	{
-		VkCommandBufferAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandPool = _commandPool;
-		allocInfo.commandBufferCount = 1;
-
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(_device, &allocInfo, &commandBuffer);
-
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		std::lock_guard<std::mutex> lock(_mutex);
 
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		VkDeviceSize alignment = requirements.alignment;
+		VkDeviceSize size = requirements.size;
+		if (optimalTiling)
+		{
+			alignment = std::max(alignment, _bufferImageGranularity);
+			size = alignUp(size, _bufferImageGranularity);
+		}
 
-		VkBufferCopy copyRegion = {};
-		copyRegion.srcOffset = 0;
-		copyRegion.dstOffset = 0;
-		copyRegion.size = size;
-		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-		
-		vkEndCommandBuffer(commandBuffer);
+		// large resources get their own block instead of eating a shared one
+		if (size > _blockSize / 2)
+		{
+			uint32_t blockIndex = _createBlock(memoryTypeIndex, size, true);
+			return _takeRange(blockIndex, 0, 0, size, optimalTiling);
+		}
 
-		// submit
-		VkSubmitInfo submitInfo = {};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
+		for (uint32_t i = 0; i < _blocks.size(); i++)
+		{
+			Block& block = _blocks[i];
+			if (block.memory == VK_NULL_HANDLE || block.dedicated || block.memoryTypeIndex != memoryTypeIndex)
+				continue;
 
-		vkQueueSubmit(_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(_graphicsQueue);
+			for (size_t r = 0; r < block.freeList.size(); r++)
+			{
+				VkDeviceSize offset = alignUp(block.freeList[r].offset, alignment);
+				if (offset + size <= block.freeList[r].offset + block.freeList[r].size)
+				{
+					return _takeRange(i, r, offset, size, optimalTiling);
+				}
+			}
+		}
 
-		// clean up
-		vkFreeCommandBuffers(_device, _commandPool, 1, &commandBuffer);
+		uint32_t blockIndex = _createBlock(memoryTypeIndex, _blockSize, false);
+		return _takeRange(blockIndex, 0, 0, size, optimalTiling);
 	}
 
-	void _createVertexBuffers()
+	void free(const GpuAllocation& allocation)
 	{
-		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+		if (allocation.memory == VK_NULL_HANDLE)
+			return;
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-		_createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+		std::lock_guard<std::mutex> lock(_mutex);
 
-		void* data;
-		vkMapMemory(_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(_device, stagingBufferMemory);
+		Block& block = _blocks[allocation.blockIndex];
+		block.usedBytes -= allocation.size;
+		block.allocationCount--;
 
-		_createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertexBuffer, _vertexBufferMemory);
+		HeapState& heap = _heaps[heapIndex(block.memoryTypeIndex)];
+		(allocation.image ? heap.imageBytes : heap.bufferBytes) -= allocation.size;
+		heap.allocationCount--;
 
-		_copyBuffer(stagingBuffer, _vertexBuffer, bufferSize);
+		if (block.dedicated)
+		{
+			_releaseBlock(block);
+			return;
+		}
 
-		vkDestroyBuffer(_device, stagingBuffer, nullptr);
-		vkFreeMemory(_device, stagingBufferMemory, nullptr);
-	}
+		// insert sorted by offset and merge with the neighbours
+		auto it = std::lower_bound(block.freeList.begin(), block.freeList.end(), allocation.offset,
+			[](const FreeRange& range, VkDeviceSize offset) { return range.offset < offset; });
+		it = block.freeList.insert(it, { allocation.offset, allocation.size });
 
+		auto next = it + 1;
+		if (next != block.freeList.end() && it->offset + it->size == next->offset)
+		{
+			it->size += next->size;
+			block.freeList.erase(next);
+		}
+		if (it != block.freeList.begin())
+		{
+			auto prev = it - 1;
+			if (prev->offset + prev->size == it->offset)
+			{
+				prev->size += it->size;
+				block.freeList.erase(it);
+			}
+		}
+	}
 
-	void _createSyncObjects()
+	void destroy()
 	{
-		_imageAvailableSemaphores.resize(MAX_FRAMES);
-		_renderFinishedSemaphores.resize(MAX_FRAMES);
-		_inFlightFences.resize(MAX_FRAMES);
-		_imagesInFlight.resize(_swapChainImages.size(), VK_NULL_HANDLE);
-
-		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		for (Block& block : _blocks)
+		{
+			if (block.memory != VK_NULL_HANDLE)
+			{
+				_releaseBlock(block);
+			}
+		}
+		_blocks.clear();
+	}
 
-		VkFenceCreateInfo fenceInfo = {};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	Stats getStats() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
 
-		for (size_t i = 0; i < MAX_FRAMES; ++i)
+		Stats stats;
+		for (const Block& block : _blocks)
 		{
-			if (vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_imageAvailableSemaphores[i]) != VK_SUCCESS ||
-				vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderFinishedSemaphores[i]) != VK_SUCCESS ||
-				vkCreateFence(_device, &fenceInfo, nullptr, &_inFlightFences[i]) != VK_SUCCESS)
+			if (block.memory == VK_NULL_HANDLE)
+				continue;
+
+			stats.blockCount++;
+			stats.allocationCount += block.allocationCount;
+			stats.reservedBytes += block.size;
+			stats.usedBytes += block.usedBytes;
+			for (const FreeRange& range : block.freeList)
 			{
-				throw std::runtime_error("Failed to create synchronization objects for a frame!");
+				stats.freeBytes += range.size;
+				stats.largestFreeRange = std::max(stats.largestFreeRange, range.size);
+				stats.freeRangeCount++;
 			}
 		}
+		return stats;
 	}
 
-	void _createCommandBuffers()
+	void printStats() const
 	{
-		_commandBuffers.resize(_swapChainFrameBuffers.size());
+		Stats stats = getStats();
+		std::cout << "gpu memory: " << stats.allocationCount << " allocations in " << stats.blockCount << " blocks, "
+			<< stats.usedBytes / 1024 << " KiB used of " << stats.reservedBytes / 1024 << " KiB reserved, "
+			<< stats.freeRangeCount << " free ranges, fragmentation " << stats.fragmentation() << std::endl;
+	}
 
-		VkCommandBufferAllocateInfo allocInfo = {};
-		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		allocInfo.commandPool = _commandPool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		allocInfo.commandBufferCount = (uint32_t)_commandBuffers.size();
+private:
+	struct FreeRange
+	{
+		VkDeviceSize	offset;
+		VkDeviceSize	size;
+	};
+
+	struct Block
+	{
+		VkDeviceMemory			memory = VK_NULL_HANDLE;
+		VkDeviceSize			size = 0;
+		void*					mapped = nullptr;
+		uint32_t				memoryTypeIndex = 0;
+		bool					dedicated = false;
+		std::vector<FreeRange>	freeList;			// sorted by offset
+		VkDeviceSize			usedBytes = 0;
+		uint32_t				allocationCount = 0;
+	};
 
-		if (vkAllocateCommandBuffers(_device, &allocInfo, _commandBuffers.data()) != VK_SUCCESS)
+	uint32_t _createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated)
+	{
+		if (_liveAllocationCount >= _maxAllocationCount)
 		{
-			throw std::runtime_error("Failed to create command buffers!");
+			throw std::runtime_error("Exceeded maxMemoryAllocationCount!");
 		}
 
-		for (size_t i = 0; i < _commandBuffers.size(); i++)
+		Block block;
+		block.size = size;
+		block.memoryTypeIndex = memoryTypeIndex;
+		block.dedicated = dedicated;
+		block.freeList.push_back({ 0, size });
+
+		// going over budget still works on most drivers, but memory gets paged out or allocations start failing;
+		// warned once per heap until usage drops below the budget again
+		const uint32_t heapIndex = this->heapIndex(memoryTypeIndex);
+		HeapState& heap = _heaps[heapIndex];
+		HeapBudget before = _heapBudget(heapIndex);
+		if (before.usage + size > before.budget)
 		{
-			VkCommandBufferBeginInfo beginInfo = {};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0;
-			beginInfo.pInheritanceInfo = nullptr;
-
-			if (vkBeginCommandBuffer(_commandBuffers[i], &beginInfo) != VK_SUCCESS)
+			if (!heap.overBudgetWarned)
 			{
-				throw std::runtime_error("Failed to begin recording command buffer!");
+				std::cerr << "gpu memory: heap " << heapIndex << " goes over budget, " << (before.usage + size) / (1024 * 1024) << " of "
+					<< before.budget / (1024 * 1024) << " MiB" << std::endl;
+				heap.overBudgetWarned = true;
 			}
+		}
+		else
+		{
+			heap.overBudgetWarned = false;
+		}
 
-			VkRenderPassBeginInfo renderPassBeginInfo = {};
-			renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassBeginInfo.renderPass = _renderPass;
-			renderPassBeginInfo.framebuffer = _swapChainFrameBuffers[i];
-
-			renderPassBeginInfo.renderArea.offset = { 0, 0 };
-			renderPassBeginInfo.renderArea.extent = _swapChainExtent;
-
-			VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-			renderPassBeginInfo.clearValueCount = 1;
-			renderPassBeginInfo.pClearValues = &clearColor;
-
-			vkCmdBeginRenderPass(_commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-			vkCmdBindPipeline(_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipeline);
-
-			VkBuffer vertexBuffers[] = { _vertexBuffer };
-			VkDeviceSize offset[] = { 0 };
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
 
-			vkCmdBindVertexBuffers(_commandBuffers[i], 0, 1, vertexBuffers, offset);
+		if (vkAllocateMemory(_device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate device memory block of " + std::to_string(size / 1024) + " KiB in heap " +
+				std::to_string(heapIndex) + ", " + std::to_string(before.usage / (1024 * 1024)) + " of " +
+				std::to_string(before.budget / (1024 * 1024)) + " MiB budget in use!");
+		}
+		_liveAllocationCount++;
+		heap.blockBytes += size;
 
-			vkCmdDraw(_commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-			vkCmdEndRenderPass(_commandBuffers[i]);
+		// a VkDeviceMemory can only be mapped once, so host-visible blocks stay mapped for their lifetime
+		if (_memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			if (vkMapMemory(_device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to map device memory block!");
+			}
+		}
 
-			if (vkEndCommandBuffer(_commandBuffers[i]) != VK_SUCCESS)
+		// reuse the slot of a released block so allocation.blockIndex stays valid
+		for (uint32_t i = 0; i < _blocks.size(); i++)
+		{
+			if (_blocks[i].memory == VK_NULL_HANDLE)
 			{
-				throw std::runtime_error("Failed to record command buffer!");
+				_blocks[i] = std::move(block);
+				return i;
 			}
 		}
+		_blocks.push_back(std::move(block));
+		return static_cast<uint32_t>(_blocks.size() - 1);
 	}
 
-	void _createCommandPool()
+	void _releaseBlock(Block& block)
 	{
-		QueueFamilyIndices queueFamilyIndice = _findQueueFamily(_physicalDevice);
-
-		VkCommandPoolCreateInfo poolInfo = {};
-		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		poolInfo.queueFamilyIndex = queueFamilyIndice.graphicsFamily.value();
-		poolInfo.flags = 0;
-
-		if (vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool) != VK_SUCCESS)
+		if (block.mapped)
 		{
-			throw std::runtime_error("Failed to create Command pool");
+			vkUnmapMemory(_device, block.memory);
 		}
+		vkFreeMemory(_device, block.memory, nullptr);
+		_liveAllocationCount--;
+		_heaps[heapIndex(block.memoryTypeIndex)].blockBytes -= block.size;
+
+		block = Block();
 	}
-	
-	void _createFrameBuffers()
+
+	// carves [offset, offset + size) out of free range rangeIndex, the alignment padding in front stays free
+	GpuAllocation _takeRange(uint32_t blockIndex, size_t rangeIndex, VkDeviceSize offset, VkDeviceSize size, bool image)
 	{
-		_swapChainFrameBuffers.resize(_swapChainImageViews.size());
+		Block& block = _blocks[blockIndex];
+		FreeRange range = block.freeList[rangeIndex];
+		block.freeList.erase(block.freeList.begin() + rangeIndex);
 
-		for (size_t i = 0; i < _swapChainImageViews.size(); ++i)
+		VkDeviceSize tailOffset = offset + size;
+		VkDeviceSize rangeEnd = range.offset + range.size;
+		if (rangeEnd > tailOffset)
+		{
+			block.freeList.insert(block.freeList.begin() + rangeIndex, { tailOffset, rangeEnd - tailOffset });
+		}
+		if (offset > range.offset)
 		{
-			VkImageView attachments[] = { _swapChainImageViews[i] };
+			block.freeList.insert(block.freeList.begin() + rangeIndex, { range.offset, offset - range.offset });
+		}
 
-			VkFramebufferCreateInfo frameBufferInfo = {};
-			frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-			frameBufferInfo.renderPass = _renderPass;
-			frameBufferInfo.attachmentCount = 1;
-			frameBufferInfo.pAttachments = attachments;
-			frameBufferInfo.width = _swapChainExtent.width;
-			frameBufferInfo.height = _swapChainExtent.height;
-			frameBufferInfo.layers = 1;
+		block.usedBytes += size;
+		block.allocationCount++;
+
+		HeapState& heap = _heaps[heapIndex(block.memoryTypeIndex)];
+		(image ? heap.imageBytes : heap.bufferBytes) += size;
+		heap.allocationCount++;
+
+		GpuAllocation allocation;
+		allocation.memory = block.memory;
+		allocation.offset = offset;
+		allocation.size = size;
+		allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+		allocation.memoryTypeIndex = block.memoryTypeIndex;
+		allocation.blockIndex = blockIndex;
+		allocation.image = image;
+		return allocation;
+	}
 
-			if (vkCreateFramebuffer(_device, &frameBufferInfo, nullptr, &_swapChainFrameBuffers[i]) != VK_SUCCESS)
-			{
-				throw std::runtime_error("Failed to create framebuffer");
-			}
+	// called with _mutex held
+	HeapBudget _heapBudget(uint32_t heapIndex) const
+	{
+		const HeapState& state = _heaps[heapIndex];
+		const VkMemoryHeap& memoryHeap = _memProperties.memoryHeaps[heapIndex];
+
+		HeapBudget heap;
+		heap.heapSize = memoryHeap.size;
+		heap.deviceLocal = (memoryHeap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		heap.blockBytes = state.blockBytes;
+		heap.bufferBytes = state.bufferBytes;
+		heap.imageBytes = state.imageBytes;
+		heap.allocationCount = state.allocationCount;
+
+		if (_getMemoryProperties2)
+		{
+			// blocks freed since the fetch can take the estimate below what the driver reported
+			VkDeviceSize usage = state.driverUsage + state.blockBytes;
+			heap.usage = usage > state.blockBytesAtFetch ? usage - state.blockBytesAtFetch : 0;
+			heap.budget = state.driverBudget;
+		}
+		else
+		{
+			// the rest of the system shares the heap too; 80% is the usual rule of thumb
+			heap.usage = state.blockBytes;
+			heap.budget = memoryHeap.size / 10 * 8;
 		}
+		return heap;
 	}
 
-	void _createRenderPass()
+	struct HeapState
 	{
-		VkAttachmentDescription colorAttachment = {};
-		colorAttachment.format = _swapChainImageFormat;
-		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-		// SUBPASS
-		// attachment references
-		VkAttachmentReference colorAttachmentRef = {};
-		colorAttachmentRef.attachment = 0;
-		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &colorAttachmentRef;
+		VkDeviceSize	blockBytes = 0;
+		VkDeviceSize	bufferBytes = 0;
+		VkDeviceSize	imageBytes = 0;
+		uint32_t		allocationCount = 0;
+		VkDeviceSize	driverUsage = 0;		// VK_EXT_memory_budget values of the last updateBudget()
+		VkDeviceSize	driverBudget = 0;
+		VkDeviceSize	blockBytesAtFetch = 0;
+		bool			overBudgetWarned = false;
+	};
 
-		VkRenderPassCreateInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.attachmentCount = 1;
-		renderPassInfo.pAttachments = &colorAttachment;
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
+	VkDevice							_device = VK_NULL_HANDLE;
+	VkPhysicalDevice					_physicalDevice = VK_NULL_HANDLE;
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR	_getMemoryProperties2 = nullptr;
+	std::vector<HeapState>				_heaps;
+	VkPhysicalDeviceMemoryProperties	_memProperties = {};
+	VkDeviceSize						_blockSize = 0;
+	VkDeviceSize						_bufferImageGranularity = 1;
+	uint32_t							_maxAllocationCount = 0;
+	uint32_t							_liveAllocationCount = 0;
+	std::vector<Block>					_blocks;
+	mutable std::mutex					_mutex;
+};
 
-		// subpass dependencies
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
+//====================== Threading ==========================
+// Fixed set of worker threads pulling jobs from one queue.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(uint32_t threadCount)
+	{
+		for (uint32_t i = 0; i < threadCount; i++)
+		{
+			_workers.emplace_back([this]() { _workerLoop(); });
+		}
+	}
 
-		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.srcAccessMask = 0;
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
 
-		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		for (auto& worker : _workers)
+		{
+			worker.join();
+		}
+	}
 
-		renderPassInfo.dependencyCount = 1;
-		renderPassInfo.pDependencies = &dependency;
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(_workers.size());
+	}
 
-		if (vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_renderPass) != VK_SUCCESS)
+	std::future<void> submit(std::function<void()> job)
+	{
+		auto task = std::make_shared<std::packaged_task<void()>>(std::move(job));
+		std::future<void> result = task->get_future();
 		{
-			throw std::runtime_error("Failed to create render pass!");
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.push_back([task]() { (*task)(); });
 		}
+		_wake.notify_one();
+		return result;
 	}
 
-	void _createGraphicsPipeline()
+	// runs fn(0) .. fn(count - 1) on the workers and blocks until all of them returned;
+	// the first exception thrown by a job is rethrown here
+	void parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn)
 	{
-		auto vertShaderCode = readFile("shaders/vert.spv");
-		auto fragShaderCode = readFile("shaders/frag.spv");
+		std::vector<std::future<void>> results;
+		results.reserve(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			results.push_back(submit([&fn, i]() { fn(i); }));
+		}
 
-		VkShaderModule vertShaderModule = _createShaderModule(vertShaderCode);
-		VkShaderModule fragShaderModule = _createShaderModule(fragShaderCode);
+		for (auto& result : results)
+		{
+			result.wait();
+		}
+		for (auto& result : results)
+		{
+			result.get();
+		}
+	}
 
-		// shader stage
-		VkPipelineShaderStageCreateInfo vertShaderStageCreateInfo = {};
-		vertShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vertShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vertShaderStageCreateInfo.module = vertShaderModule;
-		vertShaderStageCreateInfo.pName = "main";
+private:
+	void _workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+				if (_stopping && _jobs.empty())
+					return;
 
-		VkPipelineShaderStageCreateInfo fragShaderStageCreateInfo = {};
-		fragShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		fragShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		fragShaderStageCreateInfo.module = fragShaderModule;
-		fragShaderStageCreateInfo.pName = "main";
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+			}
+			job();
+		}
+	}
 
-		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageCreateInfo, fragShaderStageCreateInfo };
+	std::vector<std::thread>			_workers;
+	std::deque<std::function<void()>>	_jobs;
+	std::mutex							_mutex;
+	std::condition_variable				_wake;
+	bool								_stopping = false;
+};
 
-		// vertex input
-		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+// waits for submitted frames to complete on its own thread, so submit->complete latency is measured without
+// serializing the render loop on every frame
+class FrameLatencyProbe
+{
+public:
+	explicit FrameLatencyProbe(uint64_t lastFrameNumber) : _probedFrame(lastFrameNumber)
+	{
+		_thread = std::thread([this] { _run(); });
+	}
 
-		auto bindingDescription = Vertex::getBindingDescription();
-		auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	~FrameLatencyProbe()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_condition.notify_all();
+		_thread.join();
+	}
 
-		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	// waitComplete blocks until the frame has finished on the gpu, it runs on the probe thread
+	void submitted(uint64_t frameNumber, std::function<void()> waitComplete, std::chrono::high_resolution_clock::time_point submitEnd)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_pending.push_back({ frameNumber, std::move(waitComplete), submitEnd });
+		}
+		_condition.notify_all();
+	}
 
-		// input assembly
-		VkPipelineInputAssemblyStateCreateInfo inputAssmbly = {};
-		inputAssmbly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssmbly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-		inputAssmbly.primitiveRestartEnable = VK_FALSE;
+	// blocks until every frame up to frameNumber has been probed; their fences may be reset afterwards
+	void waitProbed(uint64_t frameNumber)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [&] { return _probedFrame >= frameNumber; });
+	}
 
-		// viewports and scissors
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float)_swapChainExtent.width;
-		viewport.height = (float)_swapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
+	FrameStats latencies()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _latencies;
+	}
 
-		VkRect2D scissor = {};
-		scissor.offset = { 0, 0 };
-		scissor.extent = _swapChainExtent;
+private:
+	struct Frame
+	{
+		uint64_t				frameNumber;
+		std::function<void()>	waitComplete;
+		std::chrono::high_resolution_clock::time_point	submitEnd;
+	};
 
-		VkPipelineViewportStateCreateInfo viewportsCreateInfo = {};
-		viewportsCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewportsCreateInfo.viewportCount = 1;
-		viewportsCreateInfo.pViewports = &viewport;
-		viewportsCreateInfo.scissorCount = 1;
-		viewportsCreateInfo.pScissors = &scissor;
+	void _run()
+	{
+		for (;;)
+		{
+			Frame frame;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_condition.wait(lock, [&] { return _stop || !_pending.empty(); });
+				if (_pending.empty())
+					return;
+				frame = _pending.front();
+			}
 
-		// rasterizer
-		VkPipelineRasterizationStateCreateInfo rasterizer = {};
-		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		rasterizer.depthClampEnable = VK_FALSE;
-		rasterizer.rasterizerDiscardEnable = VK_FALSE;
-		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-		rasterizer.lineWidth = 1.0f;
-		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-		rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-		rasterizer.depthBiasEnable = VK_FALSE;
-		rasterizer.depthBiasConstantFactor = 0.0f;
-		rasterizer.depthBiasClamp = 0.0f;
-		rasterizer.depthBiasSlopeFactor = 0.0f;
+			frame.waitComplete();
+			double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frame.submitEnd).count();
 
-		// multisampling
-		VkPipelineMultisampleStateCreateInfo multisampling = {};
-		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampling.sampleShadingEnable = VK_FALSE;
-		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisampling.minSampleShading = 1.0f;
-		multisampling.pSampleMask = nullptr;
-		multisampling.alphaToCoverageEnable = VK_FALSE;
-		multisampling.alphaToOneEnable = VK_FALSE;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_latencies.add(latencyMs);
+				_pending.pop_front();
+				_probedFrame = frame.frameNumber;
+			}
+			_condition.notify_all();
+		}
+	}
 
-		// color blending
-		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		colorBlendAttachment.blendEnable = VK_FALSE;
-		colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-		colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+	std::mutex					_mutex;
+	std::condition_variable		_condition;
+	std::deque<Frame>			_pending;
+	uint64_t					_probedFrame;
+	FrameStats					_latencies;
+	bool						_stop = false;
+	std::thread					_thread;
+};
 
+//====================== Startup ==========================
+// Initialization steps with their dependencies. A step starts as soon as all of its dependencies are done:
+// worker steps on the pool, main-thread steps (window system calls) on the thread calling run().
+// Start and end of every step are recorded for the startup timeline.
+class StartupGraph
+{
+public:
+	struct Step
+	{
+		std::string				name;
+		std::vector<size_t>		dependencies;
+		std::function<void()>	run;
+		bool					mainThread = false;
+		double					startMs = 0.0;	// relative to run()
+		double					endMs = 0.0;
+	};
 
-		VkPipelineColorBlendStateCreateInfo colorBlending = {};
-		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		colorBlending.logicOpEnable = VK_FALSE;
-		colorBlending.logicOp = VK_LOGIC_OP_COPY;
-		colorBlending.attachmentCount = 1;
-		colorBlending.pAttachments = &colorBlendAttachment;
-		colorBlending.blendConstants[0] = 0.0f;
-		colorBlending.blendConstants[1] = 0.0f;
-		colorBlending.blendConstants[2] = 0.0f;
-		colorBlending.blendConstants[3] = 0.0f;
+	// dependencies are indices returned by earlier add() calls, so the graph cannot have cycles
+	size_t add(const std::string& name, std::vector<size_t> dependencies, std::function<void()> run, bool mainThread = false)
+	{
+		for (size_t dependency : dependencies)
+		{
+			if (dependency >= _steps.size())
+			{
+				throw std::runtime_error("Startup step " + name + " depends on a later step!");
+			}
+		}
 
-		// pipeline layout
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		pipelineLayoutInfo.setLayoutCount = 0;
-		pipelineLayoutInfo.pSetLayouts = nullptr;
-		pipelineLayoutInfo.pushConstantRangeCount = 0;
-		pipelineLayoutInfo.pPushConstantRanges = nullptr;
+		Step step;
+		step.name = name;
+		step.dependencies = std::move(dependencies);
+		step.run = std::move(run);
+		step.mainThread = mainThread;
+		_steps.push_back(std::move(step));
+		return _steps.size() - 1;
+	}
 
-		if (vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS)
+	// blocks until every step has run; after a failure no further steps start and the first exception is rethrown
+	// once the running ones have returned
+	void run(ThreadPool& pool)
+	{
+		_start = std::chrono::high_resolution_clock::now();
+		_remaining.assign(_steps.size(), 0);
+		_dependents.assign(_steps.size(), std::vector<size_t>());
+		for (size_t i = 0; i < _steps.size(); i++)
 		{
-			throw std::runtime_error("Failed to create Pipeline layout!");
+			_remaining[i] = static_cast<uint32_t>(_steps[i].dependencies.size());
+			for (size_t dependency : _steps[i].dependencies)
+			{
+				_dependents[dependency].push_back(i);
+			}
 		}
 
+		std::unique_lock<std::mutex> lock(_mutex);
+		for (size_t i = 0; i < _steps.size(); i++)
+		{
+			if (_remaining[i] == 0)
+			{
+				_launch(pool, i);
+			}
+		}
 
-		VkGraphicsPipelineCreateInfo graphicsPipelineInfo = {};
-		graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		graphicsPipelineInfo.stageCount = 2;
-		graphicsPipelineInfo.pStages = shaderStages;
+		for (;;)
+		{
+			_changed.wait(lock, [&] { return !_mainReady.empty() || _finished == _steps.size() || (_error && _running == 0); });
+			if (_finished == _steps.size() || (_error && _running == 0))
+				break;
 
-		graphicsPipelineInfo.pVertexInputState = &vertexInputInfo;
-		graphicsPipelineInfo.pInputAssemblyState = &inputAssmbly;
-		graphicsPipelineInfo.pViewportState = &viewportsCreateInfo;
-		graphicsPipelineInfo.pRasterizationState = &rasterizer;
-		graphicsPipelineInfo.pMultisampleState = &multisampling;
-		graphicsPipelineInfo.pDepthStencilState = nullptr;
-		graphicsPipelineInfo.pColorBlendState = &colorBlending;
-		graphicsPipelineInfo.pDynamicState = nullptr;
+			size_t step = _mainReady.front();
+			_mainReady.pop_front();
+			lock.unlock();
+			_execute(pool, step);
+			lock.lock();
+		}
 
-		graphicsPipelineInfo.layout = _pipelineLayout;
+		if (_error)
+		{
+			std::rethrow_exception(_error);
+		}
+	}
 
-		graphicsPipelineInfo.renderPass = _renderPass;
-		graphicsPipelineInfo.subpass = 0;
+	// wall time of run()
+	double totalMs() const
+	{
+		double total = 0.0;
+		for (const Step& step : _steps)
+		{
+			total = std::max(total, step.endMs);
+		}
+		return total;
+	}
 
-		graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-		graphicsPipelineInfo.basePipelineIndex = -1;
+	// one line per step in start order; the critical path is the chain of last-finishing dependencies
+	// leading to the last step to finish
+	void report() const
+	{
+		std::vector<bool> critical(_steps.size(), false);
+		size_t last = 0;
+		for (size_t i = 0; i < _steps.size(); i++)
+		{
+			if (_steps[i].endMs > _steps[last].endMs)
+				last = i;
+		}
+		for (size_t step = last; step < _steps.size();)
+		{
+			critical[step] = true;
+			size_t next = _steps.size();
+			for (size_t dependency : _steps[step].dependencies)
+			{
+				if (next == _steps.size() || _steps[dependency].endMs > _steps[next].endMs)
+					next = dependency;
+			}
+			step = next;
+		}
 
-		if (vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &_graphicsPipeline) != VK_SUCCESS)
+		std::vector<size_t> order(_steps.size());
+		for (size_t i = 0; i < order.size(); i++)
 		{
-			throw std::runtime_error("Failed create graphics pipeline!");
+			order[i] = i;
 		}
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return _steps[a].startMs < _steps[b].startMs; });
 
-		vkDestroyShaderModule(_device, fragShaderModule, nullptr);
-		vkDestroyShaderModule(_device, vertShaderModule, nullptr);
+		double summedMs = 0.0;
+		std::cout << "startup timeline (ms from start, wall ms, * = critical path):" << std::endl;
+		for (size_t i : order)
+		{
+			const Step& step = _steps[i];
+			double wallMs = step.endMs - step.startMs;
+			summedMs += wallMs;
+
+			char line[128];
+			snprintf(line, sizeof(line), "  %-20s %-6s %8.2f %8.2f %s", step.name.c_str(), step.mainThread ? "main" : "worker",
+				step.startMs, wallMs, critical[i] ? "*" : "");
+			std::cout << line << std::endl;
+		}
+		std::cout << "startup: " << _steps.size() << " steps, " << summedMs << " ms of work in " << totalMs() << " ms" << std::endl;
 	}
 
-	VkShaderModule _createShaderModule(const std::vector<char>& code)
+private:
+	// called with _mutex held
+	void _launch(ThreadPool& pool, size_t step)
 	{
-		VkShaderModuleCreateInfo createInfo = {};
+		if (_steps[step].mainThread)
+		{
+			_mainReady.push_back(step);
+			_changed.notify_all();
+			return;
+		}
 
-		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		createInfo.codeSize = code.size();
-		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-		
-		VkShaderModule shaderModule;
-		if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+		_running++;
+		pool.submit([this, &pool, step]() { _execute(pool, step); });
+	}
+
+	void _execute(ThreadPool& pool, size_t index)
+	{
+		Step& step = _steps[index];
+		step.startMs = _elapsedMs();
+		std::exception_ptr error;
+		try
 		{
-			throw std::runtime_error("Failed to create shader module");
+			step.run();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
 		}
+		step.endMs = _elapsedMs();
 
-		return shaderModule;
+		std::lock_guard<std::mutex> lock(_mutex);
+		_finished++;
+		if (!step.mainThread)
+		{
+			_running--;
+		}
+		if (error && !_error)
+		{
+			_error = error;
+		}
+		if (!_error)
+		{
+			for (size_t dependent : _dependents[index])
+			{
+				if (--_remaining[dependent] == 0)
+				{
+					_launch(pool, dependent);
+				}
+			}
+		}
+		_changed.notify_all();
 	}
 
-	void _createImageViews()
+	double _elapsedMs() const
 	{
-		_swapChainImageViews.resize(_swapChainImages.size());
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _start).count();
+	}
 
-		for (size_t i = 0; i < _swapChainImages.size(); i++)
+	std::vector<Step>					_steps;
+	std::vector<uint32_t>				_remaining;		// unfinished dependencies per step
+	std::vector<std::vector<size_t>>	_dependents;
+	std::deque<size_t>					_mainReady;
+	size_t								_finished = 0;
+	uint32_t							_running = 0;	// worker steps submitted and not yet returned
+	std::exception_ptr					_error;
+	std::mutex							_mutex;
+	std::condition_variable				_changed;
+	std::chrono::high_resolution_clock::time_point	_start;
+};
+
+//====================== Render Graph ==========================
+// Frame description rebuilt every frame: passes declare which images and buffers they read and write, compile()
+// works out the rest.
+//  - passes whose results never reach an output (an imported image with a final layout) are culled, unless
+//    marked as having side effects
+//  - barriers come from replaying the declared accesses in pass order: a read after a write waits for it, a
+//    write after reads waits for the readers, a changed image layout is a transition. A pass's barriers go
+//    into one vkCmdPipelineBarrier, reads that were already made visible need none
+//  - graphics passes get their render pass and framebuffer from caches. Attachments are kept in their
+//    attachment layout inside the pass, the transitions are the barriers around it, and an attachment
+//    nothing reads afterwards is not stored
+//  - transient images are created by the graph; two transients whose pass ranges do not overlap share memory.
+//    A transient that lives in one pass as an attachment that is neither loaded nor stored (MSAA color, depth
+//    without pre-pass) gets TRANSIENT_ATTACHMENT usage and lazily allocated memory where the device has it,
+//    so on tilers it never gets backing memory
+// Physical transients and framebuffers outlive the frame and are only rebuilt when the set of transients
+// changes; replaced ones are kept until the frames using them have completed (see collect()).
+class RenderGraph
+{
+public:
+	typedef uint32_t Resource;
+
+	enum class Access
+	{
+		ColorAttachment,	// written by the pass's render pass
+		DepthAttachment,	// depth tested and written by the pass's render pass
+		TransferRead,
+		TransferWrite,
+		ComputeRead,		// storage buffer/image read in a compute shader
+		ComputeWrite,		// storage read-modify-write in a compute shader
+		IndirectRead,		// draw parameters
+		FragmentSampled,
+	};
+
+	struct ImageDesc
+	{
+		VkFormat				format = VK_FORMAT_UNDEFINED;
+		VkExtent2D				extent = {};
+		VkSampleCountFlagBits	samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageAspectFlags		aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	};
+
+	// one attachment of a cached render pass; layouts are not part of it, see the class comment
+	struct AttachmentKey
+	{
+		VkFormat				format = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits	samples = VK_SAMPLE_COUNT_1_BIT;
+		VkAttachmentLoadOp		loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		VkAttachmentStoreOp		storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		bool					depth = false;		// the subpass's depth attachment, at most one
+		bool					resolve = false;	// resolve target of the color attachment with the same index
+
+		bool operator==(const AttachmentKey& other) const
 		{
-			VkImageViewCreateInfo imgViewCreateInfo = {};
-			imgViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-			imgViewCreateInfo.image = _swapChainImages[i];
-			imgViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			imgViewCreateInfo.format = _swapChainImageFormat;
+			return format == other.format && samples == other.samples && loadOp == other.loadOp && storeOp == other.storeOp &&
+				depth == other.depth && resolve == other.resolve;
+		}
+	};
 
-			imgViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-			imgViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-			imgViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-			imgViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+	struct PassContext
+	{
+		VkCommandBuffer		commandBuffer = VK_NULL_HANDLE;
+		VkRenderPass		renderPass = VK_NULL_HANDLE;	// only for graphics passes, begun before the callback
+		VkFramebuffer		framebuffer = VK_NULL_HANDLE;
+		VkExtent2D			extent = {};
+	};
 
-			imgViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imgViewCreateInfo.subresourceRange.baseMipLevel = 0;
-			imgViewCreateInfo.subresourceRange.levelCount = 1;
-			imgViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-			imgViewCreateInfo.subresourceRange.layerCount = 1;
+	// of the last compile()
+	struct Stats
+	{
+		uint32_t		passCount = 0;
+		uint32_t		culledPasses = 0;
+		uint32_t		barrierCount = 0;		// image and buffer barriers
+		uint32_t		barrierBatches = 0;		// vkCmdPipelineBarrier calls
+		uint32_t		transientCount = 0;
+		VkDeviceSize	transientBytes = 0;		// sum of the transients' memory requirements
+		VkDeviceSize	allocatedBytes = 0;		// memory actually bound to them after aliasing
+		VkDeviceSize	lazyBytes = 0;			// part of allocatedBytes in lazily allocated memory
+
+		bool operator==(const Stats& other) const
+		{
+			return passCount == other.passCount && culledPasses == other.culledPasses && barrierCount == other.barrierCount &&
+				barrierBatches == other.barrierBatches && transientCount == other.transientCount &&
+				transientBytes == other.transientBytes && allocatedBytes == other.allocatedBytes && lazyBytes == other.lazyBytes;
+		}
+	};
 
-			if (vkCreateImageView(_device, &imgViewCreateInfo, nullptr, &_swapChainImageViews[i]) != VK_SUCCESS)
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, GpuAllocator& allocator)
+	{
+		_device = device;
+		_allocator = &allocator;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_memoryProperties);
+	}
+
+	// the device must be idle
+	void destroy()
+	{
+		for (auto& retired : _retired)
+		{
+			_destroyPhysical(retired);
+		}
+		_retired.clear();
+		_destroyPhysical(_physical);
+
+		for (const auto& entry : _framebuffers)
+		{
+			vkDestroyFramebuffer(_device, entry.framebuffer, nullptr);
+		}
+		_framebuffers.clear();
+
+		for (const auto& entry : _renderPasses)
+		{
+			vkDestroyRenderPass(_device, entry.renderPass, nullptr);
+		}
+		_renderPasses.clear();
+	}
+
+	// starts the description of frame frameNumber. Last frame's passes are kept for their storage, so a frame
+	// like the previous one builds its passes without allocating
+	void beginFrame(uint64_t frameNumber)
+	{
+		_frameNumber = frameNumber;
+		_resources.clear();
+		for (Pass& pass : _passes)
+		{
+			_sparePasses.push_back(std::move(pass));
+		}
+		_passes.clear();
+		_finalImageBarriers.clear();
+	}
+
+	// an image owned by the caller; its contents are not preserved across frames. finalLayout makes it an output
+	// of the frame, it is transitioned there after the last pass
+	Resource importImage(const std::string& name, VkImage image, VkImageView view, const ImageDesc& desc, VkImageLayout finalLayout)
+	{
+		ResourceNode node;
+		node.name = name;
+		node.isImage = true;
+		node.desc = desc;
+		node.image = image;
+		node.view = view;
+		node.finalLayout = finalLayout;
+		_resources.push_back(node);
+		return static_cast<Resource>(_resources.size() - 1);
+	}
+
+	Resource importBuffer(const std::string& name, VkBuffer buffer)
+	{
+		ResourceNode node;
+		node.name = name;
+		node.buffer = buffer;
+		_resources.push_back(node);
+		return static_cast<Resource>(_resources.size() - 1);
+	}
+
+	// an image only alive during the frame; its usage flags are collected from the passes using it
+	Resource createImage(const std::string& name, const ImageDesc& desc)
+	{
+		ResourceNode node;
+		node.name = name;
+		node.isImage = true;
+		node.transient = true;
+		node.desc = desc;
+		_resources.push_back(node);
+		return static_cast<Resource>(_resources.size() - 1);
+	}
+
+	// passes run in the order they are added
+	size_t addPass(const std::string& name, std::function<void(const PassContext&)> record)
+	{
+		Pass pass;
+		if (!_sparePasses.empty())
+		{
+			pass = std::move(_sparePasses.back());
+			_sparePasses.pop_back();
+			pass.reset();
+		}
+		pass.name = name;
+		pass.record = std::move(record);
+		_passes.push_back(std::move(pass));
+		return _passes.size() - 1;
+	}
+
+	void read(size_t pass, Resource resource, Access access)
+	{
+		_addUse(pass, resource, access, false);
+	}
+
+	void write(size_t pass, Resource resource, Access access)
+	{
+		_addUse(pass, resource, access, true);
+	}
+
+	// attachments are numbered in call order; LOAD also reads the previous contents
+	void colorAttachment(size_t pass, Resource resource, VkAttachmentLoadOp loadOp, VkClearValue clearValue = {})
+	{
+		Attachment attachment;
+		attachment.resource = resource;
+		attachment.loadOp = loadOp;
+		_passes[pass].attachments.push_back(attachment);
+		_passes[pass].clearValues.push_back(clearValue);
+
+		if (loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+		{
+			_addUse(pass, resource, Access::ColorAttachment, false);
+		}
+		_addUse(pass, resource, Access::ColorAttachment, true);
+	}
+
+	void depthAttachment(size_t pass, Resource resource, VkAttachmentLoadOp loadOp, VkClearValue clearValue = {})
+	{
+		Attachment attachment;
+		attachment.resource = resource;
+		attachment.loadOp = loadOp;
+		attachment.depth = true;
+		_passes[pass].attachments.push_back(attachment);
+		_passes[pass].clearValues.push_back(clearValue);
+
+		if (loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+		{
+			_addUse(pass, resource, Access::DepthAttachment, false);
+		}
+		_addUse(pass, resource, Access::DepthAttachment, true);
+	}
+
+	// the multisampled color attachments are resolved into resolve attachments, added in the same order
+	void resolveAttachment(size_t pass, Resource resource)
+	{
+		Attachment attachment;
+		attachment.resource = resource;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.resolve = true;
+		_passes[pass].attachments.push_back(attachment);
+		_passes[pass].clearValues.push_back(VkClearValue{});
+
+		_addUse(pass, resource, Access::ColorAttachment, true);
+	}
+
+	// the pass does work the graph cannot see (e.g. resources it does not track), it is never culled
+	void setSideEffects(size_t pass)
+	{
+		_passes[pass].sideEffects = true;
+	}
+
+	// the callback records secondaries executed inside the render pass
+	void setSecondaryContents(size_t pass)
+	{
+		_passes[pass].secondaryContents = true;
+	}
+
+	void compile()
+	{
+		_cullPasses();
+		_computeLifetimes();
+		_allocateTransients();
+		_computeBarriers();
+
+		for (Pass& pass : _passes)
+		{
+			if (!pass.culled && !pass.attachments.empty())
 			{
-				throw std::runtime_error("Failed to create image views");
+				_preparePassTargets(pass);
 			}
 		}
+
+		_stats.passCount = static_cast<uint32_t>(_passes.size());
+		_stats.culledPasses = 0;
+		_stats.barrierCount = static_cast<uint32_t>(_finalImageBarriers.size());
+		_stats.barrierBatches = _finalImageBarriers.empty() ? 0 : 1;
+		for (const Pass& pass : _passes)
+		{
+			_stats.culledPasses += pass.culled ? 1 : 0;
+			uint32_t barriers = static_cast<uint32_t>(pass.imageBarriers.size() + pass.bufferBarriers.size());
+			_stats.barrierCount += barriers;
+			_stats.barrierBatches += barriers > 0 ? 1 : 0;
+		}
 	}
 
-	void _recreateSwapChain()
+	void execute(VkCommandBuffer commandBuffer)
 	{
-		int width = 0, height = 0;
-		glfwGetFramebufferSize(_window, &width, &height);
-		while (width == 0 || height == 0)
+		for (Pass& pass : _passes)
 		{
-			glfwGetFramebufferSize(_window, &width, &height);
-			glfwWaitEvents();
+			if (pass.culled)
+				continue;
+
+			if (!pass.imageBarriers.empty() || !pass.bufferBarriers.empty())
+			{
+				vkCmdPipelineBarrier(commandBuffer, pass.srcStages, pass.dstStages, 0, 0, nullptr,
+					static_cast<uint32_t>(pass.bufferBarriers.size()), pass.bufferBarriers.data(),
+					static_cast<uint32_t>(pass.imageBarriers.size()), pass.imageBarriers.data());
+			}
+
+			PassContext context;
+			context.commandBuffer = commandBuffer;
+			if (pass.attachments.empty())
+			{
+				pass.record(context);
+				continue;
+			}
+
+			context.renderPass = pass.renderPass;
+			context.framebuffer = pass.framebuffer;
+			context.extent = pass.extent;
+
+			VkRenderPassBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			beginInfo.renderPass = pass.renderPass;
+			beginInfo.framebuffer = pass.framebuffer;
+			beginInfo.renderArea.offset = { 0, 0 };
+			beginInfo.renderArea.extent = pass.extent;
+			beginInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+			beginInfo.pClearValues = pass.clearValues.data();
+
+			vkCmdBeginRenderPass(commandBuffer, &beginInfo, pass.secondaryContents ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+			pass.record(context);
+			vkCmdEndRenderPass(commandBuffer);
 		}
-		
-		vkDeviceWaitIdle(_device);
 
-		_cleanupSwapChain();
+		if (!_finalImageBarriers.empty())
+		{
+			vkCmdPipelineBarrier(commandBuffer, _finalSrcStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+				static_cast<uint32_t>(_finalImageBarriers.size()), _finalImageBarriers.data());
+		}
 
-		_createSwapchain();
-		_createImageViews();
-		_createRenderPass();
-		_createGraphicsPipeline();
-		_createFrameBuffers();
-		_createCommandBuffers();
+		if (_physical.lastFrame < _frameNumber)
+		{
+			_physical.lastFrame = _frameNumber;
+		}
 	}
 
-	void _createSwapchain()
+	// destroys replaced transients (and their framebuffers) once the last frame using them has completed
+	void collect(uint64_t completedFrameNumber)
 	{
-		SwapchainSupportDetails swapChainSupport = _querySwapchainSupport(_physicalDevice);
+		while (!_retired.empty() && _retired.front().lastFrame <= completedFrameNumber)
+		{
+			_destroyPhysical(_retired.front());
+			_retired.pop_front();
+		}
+	}
+
+	// drops the cached framebuffers using these views; the caller destroys the views once no frame uses them
+	void releaseImageViews(const std::vector<VkImageView>& views)
+	{
+		for (size_t i = 0; i < _framebuffers.size();)
+		{
+			if (_usesAnyView(_framebuffers[i].views, views))
+			{
+				vkDestroyFramebuffer(_device, _framebuffers[i].framebuffer, nullptr);
+				_framebuffers.erase(_framebuffers.begin() + i);
+				continue;
+			}
+			i++;
+		}
+	}
+
+	// cached; also used to build pipelines, which only need a compatible render pass
+	VkRenderPass getRenderPass(const std::vector<AttachmentKey>& attachments)
+	{
+		for (const auto& entry : _renderPasses)
+		{
+			if (entry.attachments == attachments)
+				return entry.renderPass;
+		}
+
+		std::vector<VkAttachmentDescription> descriptions;
+		std::vector<VkAttachmentReference> colorReferences;
+		std::vector<VkAttachmentReference> resolveReferences;
+		VkAttachmentReference depthReference = {};
+		bool hasDepth = false;
+		for (const AttachmentKey& key : attachments)
+		{
+			VkImageLayout layout = key.depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+			VkAttachmentDescription description = {};
+			description.format = key.format;
+			description.samples = key.samples;
+			description.loadOp = key.loadOp;
+			description.storeOp = key.storeOp;
+			description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			description.initialLayout = layout;
+			description.finalLayout = layout;
+
+			VkAttachmentReference reference = {};
+			reference.attachment = static_cast<uint32_t>(descriptions.size());
+			reference.layout = layout;
+			if (key.depth)
+			{
+				depthReference = reference;
+				hasDepth = true;
+			}
+			else if (key.resolve)
+			{
+				resolveReferences.push_back(reference);
+			}
+			else
+			{
+				colorReferences.push_back(reference);
+			}
+			descriptions.push_back(description);
+		}
+
+		if (!resolveReferences.empty() && resolveReferences.size() != colorReferences.size())
+		{
+			throw std::runtime_error("Render pass needs one resolve attachment per color attachment!");
+		}
+
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+		subpass.pColorAttachments = colorReferences.data();
+		subpass.pResolveAttachments = resolveReferences.empty() ? nullptr : resolveReferences.data();
+		subpass.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+		// no subpass dependencies: the graph's barriers before and after the pass order it against the rest
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(descriptions.size());
+		renderPassInfo.pAttachments = descriptions.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+
+		RenderPassEntry entry;
+		entry.attachments = attachments;
+		if (vkCreateRenderPass(_device, &renderPassInfo, nullptr, &entry.renderPass) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create render pass!");
+		}
+		_renderPasses.push_back(entry);
+		return entry.renderPass;
+	}
+
+	// pipeline stages of the image's first use this frame; a wait semaphore guarding it must wait there
+	VkPipelineStageFlags firstStages(Resource resource) const
+	{
+		return _resources[resource].firstStages;
+	}
+
+	VkImage image(Resource resource) const
+	{
+		return _resources[resource].image;
+	}
+
+	const Stats& stats() const
+	{
+		return _stats;
+	}
+
+	void printStats() const
+	{
+		std::cout << "render graph: " << _stats.passCount - _stats.culledPasses << "/" << _stats.passCount << " passes ("
+			<< _stats.culledPasses << " culled), " << _stats.barrierCount << " barriers in " << _stats.barrierBatches << " batches, "
+			<< _stats.transientCount << " transient images " << _stats.allocatedBytes / 1024 << " KiB (" << _stats.transientBytes / 1024
+			<< " KiB requested, " << (_stats.transientBytes - _stats.allocatedBytes) / 1024 << " KiB saved by aliasing";
+		if (_stats.lazyBytes)
+		{
+			std::cout << ", " << _stats.lazyBytes / 1024 << " KiB lazily allocated";
+		}
+		std::cout << ")" << std::endl;
+	}
+
+	// bytes the driver has actually committed to the lazily allocated transients so far
+	VkDeviceSize lazyCommittedBytes() const
+	{
+		std::vector<VkDeviceMemory> counted;
+		VkDeviceSize committed = 0;
+		for (const MemorySlot& slot : _physical.slots)
+		{
+			if (!slot.lazilyAllocated || std::find(counted.begin(), counted.end(), slot.allocation.memory) != counted.end())
+				continue;
+
+			VkDeviceSize bytes = 0;
+			vkGetDeviceMemoryCommitment(_device, slot.allocation.memory, &bytes);
+			committed += bytes;
+			counted.push_back(slot.allocation.memory);
+		}
+		return committed;
+	}
+
+private:
+	struct Use
+	{
+		Resource				resource = 0;
+		VkPipelineStageFlags	stages = 0;
+		VkAccessFlags			access = 0;
+		VkImageLayout			layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		bool					read = false;		// depends on the previous contents
+		bool					write = false;
+	};
+
+	struct Attachment
+	{
+		Resource				resource = 0;
+		VkAttachmentLoadOp		loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		bool					depth = false;
+		bool					resolve = false;
+	};
+
+	struct Pass
+	{
+		std::string							name;
+		std::function<void(const PassContext&)>	record;
+		std::vector<Use>					uses;			// one per resource
+		std::vector<Attachment>				attachments;
+		std::vector<VkClearValue>			clearValues;	// one per attachment
+		bool								sideEffects = false;
+		bool								secondaryContents = false;
+		bool								culled = false;
+
+		VkPipelineStageFlags				srcStages = 0;
+		VkPipelineStageFlags				dstStages = 0;
+		std::vector<VkImageMemoryBarrier>	imageBarriers;
+		std::vector<VkBufferMemoryBarrier>	bufferBarriers;
+		VkRenderPass						renderPass = VK_NULL_HANDLE;
+		VkFramebuffer						framebuffer = VK_NULL_HANDLE;
+		VkExtent2D							extent = {};
+
+		// back to a new pass, keeping the vectors' storage
+		void reset()
+		{
+			uses.clear();
+			attachments.clear();
+			clearValues.clear();
+			sideEffects = false;
+			secondaryContents = false;
+			culled = false;
+			srcStages = 0;
+			dstStages = 0;
+			imageBarriers.clear();
+			bufferBarriers.clear();
+			renderPass = VK_NULL_HANDLE;
+			framebuffer = VK_NULL_HANDLE;
+			extent = {};
+		}
+	};
+
+	struct ResourceNode
+	{
+		std::string				name;
+		bool					isImage = false;
+		bool					transient = false;
+		ImageDesc				desc;
+		VkImage					image = VK_NULL_HANDLE;
+		VkImageView				view = VK_NULL_HANDLE;
+		VkBuffer				buffer = VK_NULL_HANDLE;
+		VkImageLayout			finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		// filled by compile()
+		VkImageUsageFlags		usage = 0;
+		size_t					firstPass = SIZE_MAX;	// surviving passes only
+		size_t					lastPass = 0;
+		VkPipelineStageFlags	firstStages = 0;
+		VkAccessFlags			firstWriteAccess = 0;
+		VkPipelineStageFlags	allStages = 0;
+		VkAccessFlags			allWriteAccess = 0;
+		bool					readLater = false;		// read by a pass after a write, see _storeOp
+		bool					attachmentOnly = true;	// only used as a render pass attachment, never loaded
+		bool					lazy = false;			// transient attachment living in one pass, see the class comment
+	};
+
+	// where the replay of the accesses stands for one resource
+	struct SyncState
+	{
+		VkImageLayout			layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags	writeStages = 0;		// of the last write (or layout transition)
+		VkAccessFlags			writeAccess = 0;
+		VkPipelineStageFlags	readStages = 0;			// stages ordered after that write
+		VkAccessFlags			visibleAccess = 0;		// accesses it has been made visible to
+	};
+
+	// what a transient's image and memory slot are built from; the transients are rebuilt when one changes
+	struct TransientKey
+	{
+		VkFormat				format = VK_FORMAT_UNDEFINED;
+		VkExtent2D				extent = {};
+		VkSampleCountFlagBits	samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageUsageFlags		usage = 0;
+		size_t					firstPass = 0;
+		size_t					lastPass = 0;
+
+		bool operator==(const TransientKey& other) const
+		{
+			return format == other.format && extent.width == other.extent.width && extent.height == other.extent.height &&
+				samples == other.samples && usage == other.usage && firstPass == other.firstPass && lastPass == other.lastPass;
+		}
+	};
+
+	// memory shared by transients whose pass ranges do not overlap
+	struct MemorySlot
+	{
+		VkMemoryRequirements	requirements = {};
+		std::vector<size_t>		members;				// indices into Physical::images
+		bool					lazy = false;			// members are lazy transients
+		bool					lazilyAllocated = false;	// and the device had lazily allocated memory for them
+		GpuAllocation			allocation;
+	};
+
+	struct Physical
+	{
+		std::vector<TransientKey>	keys;				// the transients this was built for
+		std::vector<VkImage>		images;
+		std::vector<VkImageView>	views;
+		std::vector<MemorySlot>		slots;
+		std::vector<size_t>			imageSlots;
+		std::vector<VkFramebuffer>	framebuffers;		// moved here from the cache when retired
+		VkDeviceSize				requestedBytes = 0;
+		uint64_t					lastFrame = 0;
+	};
+
+	struct RenderPassEntry
+	{
+		std::vector<AttachmentKey>	attachments;
+		VkRenderPass				renderPass = VK_NULL_HANDLE;
+	};
+
+	struct FramebufferEntry
+	{
+		VkRenderPass				renderPass = VK_NULL_HANDLE;
+		std::vector<VkImageView>	views;
+		VkExtent2D					extent = {};
+		VkFramebuffer				framebuffer = VK_NULL_HANDLE;
+	};
+
+	static Use _describe(Access access)
+	{
+		Use use;
+		switch (access)
+		{
+		case Access::ColorAttachment:
+			use.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+			use.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			use.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			break;
+		case Access::DepthAttachment:
+			use.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			use.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+			use.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			break;
+		case Access::TransferRead:
+			use.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			use.access = VK_ACCESS_TRANSFER_READ_BIT;
+			use.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			break;
+		case Access::TransferWrite:
+			use.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			use.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+			use.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			break;
+		case Access::ComputeRead:
+			use.stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			use.access = VK_ACCESS_SHADER_READ_BIT;
+			use.layout = VK_IMAGE_LAYOUT_GENERAL;
+			break;
+		case Access::ComputeWrite:
+			use.stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+			use.access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			use.layout = VK_IMAGE_LAYOUT_GENERAL;
+			break;
+		case Access::IndirectRead:
+			use.stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+			use.access = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+			break;
+		case Access::FragmentSampled:
+			use.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			use.access = VK_ACCESS_SHADER_READ_BIT;
+			use.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			break;
+		}
+		return use;
+	}
+
+	static VkImageUsageFlags _imageUsage(Access access)
+	{
+		switch (access)
+		{
+		case Access::ColorAttachment:	return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		case Access::DepthAttachment:	return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		case Access::TransferRead:		return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		case Access::TransferWrite:		return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		case Access::ComputeRead:
+		case Access::ComputeWrite:		return VK_IMAGE_USAGE_STORAGE_BIT;
+		case Access::FragmentSampled:	return VK_IMAGE_USAGE_SAMPLED_BIT;
+		default:						return 0;
+		}
+	}
+
+	static const VkAccessFlags WRITE_ACCESS_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	// a pass touching a resource twice gets one merged use; an image can only be in one layout during a pass
+	void _addUse(size_t pass, Resource resource, Access access, bool write)
+	{
+		Use use = _describe(access);
+		use.resource = resource;
+		use.read = !write || access == Access::ComputeWrite;
+		use.write = write;
+		ResourceNode& node = _resources[resource];
+		if (!node.isImage)
+		{
+			use.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+		node.usage |= _imageUsage(access);
+
+		for (Use& existing : _passes[pass].uses)
+		{
+			if (existing.resource != resource)
+				continue;
+
+			if (node.isImage && existing.layout != use.layout)
+			{
+				throw std::runtime_error("Render pass " + _passes[pass].name + " uses " + node.name + " in two layouts!");
+			}
+			existing.stages |= use.stages;
+			existing.access |= use.access;
+			existing.read = existing.read || use.read;
+			existing.write = existing.write || use.write;
+			return;
+		}
+		_passes[pass].uses.push_back(use);
+	}
+
+	// walks the passes backwards from the outputs; a pass survives if it has side effects or writes something
+	// a surviving later pass reads (or an output). Its own reads then become live, what it only writes does not
+	// need earlier producers
+	void _cullPasses()
+	{
+		std::vector<bool> live(_resources.size(), false);
+		for (size_t i = 0; i < _resources.size(); i++)
+		{
+			live[i] = _resources[i].finalLayout != VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		for (size_t p = _passes.size(); p-- > 0;)
+		{
+			Pass& pass = _passes[p];
+			bool needed = pass.sideEffects;
+			for (const Use& use : pass.uses)
+			{
+				needed = needed || (use.write && live[use.resource]);
+			}
+
+			pass.culled = !needed;
+			if (pass.culled)
+				continue;
+
+			for (const Use& use : pass.uses)
+			{
+				if (use.write)
+				{
+					live[use.resource] = false;
+				}
+			}
+			for (const Use& use : pass.uses)
+			{
+				if (use.read)
+				{
+					live[use.resource] = true;
+				}
+			}
+		}
+	}
+
+	void _computeLifetimes()
+	{
+		std::vector<bool> written(_resources.size(), false);
+		for (size_t p = 0; p < _passes.size(); p++)
+		{
+			if (_passes[p].culled)
+				continue;
+
+			for (const Use& use : _passes[p].uses)
+			{
+				ResourceNode& node = _resources[use.resource];
+				if (node.firstPass == SIZE_MAX)
+				{
+					node.firstPass = p;
+					node.firstStages = use.stages;
+					node.firstWriteAccess = use.write ? (use.access & WRITE_ACCESS_MASK) : 0;
+				}
+				node.lastPass = p;
+				node.allStages |= use.stages;
+				node.allWriteAccess |= use.write ? (use.access & WRITE_ACCESS_MASK) : 0;
+				node.attachmentOnly = node.attachmentOnly && !use.read &&
+					(use.layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL || use.layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+				// a LOAD attachment both reads and writes, and it still needs the earlier contents
+				if (use.read && written[use.resource])
+				{
+					node.readLater = true;
+				}
+				if (use.write)
+				{
+					written[use.resource] = true;
+				}
+			}
+		}
+
+		// one pass, not loaded, not an output: the store op is DONT_CARE too, the contents never leave the pass
+		for (ResourceNode& node : _resources)
+		{
+			node.lazy = node.transient && node.attachmentOnly && node.firstPass != SIZE_MAX && node.firstPass == node.lastPass;
+			if (node.lazy)
+			{
+				node.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			}
+		}
+	}
+
+	// into a member vector, so comparing against the current transients does not allocate once it has grown
+	void _collectTransientKeys()
+	{
+		_transientKeys.clear();
+		for (const ResourceNode& node : _resources)
+		{
+			if (!node.transient || node.firstPass == SIZE_MAX)
+				continue;
+
+			TransientKey key;
+			key.format = node.desc.format;
+			key.extent = node.desc.extent;
+			key.samples = node.desc.samples;
+			key.usage = node.usage;
+			key.firstPass = node.firstPass;
+			key.lastPass = node.lastPass;
+			_transientKeys.push_back(key);
+		}
+	}
+
+	// reuses last frame's images when the transients are unchanged. Otherwise every transient gets an image,
+	// largest first each goes into the first memory slot whose members' pass ranges it does not overlap
+	void _allocateTransients()
+	{
+		std::vector<size_t> transients;
+		for (size_t i = 0; i < _resources.size(); i++)
+		{
+			if (_resources[i].transient && _resources[i].firstPass != SIZE_MAX)
+			{
+				transients.push_back(i);
+			}
+		}
+
+		_collectTransientKeys();
+		if (_transientKeys != _physical.keys)
+		{
+			if (!_physical.images.empty())
+			{
+				_retire();
+			}
+			_physical.keys = _transientKeys;
+
+			for (size_t index : transients)
+			{
+				const ResourceNode& node = _resources[index];
+
+				VkImageCreateInfo imageInfo = {};
+				imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+				imageInfo.imageType = VK_IMAGE_TYPE_2D;
+				imageInfo.format = node.desc.format;
+				imageInfo.extent = { node.desc.extent.width, node.desc.extent.height, 1 };
+				imageInfo.mipLevels = 1;
+				imageInfo.arrayLayers = 1;
+				imageInfo.samples = node.desc.samples;
+				imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+				imageInfo.usage = node.usage;
+				imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+				imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+				VkImage image;
+				if (vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create transient image " + node.name + "!");
+				}
+				_physical.images.push_back(image);
+			}
+
+			std::vector<VkMemoryRequirements> requirements(transients.size());
+			std::vector<size_t> order(transients.size());
+			for (size_t i = 0; i < transients.size(); i++)
+			{
+				vkGetImageMemoryRequirements(_device, _physical.images[i], &requirements[i]);
+				_physical.requestedBytes += requirements[i].size;
+				order[i] = i;
+			}
+			std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return requirements[a].size > requirements[b].size; });
+
+			_physical.imageSlots.assign(transients.size(), 0);
+			for (size_t i : order)
+			{
+				const ResourceNode& node = _resources[transients[i]];
+				size_t slot = 0;
+				for (; slot < _physical.slots.size(); slot++)
+				{
+					MemorySlot& candidate = _physical.slots[slot];
+					bool fits = (candidate.requirements.memoryTypeBits & requirements[i].memoryTypeBits) != 0 && candidate.lazy == node.lazy;
+					for (size_t member : candidate.members)
+					{
+						const ResourceNode& other = _resources[transients[member]];
+						fits = fits && (node.lastPass < other.firstPass || other.lastPass < node.firstPass);
+					}
+					if (fits)
+						break;
+				}
+
+				if (slot == _physical.slots.size())
+				{
+					MemorySlot created;
+					created.requirements = requirements[i];
+					created.lazy = node.lazy;
+					_physical.slots.push_back(created);
+				}
+				else
+				{
+					VkMemoryRequirements& merged = _physical.slots[slot].requirements;
+					merged.size = std::max(merged.size, requirements[i].size);
+					merged.alignment = std::max(merged.alignment, requirements[i].alignment);
+					merged.memoryTypeBits &= requirements[i].memoryTypeBits;
+				}
+				_physical.slots[slot].members.push_back(i);
+				_physical.imageSlots[i] = slot;
+			}
+
+			for (MemorySlot& slot : _physical.slots)
+			{
+				uint32_t memoryType = _findMemoryType(slot.requirements.memoryTypeBits, slot.lazy);
+				slot.lazilyAllocated = (_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+				slot.allocation = _allocator->allocate(slot.requirements, memoryType, true);
+				for (size_t member : slot.members)
+				{
+					vkBindImageMemory(_device, _physical.images[member], slot.allocation.memory, slot.allocation.offset);
+				}
+			}
+
+			for (size_t i = 0; i < transients.size(); i++)
+			{
+				const ResourceNode& node = _resources[transients[i]];
+
+				VkImageViewCreateInfo viewInfo = {};
+				viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+				viewInfo.image = _physical.images[i];
+				viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				viewInfo.format = node.desc.format;
+				viewInfo.subresourceRange = { node.desc.aspect, 0, 1, 0, 1 };
+
+				VkImageView view;
+				if (vkCreateImageView(_device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create transient image view " + node.name + "!");
+				}
+				_physical.views.push_back(view);
+			}
+		}
+
+		_stats.transientCount = static_cast<uint32_t>(transients.size());
+		_stats.transientBytes = _physical.requestedBytes;
+		_stats.allocatedBytes = 0;
+		_stats.lazyBytes = 0;
+		for (const MemorySlot& slot : _physical.slots)
+		{
+			_stats.allocatedBytes += slot.requirements.size;
+			_stats.lazyBytes += slot.lazilyAllocated ? slot.requirements.size : 0;
+		}
+
+		for (size_t i = 0; i < transients.size(); i++)
+		{
+			ResourceNode& node = _resources[transients[i]];
+			node.image = _physical.images[i];
+			node.view = _physical.views[i];
+		}
+	}
+
+	// Replays the surviving passes' accesses. Images start in UNDEFINED (their contents are not kept) with
+	// their first use's stages and writes, or for transients every stage and write of their memory slot, as
+	// the ones to wait on: that orders the transition after the acquire semaphore wait, after last frame's
+	// writes to the image and after the aliased transients' writes to the memory.
+	void _computeBarriers()
+	{
+		std::vector<SyncState> states(_resources.size());
+		for (size_t i = 0; i < _resources.size(); i++)
+		{
+			if (_resources[i].isImage)
+			{
+				states[i].writeStages = _resources[i].firstStages;
+				states[i].writeAccess = _resources[i].firstWriteAccess;
+			}
+		}
+		for (size_t i = 0, t = 0; i < _resources.size(); i++)
+		{
+			if (!_resources[i].transient || _resources[i].firstPass == SIZE_MAX)
+				continue;
+
+			const MemorySlot& slot = _physical.slots[_physical.imageSlots[t++]];
+			for (size_t r = 0, m = 0; r < _resources.size(); r++)
+			{
+				if (!_resources[r].transient || _resources[r].firstPass == SIZE_MAX)
+					continue;
+				if (std::find(slot.members.begin(), slot.members.end(), m++) != slot.members.end())
+				{
+					states[i].writeStages |= _resources[r].allStages;
+					states[i].writeAccess |= _resources[r].allWriteAccess;
+				}
+			}
+		}
+
+		for (Pass& pass : _passes)
+		{
+			pass.srcStages = 0;
+			pass.dstStages = 0;
+			pass.imageBarriers.clear();
+			pass.bufferBarriers.clear();
+			if (pass.culled)
+				continue;
+
+			for (const Use& use : pass.uses)
+			{
+				const ResourceNode& node = _resources[use.resource];
+				SyncState& state = states[use.resource];
+				bool transition = node.isImage && state.layout != use.layout;
+
+				VkPipelineStageFlags srcStages = state.writeStages;
+				bool needed;
+				if (transition || use.write)
+				{
+					srcStages |= state.readStages;
+					needed = transition || srcStages != 0;
+				}
+				else
+				{
+					needed = state.writeStages != 0 && ((use.stages & ~state.readStages) != 0 || (use.access & ~state.visibleAccess) != 0);
+				}
+
+				if (needed)
+				{
+					_addBarrier(pass, node, state, use, srcStages);
+				}
+
+				if (use.write || transition)
+				{
+					state.writeStages = use.stages;
+					state.writeAccess = use.write ? (use.access & WRITE_ACCESS_MASK) : 0;
+					state.readStages = use.write ? 0 : use.stages;
+					state.visibleAccess = use.write ? 0 : use.access;
+					state.layout = use.layout;
+				}
+				else
+				{
+					state.readStages |= use.stages;
+					state.visibleAccess |= use.access;
+				}
+			}
+		}
+
+		_finalSrcStages = 0;
+		for (size_t i = 0; i < _resources.size(); i++)
+		{
+			const ResourceNode& node = _resources[i];
+			const SyncState& state = states[i];
+			if (node.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || node.firstPass == SIZE_MAX || state.layout == node.finalLayout)
+				continue;
+
+			VkImageMemoryBarrier barrier = _imageBarrier(node, state.layout, node.finalLayout, state.writeAccess, 0);
+			_finalImageBarriers.push_back(barrier);
+			_finalSrcStages |= state.writeStages | state.readStages;
+		}
+	}
+
+	void _addBarrier(Pass& pass, const ResourceNode& node, const SyncState& state, const Use& use, VkPipelineStageFlags srcStages)
+	{
+		pass.srcStages |= srcStages != 0 ? srcStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+		pass.dstStages |= use.stages;
+
+		if (node.isImage)
+		{
+			pass.imageBarriers.push_back(_imageBarrier(node, state.layout, use.layout, state.writeAccess, use.access));
+			return;
+		}
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = state.writeAccess;
+		barrier.dstAccessMask = use.access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = node.buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		pass.bufferBarriers.push_back(barrier);
+	}
+
+	static VkImageMemoryBarrier _imageBarrier(const ResourceNode& node, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkAccessFlags srcAccess, VkAccessFlags dstAccess)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = node.image;
+		barrier.subresourceRange = { node.desc.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+		return barrier;
+	}
+
+	// an attachment is stored when a later pass reads it or it is an output of the frame
+	VkAttachmentStoreOp _storeOp(const ResourceNode& node, size_t pass) const
+	{
+		bool keep = node.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED || (node.readLater && node.lastPass > pass);
+		return keep ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	}
+
+	void _preparePassTargets(Pass& pass)
+	{
+		std::vector<AttachmentKey> keys;
+		std::vector<VkImageView> views;
+		size_t passIndex = static_cast<size_t>(&pass - _passes.data());
+		for (const Attachment& attachment : pass.attachments)
+		{
+			const ResourceNode& node = _resources[attachment.resource];
+
+			AttachmentKey key;
+			key.format = node.desc.format;
+			key.samples = node.desc.samples;
+			key.loadOp = attachment.loadOp;
+			key.storeOp = _storeOp(node, passIndex);
+			key.depth = attachment.depth;
+			key.resolve = attachment.resolve;
+			keys.push_back(key);
+			views.push_back(node.view);
+		}
+
+		pass.extent = _resources[pass.attachments[0].resource].desc.extent;
+		pass.renderPass = getRenderPass(keys);
+		pass.framebuffer = _getFramebuffer(pass.renderPass, views, pass.extent);
+	}
+
+	VkFramebuffer _getFramebuffer(VkRenderPass renderPass, const std::vector<VkImageView>& views, VkExtent2D extent)
+	{
+		for (const auto& entry : _framebuffers)
+		{
+			if (entry.renderPass == renderPass && entry.views == views && entry.extent.width == extent.width && entry.extent.height == extent.height)
+				return entry.framebuffer;
+		}
+
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = renderPass;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferInfo.pAttachments = views.data();
+		framebufferInfo.width = extent.width;
+		framebufferInfo.height = extent.height;
+		framebufferInfo.layers = 1;
+
+		FramebufferEntry entry;
+		entry.renderPass = renderPass;
+		entry.views = views;
+		entry.extent = extent;
+		if (vkCreateFramebuffer(_device, &framebufferInfo, nullptr, &entry.framebuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create framebuffer");
+		}
+		_framebuffers.push_back(entry);
+		return entry.framebuffer;
+	}
+
+	static bool _usesAnyView(const std::vector<VkImageView>& views, const std::vector<VkImageView>& released)
+	{
+		for (VkImageView view : views)
+		{
+			if (std::find(released.begin(), released.end(), view) != released.end())
+				return true;
+		}
+		return false;
+	}
+
+	// moves the current transients out, with the framebuffers built on them, until their last frame completes
+	void _retire()
+	{
+		for (size_t i = 0; i < _framebuffers.size();)
+		{
+			if (_usesAnyView(_framebuffers[i].views, _physical.views))
+			{
+				_physical.framebuffers.push_back(_framebuffers[i].framebuffer);
+				_framebuffers.erase(_framebuffers.begin() + i);
+				continue;
+			}
+			i++;
+		}
+
+		_retired.push_back(std::move(_physical));
+		_physical = Physical();
+	}
+
+	void _destroyPhysical(Physical& physical)
+	{
+		for (VkFramebuffer framebuffer : physical.framebuffers)
+		{
+			vkDestroyFramebuffer(_device, framebuffer, nullptr);
+		}
+		for (VkImageView view : physical.views)
+		{
+			vkDestroyImageView(_device, view, nullptr);
+		}
+		for (VkImage image : physical.images)
+		{
+			vkDestroyImage(_device, image, nullptr);
+		}
+		for (const MemorySlot& slot : physical.slots)
+		{
+			_allocator->free(slot.allocation);
+		}
+		physical = Physical();
+	}
+
+	// lazily allocated for lazy transients when the device has it, device-local otherwise when the images allow it
+	uint32_t _findMemoryType(uint32_t typeBits, bool lazy) const
+	{
+		for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount && lazy; i++)
+		{
+			if ((typeBits & (1u << i)) && (_memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+				return i;
+		}
+		for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; i++)
+		{
+			if ((typeBits & (1u << i)) && (_memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+				return i;
+		}
+		for (uint32_t i = 0; i < _memoryProperties.memoryTypeCount; i++)
+		{
+			if (typeBits & (1u << i))
+				return i;
+		}
+		throw std::runtime_error("No memory type for the transient images!");
+	}
+
+	VkDevice							_device = VK_NULL_HANDLE;
+	GpuAllocator*						_allocator = nullptr;
+	VkPhysicalDeviceMemoryProperties	_memoryProperties = {};
+	uint64_t							_frameNumber = 0;
+
+	std::vector<ResourceNode>			_resources;
+	std::vector<Pass>					_passes;
+	std::vector<Pass>					_sparePasses;		// last frame's, reused by addPass()
+	std::vector<TransientKey>			_transientKeys;		// of the frame being compiled
+	std::vector<VkImageMemoryBarrier>	_finalImageBarriers;
+	VkPipelineStageFlags				_finalSrcStages = 0;
+	Stats								_stats;
+
+	Physical							_physical;
+	std::deque<Physical>				_retired;
+	std::vector<RenderPassEntry>		_renderPasses;
+	std::vector<FramebufferEntry>		_framebuffers;
+};
+
+//====================== Mesh File ==========================
+// Binary mesh container (.vmesh), little endian:
+//   MeshFileHeader | MeshFileChunk[chunkCount] | per chunk: vertex data, index data (each 16 byte aligned)
+// Chunks are self-contained: their indices are local to the chunk's vertices and drawn with
+// vertexOffset = firstVertex, so a chunk can be drawn as soon as it is uploaded.
+const uint32_t	MESH_FILE_MAGIC = 0x48534D56;	// "VMSH"
+const uint32_t	MESH_FILE_VERSION = 1;
+const uint32_t	MESH_CHUNK_TRIANGLES = 16384;	// chunk size used by the writer
+
+struct MeshFileHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	vertexStride;		// must match sizeof(Vertex)
+	uint32_t	indexSize;			// 2 or 4
+	uint32_t	chunkCount;
+	uint32_t	reserved;
+	uint64_t	vertexCount;		// totals over all chunks
+	uint64_t	indexCount;
+	float		boundsMin[3];
+	float		boundsMax[3];
+};
+
+struct MeshFileChunk
+{
+	uint64_t	vertexDataOffset;	// byte offsets from the start of the file
+	uint64_t	indexDataOffset;
+	uint32_t	firstVertex;		// position in the concatenated vertex / index buffers
+	uint32_t	vertexCount;
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+	float		boundsMin[3];
+	float		boundsMax[3];
+};
+
+static void computeBounds(const Vertex* vertices, size_t count, float boundsMin[3], float boundsMax[3])
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		boundsMin[axis] = count ? FLT_MAX : 0.0f;
+		boundsMax[axis] = count ? -FLT_MAX : 0.0f;
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		const float position[3] = { vertices[i].pos.x, vertices[i].pos.y, 0.0f };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			boundsMin[axis] = std::min(boundsMin[axis], position[axis]);
+			boundsMax[axis] = std::max(boundsMax[axis], position[axis]);
+		}
+	}
+}
+
+// checks the header and that every chunk lies inside the file; returns the chunk table
+static const MeshFileChunk* parseMeshFile(const char* data, size_t size, const MeshFileHeader*& header)
+{
+	header = reinterpret_cast<const MeshFileHeader*>(data);
+	if (size < sizeof(MeshFileHeader) || header->magic != MESH_FILE_MAGIC)
+	{
+		throw std::runtime_error("Not a mesh file!");
+	}
+	if (header->version != MESH_FILE_VERSION)
+	{
+		throw std::runtime_error("Unsupported mesh file version " + std::to_string(header->version));
+	}
+	if (header->vertexStride != sizeof(Vertex) || (header->indexSize != 2 && header->indexSize != 4))
+	{
+		throw std::runtime_error("Mesh file vertex or index format does not match!");
+	}
+	if (size < sizeof(MeshFileHeader) + uint64_t(header->chunkCount) * sizeof(MeshFileChunk))
+	{
+		throw std::runtime_error("Mesh file chunk table is truncated!");
+	}
+
+	const MeshFileChunk* chunks = reinterpret_cast<const MeshFileChunk*>(data + sizeof(MeshFileHeader));
+	for (uint32_t i = 0; i < header->chunkCount; i++)
+	{
+		const MeshFileChunk& chunk = chunks[i];
+		uint64_t vertexBytes = uint64_t(chunk.vertexCount) * header->vertexStride;
+		uint64_t indexBytes = uint64_t(chunk.indexCount) * header->indexSize;
+		if (chunk.vertexDataOffset > size || vertexBytes > size - chunk.vertexDataOffset ||
+			chunk.indexDataOffset > size || indexBytes > size - chunk.indexDataOffset ||
+			uint64_t(chunk.firstVertex) + chunk.vertexCount > header->vertexCount ||
+			uint64_t(chunk.firstIndex) + chunk.indexCount > header->indexCount)
+		{
+			throw std::runtime_error("Mesh file chunk " + std::to_string(i) + " is out of range!");
+		}
+	}
+	return chunks;
+}
+
+// indices are local to their chunk (drawn with vertexOffset = firstVertex), so each one must stay below the
+// chunk's vertex count; checked while the chunk is streamed rather than in parseMeshFile, which only touches the table
+template<typename Index>
+static void checkMeshChunkIndices(const char* data, const MeshFileChunk& chunk)
+{
+	const Index* indices = reinterpret_cast<const Index*>(data + chunk.indexDataOffset);
+	for (uint32_t i = 0; i < chunk.indexCount; i++)
+	{
+		if (indices[i] >= chunk.vertexCount)
+		{
+			throw std::runtime_error("Mesh file index " + std::to_string(uint64_t(chunk.firstIndex) + i) + " is out of range!");
+		}
+	}
+}
+
+// splits the mesh into chunks of at most MESH_CHUNK_TRIANGLES triangles and 65535 vertices (16-bit local indices)
+static void writeMeshFile(const std::string& filename, const Mesh& mesh)
+{
+	std::vector<MeshFileChunk> chunks;
+	std::vector<Vertex> chunkVertexData;
+	std::vector<uint16_t> chunkIndexData;
+
+	std::vector<uint32_t> localIndex(mesh.vertices.size(), UINT32_MAX);
+	std::vector<uint32_t> chunkSourceVertices;
+	std::vector<uint16_t> chunkIndices;
+
+	auto flushChunk = [&]()
+	{
+		if (chunkIndices.empty())
+			return;
+
+		MeshFileChunk chunk = {};
+		chunk.firstVertex = static_cast<uint32_t>(chunkVertexData.size());
+		chunk.vertexCount = static_cast<uint32_t>(chunkSourceVertices.size());
+		chunk.firstIndex = static_cast<uint32_t>(chunkIndexData.size());
+		chunk.indexCount = static_cast<uint32_t>(chunkIndices.size());
+
+		for (uint32_t source : chunkSourceVertices)
+		{
+			chunkVertexData.push_back(mesh.vertices[source]);
+			localIndex[source] = UINT32_MAX;
+		}
+		chunkIndexData.insert(chunkIndexData.end(), chunkIndices.begin(), chunkIndices.end());
+		computeBounds(&chunkVertexData[chunk.firstVertex], chunk.vertexCount, chunk.boundsMin, chunk.boundsMax);
+		chunks.push_back(chunk);
+
+		chunkSourceVertices.clear();
+		chunkIndices.clear();
+	};
+
+	for (size_t triangle = 0; triangle < mesh.indices.size() / 3; triangle++)
+	{
+		const uint32_t* corners = &mesh.indices[triangle * 3];
+		size_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			newVertices += localIndex[corners[k]] == UINT32_MAX ? 1 : 0;
+		}
+		if (chunkIndices.size() / 3 == MESH_CHUNK_TRIANGLES || chunkSourceVertices.size() + newVertices > 0xFFFF)
+		{
+			flushChunk();
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			if (localIndex[corners[k]] == UINT32_MAX)
+			{
+				localIndex[corners[k]] = static_cast<uint32_t>(chunkSourceVertices.size());
+				chunkSourceVertices.push_back(corners[k]);
+			}
+			chunkIndices.push_back(static_cast<uint16_t>(localIndex[corners[k]]));
+		}
+	}
+	flushChunk();
+
+	MeshFileHeader header = {};
+	header.magic = MESH_FILE_MAGIC;
+	header.version = MESH_FILE_VERSION;
+	header.vertexStride = sizeof(Vertex);
+	header.indexSize = sizeof(uint16_t);
+	header.chunkCount = static_cast<uint32_t>(chunks.size());
+	header.vertexCount = chunkVertexData.size();
+	header.indexCount = chunkIndexData.size();
+	computeBounds(chunkVertexData.data(), chunkVertexData.size(), header.boundsMin, header.boundsMax);
+
+	// lay out the chunk data behind the chunk table
+	uint64_t offset = sizeof(MeshFileHeader) + chunks.size() * sizeof(MeshFileChunk);
+	for (auto& chunk : chunks)
+	{
+		chunk.vertexDataOffset = alignUp(offset, 16);
+		chunk.indexDataOffset = alignUp(chunk.vertexDataOffset + uint64_t(chunk.vertexCount) * sizeof(Vertex), 16);
+		offset = chunk.indexDataOffset + uint64_t(chunk.indexCount) * sizeof(uint16_t);
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + filename);
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(MeshFileChunk));
+	const char padding[16] = {};
+	for (const auto& chunk : chunks)
+	{
+		file.write(padding, static_cast<std::streamsize>(chunk.vertexDataOffset - file.tellp()));
+		file.write(reinterpret_cast<const char*>(&chunkVertexData[chunk.firstVertex]), chunk.vertexCount * sizeof(Vertex));
+		file.write(padding, static_cast<std::streamsize>(chunk.indexDataOffset - file.tellp()));
+		file.write(reinterpret_cast<const char*>(&chunkIndexData[chunk.firstIndex]), chunk.indexCount * sizeof(uint16_t));
+	}
+
+	if (!file)
+	{
+		throw std::runtime_error("Failed to write " + filename);
+	}
+	std::cout << "mesh: wrote " << filename << ", " << chunks.size() << " chunks, " << header.vertexCount << " vertices, "
+		<< header.indexCount << " indices" << std::endl;
+}
+
+//====================== Textures ==========================
+// decoded texture, TEXTURE_FORMAT texels in tightly packed rows
+struct TextureImage
+{
+	uint32_t				width = 0;
+	uint32_t				height = 0;
+	std::vector<uint8_t>	texels;
+};
+
+static uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	while ((width | height) >> levels)
+	{
+		levels++;
+	}
+	return levels;
+}
+
+// binary PPM (P6, 8 bits per channel), expanded to RGBA
+static TextureImage decodePPM(const std::vector<char>& bytes)
+{
+	size_t pos = 0;
+	auto nextToken = [&]() -> std::string
+	{
+		while (pos < bytes.size())
+		{
+			if (bytes[pos] == '#')
+			{
+				while (pos < bytes.size() && bytes[pos] != '\n')
+					pos++;
+			}
+			else if (std::isspace(static_cast<unsigned char>(bytes[pos])))
+			{
+				pos++;
+			}
+			else
+			{
+				break;
+			}
+		}
+		size_t start = pos;
+		while (pos < bytes.size() && !std::isspace(static_cast<unsigned char>(bytes[pos])))
+		{
+			pos++;
+		}
+		return std::string(bytes.data() + start, pos - start);
+	};
+
+	if (nextToken() != "P6")
+	{
+		throw std::runtime_error("Texture is not a binary PPM (P6) file!");
+	}
+	TextureImage image;
+	image.width = static_cast<uint32_t>(std::stoul(nextToken()));
+	image.height = static_cast<uint32_t>(std::stoul(nextToken()));
+	if (std::stoul(nextToken()) != 255)
+	{
+		throw std::runtime_error("Only 8-bit PPM textures are supported!");
+	}
+	pos++;	// single whitespace in front of the pixel data
+
+	size_t pixelCount = size_t(image.width) * image.height;
+	if (pixelCount == 0 || pos > bytes.size() || bytes.size() - pos < pixelCount * 3)
+	{
+		throw std::runtime_error("PPM texture is truncated!");
+	}
+
+	image.texels.resize(pixelCount * TEXTURE_TEXEL_SIZE);
+	const uint8_t* rgb = reinterpret_cast<const uint8_t*>(bytes.data() + pos);
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		image.texels[i * 4 + 0] = rgb[i * 3 + 0];
+		image.texels[i * 4 + 1] = rgb[i * 3 + 1];
+		image.texels[i * 4 + 2] = rgb[i * 3 + 2];
+		image.texels[i * 4 + 3] = 255;
+	}
+	return image;
+}
+
+// size x size checkerboard of white and a hue picked by seed, 8 x 8 squares
+static TextureImage makeCheckerTexture(uint32_t size, uint32_t seed)
+{
+	float hue = seed * 0.618034f;
+	glm::vec3 color = hueToRgb(hue - std::floor(hue));
+
+	TextureImage image;
+	image.width = size;
+	image.height = size;
+	image.texels.resize(size_t(size) * size * TEXTURE_TEXEL_SIZE);
+
+	const uint32_t square = std::max(1u, size / 8);
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			bool white = ((x / square) + (y / square)) % 2 == 0;
+			uint8_t* texel = &image.texels[(size_t(y) * size + x) * TEXTURE_TEXEL_SIZE];
+			texel[0] = white ? 255 : static_cast<uint8_t>(color.x * 255.0f);
+			texel[1] = white ? 255 : static_cast<uint8_t>(color.y * 255.0f);
+			texel[2] = white ? 255 : static_cast<uint8_t>(color.z * 255.0f);
+			texel[3] = 255;
+		}
+	}
+	return image;
+}
+
+// next mip level on the cpu, 2x2 box filter; only used to build the top level of a version that
+// leaves the most detailed mips out, the rest of the chain is blitted on the gpu
+static TextureImage downsampleTexture(const TextureImage& source)
+{
+	TextureImage image;
+	image.width = std::max(1u, source.width / 2);
+	image.height = std::max(1u, source.height / 2);
+	image.texels.resize(size_t(image.width) * image.height * TEXTURE_TEXEL_SIZE);
+
+	for (uint32_t y = 0; y < image.height; y++)
+	{
+		for (uint32_t x = 0; x < image.width; x++)
+		{
+			uint32_t x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+			uint32_t y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+			for (uint32_t c = 0; c < TEXTURE_TEXEL_SIZE; c++)
+			{
+				uint32_t sum = source.texels[(size_t(y0) * source.width + x0) * TEXTURE_TEXEL_SIZE + c]
+					+ source.texels[(size_t(y0) * source.width + x1) * TEXTURE_TEXEL_SIZE + c]
+					+ source.texels[(size_t(y1) * source.width + x0) * TEXTURE_TEXEL_SIZE + c]
+					+ source.texels[(size_t(y1) * source.width + x1) * TEXTURE_TEXEL_SIZE + c];
+				image.texels[(size_t(y) * image.width + x) * TEXTURE_TEXEL_SIZE + c] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+	return image;
+}
+
+static bool isFutureReady(const std::future<void>& future)
+{
+	return !future.valid() || future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+class HelloTriangleApplication
+{
+	struct QueueFamilyIndices
+	{
+		std::optional<uint32_t> graphicsFamily;
+		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> transferFamily;	// dedicated transfer family if there is one, else graphics
+
+		bool isComplete()
+		{
+			return graphicsFamily.has_value() && presentFamily.has_value();
+		}
+	};
+
+	struct SwapchainSupportDetails
+	{
+		VkSurfaceCapabilitiesKHR capabilities;
+		std::vector<VkSurfaceFormatKHR> formats;
+		std::vector<VkPresentModeKHR> presentModes;
+	};
+
+	// one in-flight upload, retired in submission order once its fence or timeline value signals
+	struct PendingUpload
+	{
+		uint64_t			ticket;
+		VkFence				fence;					// fence backend
+		uint64_t			timelineValue;			// timeline backend
+		VkCommandBuffer		transferCommandBuffer;
+		VkCommandBuffer		acquireCommandBuffer;	// graphics-side ownership acquire, null when families match
+		VkSemaphore			ownershipSemaphore;
+		VkDeviceSize		ringOffset;
+		VkDeviceSize		ringEnd;
+	};
+
+	// swapchain objects replaced by a recreation, destroyed once the last frame that used them has finished
+	struct RetiredSwapchain
+	{
+		VkSwapchainKHR					swapChain;
+		std::vector<VkImageView>		imageViews;
+		uint64_t						lastFrame;
+	};
+
+	// a range of the index buffer drawn with one vkCmdDrawIndexed
+	struct MeshDrawChunk
+	{
+		uint32_t		firstIndex;
+		uint32_t		indexCount;
+		int32_t			vertexOffset;
+		glm::vec3		boundsMin;
+		glm::vec3		boundsMax;
+	};
+
+	// one pipeline permutation, compiled on _pipelineCompilePool
+	struct PipelineVariantEntry
+	{
+		PipelineVariant			variant;
+		VkPipeline				pipeline = VK_NULL_HANDLE;
+		double					compileMs = 0.0;
+		std::future<void>		compiled;
+	};
+
+	// indirect draw output of the culling pass, per frame in flight
+	struct CullFrame
+	{
+		VkBuffer				drawCommands = VK_NULL_HANDLE;
+		GpuAllocation			drawCommandsAllocation;
+		VkBuffer				drawCount = VK_NULL_HANDLE;
+		GpuAllocation			drawCountAllocation;
+		VkDescriptorSet			descriptorSet = VK_NULL_HANDLE;
+	};
+
+	// gpu queries of one frame in flight, read back once the frame's fence has signaled
+	struct FrameQueries
+	{
+		VkQueryPool		timestampPool;			// 2 timestamps around the render pass
+		VkQueryPool		statisticsPool;			// null unless pipeline statistics are enabled
+		bool			pending;				// written by a submitted frame that has not been read yet
+		bool			statisticsActive;		// the statistics query was recorded for that frame
+		uint64_t		frameNumber;
+	};
+
+	// one copy of a streamed texture holding mips [baseMip, mipLevels) of the decoded image
+	struct TextureVersion
+	{
+		uint32_t				baseMip = 0;
+		uint32_t				width = 0;
+		uint32_t				height = 0;
+		uint32_t				levels = 0;
+		VkImage					image = VK_NULL_HANDLE;
+		GpuAllocation			allocation;
+		VkImageView				view = VK_NULL_HANDLE;
+		uint32_t				slot = 0;				// bindless texture slot, valid once the view exists
+		TextureImage			baseLevel;				// texels of baseMip when it is not mip 0, built on a worker
+		std::future<void>		prepared;
+		uint32_t				uploadedRows = 0;
+		uint64_t				uploadTicket = 0;
+		bool					mipsPending = false;	// swapped in, mips are blitted by the next recorded frame
+		uint64_t				lastFrame = 0;			// retired versions: last frame that may sample it
+	};
+
+	// a texture decoded on _textureStreamPool; changing its residency builds a new version and retires the old one
+	struct StreamedTexture
+	{
+		std::string						source;			// .ppm file, empty for a procedural texture
+		TextureImage					decoded;		// full resolution mip 0, kept to build other base levels
+		std::future<void>				decodeJob;
+		uint32_t						mipLevels = 0;	// 0 until decoded
+		uint32_t						requestedMip = 0;	// most detailed mip that should be resident
+		std::unique_ptr<TextureVersion>	resident;
+		std::unique_ptr<TextureVersion>	pending;
+	};
+
+	// micro-benchmark results of one physical device
+	struct DeviceBenchmark
+	{
+		double		fillGpixels = 0.0;		// cleared gigapixels per second
+		double		uploadGBs = 0.0;		// host-visible to device-local copy, GB/s
+		double		computeGflops = 0.0;
+	};
+
+	// command recording state of one frame in flight; pools are transient and reset as a whole each frame
+	struct FrameCommands
+	{
+		VkCommandPool					commandPool;
+		VkCommandBuffer					primary;
+		std::vector<VkCommandPool>		workerPools;		// one per recording job, never shared between threads
+		std::vector<VkCommandBuffer>	secondaries;		// one per recording job, allocated from workerPools
+	};
+public:
+	explicit HelloTriangleApplication(const AppConfig& config) : _config(config) {}
+
+	void Run()
+	{
+		_launchTime = std::chrono::high_resolution_clock::now();
+		_initVulkan();
+		if (_config.benchmark == "record")
+		{
+			_recordBenchmark();
+		}
+		else if (_config.benchmark == "mesh-load")
+		{
+			_meshLoadBenchmark();
+		}
+		else if (_config.benchmark == "instancing")
+		{
+			_instancingBenchmark();
+		}
+		else if (_config.benchmark == "culling")
+		{
+			_cullingBenchmark();
+		}
+		else if (_config.benchmark == "latency")
+		{
+			_latencyBenchmark();
+		}
+		else if (_config.benchmark == "texture-streaming")
+		{
+			_textureStreamingBenchmark();
+		}
+		else if (_config.benchmark == "vertex-format")
+		{
+			_vertexFormatBenchmark();
+		}
+		else if (_config.benchmark == "overdraw")
+		{
+			_overdrawBenchmark();
+		}
+		else if (_config.benchmark == "msaa")
+		{
+			_msaaBenchmark();
+		}
+		else if (_config.headless)
+		{
+			_offscreenLoop();
+		}
+		else if (_config.benchmark == "resize-storm")
+		{
+			_resizeStormLoop();
+		}
+		else
+		{
+			_mainLoop();
+		}
+		_cleanup();
+	}
+
+private:
+	AppConfig							_config;
+
+	GLFWwindow*							_window = nullptr;
+
+	// vulkan
+	VkInstance							_instance;
+
+	// debug messenger
+	VkDebugUtilsMessengerEXT			debugMessenger;
+
+	// physical device-->gpu graphics card
+	VkPhysicalDevice					_physicalDevice = VK_NULL_HANDLE;
+
+	// logic device
+	VkDevice							_device;
+
+	// queue handle
+	VkQueue								_graphicsQueue;
+	VkQueue								_presentQueue;
+	VkQueue								_transferQueue;
+
+	// surface
+	VkSurfaceKHR						_surface;
+
+	// swapchain
+	VkSwapchainKHR						_swapChain = VK_NULL_HANDLE;
+	std::deque<RetiredSwapchain>		_retiredSwapchains;
+	uint32_t							_swapchainRecreations = 0;
+	std::vector<VkImage>				_swapChainImages;
+	VkFormat							_swapChainImageFormat;
+	VkExtent2D							_swapChainExtent;
+
+	// image view
+	std::vector<VkImageView>			_swapChainImageViews;
+
+	// pipeline layout
+	VkPipelineLayout					_pipelineLayout;
+
+	// render pass the pipelines are built against, owned by _renderGraph
+	VkRenderPass						_renderPass;
+
+	// depth buffer: a transient of the render graph at the scene extent
+	VkFormat							_depthFormat = VK_FORMAT_UNDEFINED;
+	float								_depthStep = 0.0f;			// between depth layers, see _updateDepthLayers
+	float								_instanceDepthStep = 0.0f;	// 0 when the instances of a draw share its layer
+	uint32_t							_depthLayersPerDraw = 1;
+	uint32_t							_depthLayerCount = 1;		// usable layers, the far plane excluded
+	VkRenderPass						_depthPrepassRenderPass = VK_NULL_HANDLE;	// depth only, owned by _renderGraph
+	VkPipeline							_depthPrepassPipeline = VK_NULL_HANDLE;		// null without --depth-prepass
+
+	// samples of the color and depth attachments the scene is drawn into; above 1 the color is resolved in the subpass
+	VkSampleCountFlagBits				_sampleCount = VK_SAMPLE_COUNT_1_BIT;
+
+	// the frame's passes, rebuilt every frame; see RenderGraph
+	RenderGraph							_renderGraph;
+	VkExtent2D							_sceneExtent = {};		// _swapChainExtent times the render scale
+	VkFilter							_upscaleFilter = VK_FILTER_LINEAR;
+	bool								_swapchainTransferDst = false;	// the swapchain images can be blitted to
+	VkPipelineStageFlags				_backbufferWaitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	RenderGraph::Stats					_lastRenderGraphStats;
+	uint64_t							_renderGraphFrames = 0;
+	uint64_t							_renderGraphBarriers = 0;
+
+	// graphics pipeline, the variant used for drawing
+	VkPipeline							_graphicsPipeline;
+
+	// all pipeline variants; the ones needed for the first frame are waited for, the rest finish in the background
+	std::vector<PipelineVariantEntry>	_pipelineVariants;
+	std::unique_ptr<ThreadPool>			_pipelineCompilePool;
+	VkShaderModule						_vertShaderModule = VK_NULL_HANDLE;
+	VkShaderModule						_fragShaderModule = VK_NULL_HANDLE;
+	std::vector<char>					_vertShaderCode;	// SPIR-V read at startup, kept for pipeline recreation
+	std::vector<char>					_fragShaderCode;
+	std::vector<char>					_cullShaderCode;
+	std::atomic<uint32_t>				_pendingPipelineVariants{ 0 };
+	std::chrono::high_resolution_clock::time_point	_pipelineCompileStart;
+	double								_pipelineCriticalPathMs = 0.0;
+	bool								_pipelineVariantsReported = true;
+
+	// pipeline cache, loaded from / saved to PIPELINE_CACHE_FILE
+	VkPipelineCache						_pipelineCache = VK_NULL_HANDLE;
+	bool								_pipelineCacheWarm = false;
+	std::vector<char>					_pipelineCacheData;	// file contents until the cache is created
+
+	// startup: launch to first presented frame
+	std::chrono::high_resolution_clock::time_point	_launchTime;
+	double								_initializationMs = 0.0;
+	bool								_firstFrameReported = false;
+	Mesh								_startupMesh;		// built while the device is created, uploaded by _createVertexBuffers
+
+	// packing of the vertex buffer
+	VertexLayoutInfo					_vertexLayout;
+	std::vector<Vertex>					_sourceVertices;	// kept for re-encoding by the vertex-format benchmark
+
+	// command pools and buffers, one set per frame in flight
+	std::vector<FrameCommands>			_frameCommands;
+
+	// workers recording secondary command buffers, null when recording inline
+	std::unique_ptr<ThreadPool>			_recordPool;
+	double								_lastRecordMs = 0.0;
+
+	// gpu timestamps / pipeline statistics per frame in flight
+	std::vector<FrameQueries>			_frameQueries;
+	bool								_timestampsSupported = false;
+	float								_timestampPeriod = 1.0f;	// nanoseconds per tick
+	uint64_t							_timestampMask = ~0ull;		// timestampValidBits of the graphics queue
+	GpuFrameHistory						_gpuHistory;
+
+	// present mode of the current swapchain, differs from _config.presentMode when that one is unsupported
+	VkPresentModeKHR					_presentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+
+	// per-frame uniform ring: one region per frame in flight, bound with a dynamic offset
+	VkBuffer							_uniformRingBuffer = VK_NULL_HANDLE;
+	GpuAllocation						_uniformRingAllocation;
+	VkDeviceSize						_uniformRegionSize = 0;
+	VkDeviceSize						_uniformAlignment = 0;		// minUniformBufferOffsetAlignment
+	VkDeviceSize						_nonCoherentAtomSize = 0;
+	bool								_uniformRingCoherent = false;
+	VkDeviceSize						_uniformHead = 0;			// bytes used in the current frame's region
+	uint32_t							_frameUniformOffset = 0;	// dynamic offset of this frame's FrameUniforms
+	VkDescriptorSetLayout				_uniformSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool					_uniformDescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet						_uniformSet = VK_NULL_HANDLE;
+	std::chrono::high_resolution_clock::time_point	_startTime = std::chrono::high_resolution_clock::now();
+
+	// bindless descriptor table: texture and storage buffer arrays shared by every draw, indexed by material
+	bool								_descriptorIndexing = false;
+	uint32_t							_textureCapacity = 0;
+	uint32_t							_bufferCapacity = 0;
+	VkDescriptorSetLayout				_bindlessSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool					_bindlessPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet>		_bindlessSets;			// one with update-after-bind, one per frame in flight otherwise
+	std::vector<uint64_t>				_bindlessSetVersions;	// fallback: table version each set was last written with
+	uint64_t							_bindlessVersion = 0;
+	std::vector<VkDescriptorImageInfo>	_bindlessTextures;
+	std::vector<VkDescriptorBufferInfo>	_bindlessBuffers;
+	VkSampler							_defaultSampler = VK_NULL_HANDLE;
+	VkImage								_defaultTexture = VK_NULL_HANDLE;
+	GpuAllocation						_defaultTextureAllocation;
+	VkImageView							_defaultTextureView = VK_NULL_HANDLE;
+	VkBuffer							_materialBuffer = VK_NULL_HANDLE;
+	GpuAllocation						_materialBufferAllocation;
+	std::vector<uint32_t>				_freeTextureSlots;		// released slots, reused before the array grows
+	std::atomic<uint64_t>				_descriptorWrites{ 0 };
+	std::atomic<uint64_t>				_descriptorBinds{ 0 };
+
+	// texture streaming: decoding and base levels run on the pool, uploads are capped per frame, mips are blitted
+	// on the graphics queue; versions replaced by a residency change are destroyed once no frame samples them
+	std::unique_ptr<ThreadPool>			_textureStreamPool;
+	std::vector<StreamedTexture>		_streamedTextures;
+	std::deque<std::unique_ptr<TextureVersion>>	_retiredTextureVersions;
+	std::vector<TextureVersion*>		_textureMipJobs;
+	VkFilter							_mipFilter = VK_FILTER_LINEAR;
+	bool								_textureResidencyPinned = false;	// requestedMip set by the caller instead of the on-screen size
+	VkDeviceSize						_lastTextureUploadBytes = 0;
+	VkDeviceSize						_peakTextureUploadBytes = 0;
+	uint64_t							_textureUploadBytes = 0;
+	uint32_t							_texturePromotions = 0;
+	uint32_t							_textureEvictions = 0;
+
+	// memory budget: under device-local pressure streamed textures keep fewer of their finest mips resident
+	uint32_t							_textureBudgetMipBias = 0;
+	uint64_t							_lastBudgetReactionFrame = 0;
+	std::chrono::high_resolution_clock::time_point	_lastMemoryReport;
+
+	// latency measurement, only running during the latency benchmark
+	std::unique_ptr<FrameLatencyProbe>	_latencyProbe;
+	double								_lastAcquireToPresentMs = 0.0;
+
+	// features and optional extensions enabled on the logical device
+	VkPhysicalDeviceFeatures			_enabledFeatures = {};
+	std::set<std::string>				_enabledDeviceExtensions;
+
+	// gpu-driven culling
+	std::vector<CullObject>				_cullObjects;
+	VkBuffer							_cullObjectBuffer = VK_NULL_HANDLE;
+	GpuAllocation						_cullObjectAllocation;
+	std::vector<CullFrame>				_cullFrames;
+	VkDescriptorSetLayout				_cullDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool					_cullDescriptorPool = VK_NULL_HANDLE;
+	VkPipelineLayout					_cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline							_cullPipeline = VK_NULL_HANDLE;
+	bool								_gpuCullingSupported = false;
+	uint32_t							_maxDrawIndirectCount = 1;
+	PFN_vkCmdDrawIndexedIndirectCountKHR	_vkCmdDrawIndexedIndirectCount = nullptr;
+	std::atomic<uint32_t>				_cpuVisibleObjects{ 0 };
+
+	// cpu cost of the last vkQueueSubmit, for the benchmarks
+	double								_lastSubmitMs = 0.0;
+	std::chrono::high_resolution_clock::time_point	_lastSubmitEnd;
+
+	// semaphores
+	std::vector<VkSemaphore>			_imageAvailableSemaphores;
+	std::vector<VkSemaphore>			_renderFinishedSemaphores;
+	std::vector<VkFence>				_inFlightFences;		// fence backend only
+	std::vector<uint64_t>				_imageFrameNumbers;		// last frame rendered into each swapchain image
+
+	// timeline backend: every graphics-queue submit (frames and uploads) signals the next value of one semaphore
+	bool								_timelineSync = false;
+	VkSemaphore							_timeline = VK_NULL_HANDLE;
+	uint64_t							_timelineValue = 0;		// last value handed out to a submit
+	std::vector<uint64_t>				_frameTimelineValues;	// value signaled by each in-flight slot's last frame
+	PFN_vkWaitSemaphoresKHR				_vkWaitSemaphores = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR	_vkGetSemaphoreCounterValue = nullptr;
+	bool								_physicalDeviceProperties2 = false;	// instance has VK_KHR_get_physical_device_properties2
+	bool								_physicalDeviceIdProperties = false;	// and VK_KHR_external_memory_capabilities, for the device UUID
+
+	// current frame
+	size_t								_currentFrame = 0;
+
+	// frame numbers: submitted so far, last one submitted per in-flight slot, last one known complete
+	uint64_t							_frameNumber = 0;
+	std::vector<uint64_t>				_frameSlotNumbers;
+	uint64_t							_completedFrameNumber = 0;
+
+	// resized
+	bool								_framebufferResized = false;
+
+	// gpu memory sub-allocator, backs every buffer and image
+	GpuAllocator						_allocator;
+
+	// vertex buffer
+	VkBuffer							_vertexBuffer;
+	GpuAllocation						_vertexBufferAllocation;
+
+	// index buffer, 16-bit when the mesh has few enough vertices
+	VkBuffer							_indexBuffer;
+	GpuAllocation						_indexBufferAllocation;
+	VkIndexType							_indexType = VK_INDEX_TYPE_UINT16;
+
+	// draw ranges of the mesh; only the first _streamedChunkCount have been uploaded
+	std::vector<MeshDrawChunk>			_meshChunks;
+	uint32_t							_streamedChunkCount = 0;
+
+	// mesh file being streamed, released once every chunk has been copied out of it
+	std::unique_ptr<MappedFile>			_meshFile;
+	const MeshFileHeader*				_meshFileHeader = nullptr;
+	const MeshFileChunk*				_meshFileChunks = nullptr;
+	uint32_t							_meshStreamFrames = 0;
+
+	// per-instance data, _config.instanceCount entries
+	VkBuffer							_instanceBuffer = VK_NULL_HANDLE;
+	GpuAllocation						_instanceBufferAllocation;
+	uint64_t							_instanceUploadTicket = 0;
+
+	// uploads: staging ring + transfer queue, callers get a ticket instead of blocking
+	VkCommandPool						_transferCommandPool;
+	VkCommandPool						_uploadAcquireCommandPool;
+	VkBuffer							_stagingRingBuffer;
+	GpuAllocation						_stagingRingAllocation;
+	std::deque<PendingUpload>			_pendingUploads;
+	std::vector<VkFence>				_freeUploadFences;
+	std::vector<VkSemaphore>			_freeUploadSemaphores;
+	uint64_t							_nextUploadTicket = 1;
+	uint64_t							_completedUploadTicket = 0;
+
+	// offscreen render targets (headless mode), exposed through _swapChainImages
+	std::vector<GpuAllocation>			_offscreenImageAllocations;
+	uint32_t							_offscreenImageIndex = 0;
+private:
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+		void* pUserdata)
+	{
+		std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+
+		return VK_FALSE;
+	}
+	void _initWindow()
+	{
+		glfwInit();
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);	// no openGL api
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);		// no resize
+
+		_window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+		glfwSetWindowUserPointer(_window, this);
+		glfwSetFramebufferSizeCallback(_window, framebufferResizeCallback);
+	}
+
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height)
+	{
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->_framebufferResized = true;
+	}
+
+	bool _checkValidationLayerSupport()
+	{
+		uint32_t layerCount = 0;
+		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+		std::vector<VkLayerProperties> availibleLayers(layerCount);
+		vkEnumerateInstanceLayerProperties(&layerCount, availibleLayers.data());
+
+		bool layerFound = false;
+		for (const char* layerName : validationLayers)
+		{
+			for (const auto& layerProperties : availibleLayers)
+			{
+				if (strcmp(layerName, layerProperties.layerName) == 0)
+				{
+					layerFound = true;
+					break;
+				}
+			}
+
+		}
+		if (!layerFound)
+			return false;
+
+		return true;
+	}
+
+	std::vector<const char*> getRequiredExtensions()
+	{
+		uint32_t gfwExtensionCount = 0;
+		const char** glfwExtensions = nullptr;
+
+		// headless mode never initializes glfw and needs no surface extensions
+		if (!_config.headless)
+		{
+			glfwExtensions = glfwGetRequiredInstanceExtensions(&gfwExtensionCount);
+		}
+
+		std::vector<const char*> extensions(glfwExtensions, glfwExtensions + gfwExtensionCount);
+		if (enableValidationLayer)
+		{
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
+
+		// needed to query and enable extension features such as timeline semaphores on a 1.0 instance
+		uint32_t availableCount = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+		std::vector<VkExtensionProperties> available(availableCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, available.data());
+		bool externalMemoryCapabilities = false;
+		for (const auto& extension : available)
+		{
+			if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+			{
+				extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+				_physicalDeviceProperties2 = true;
+			}
+			else if (strcmp(extension.extensionName, VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME) == 0)
+			{
+				externalMemoryCapabilities = true;
+			}
+		}
+
+		// VkPhysicalDeviceIDProperties, whose device UUID keys the device benchmark cache, comes with this extension
+		if (_physicalDeviceProperties2 && externalMemoryCapabilities)
+		{
+			extensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+			_physicalDeviceIdProperties = true;
+		}
+
+		return extensions;
+	}
+
+	void _createInstance()
+	{
+		if (enableValidationLayer && !_checkValidationLayerSupport())
+		{
+			throw std::runtime_error("validation layers requested, but not availible");
+		}
+		VkApplicationInfo appInfo = {};
+		appInfo.sType				= VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		appInfo.pApplicationName	= "Hello Triangle";
+		appInfo.applicationVersion	= VK_MAKE_VERSION(1, 0, 0);
+		appInfo.pEngineName			= "No Engine";
+		appInfo.engineVersion		= VK_MAKE_VERSION(1, 0, 0);
+		appInfo.apiVersion			= VK_API_VERSION_1_0;
+
+		VkInstanceCreateInfo createInfo = {};
+		createInfo.sType			= VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		createInfo.pApplicationInfo = &appInfo;
+
+		auto extensions = getRequiredExtensions();
+
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+		createInfo.ppEnabledExtensionNames  = extensions.data();
+
+		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+		if (enableValidationLayer)
+		{
+			createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+			createInfo.ppEnabledLayerNames = validationLayers.data();
+
+			_populateDebugMessengerCreateInfo(debugCreateInfo);
+			createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)&debugCreateInfo;
+		}
+		else
+		{
+			createInfo.enabledLayerCount = 0;
+		}
+
+		
+		if (vkCreateInstance(&createInfo, nullptr, &_instance) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create instance!");
+		}		
+	}
+
+	void _populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo)
+	{
+		createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		createInfo.pfnUserCallback = debugCallback;
+	}
+
+	void _drawFrame()
+	{
+		_waitFrame(_frameSlotNumbers[_currentFrame]);
+
+		// frames retire in submission order, so every frame up to this slot's last one is done
+		_completedFrameNumber = std::max(_completedFrameNumber, _frameSlotNumbers[_currentFrame]);
+		_pollCompletedFrames();
+		_collectRetiredSwapchains();
+		_renderGraph.collect(_completedFrameNumber);
+		_readFrameQueries(_frameQueries[_currentFrame]);
+
+		_collectUploads();
+		_updateMemoryBudget();
+		_streamMeshChunks();
+		_streamTextures();
+		_pollPipelineVariants();
+
+		// acquiring an image
+		auto acquireStart = std::chrono::high_resolution_clock::now();
+		uint32_t imageIndex;
+		VkResult result = VK_SUCCESS;
+		if (_config.headless)
+		{
+			// offscreen targets are used round-robin, nothing to acquire
+			imageIndex = _offscreenImageIndex;
+			_offscreenImageIndex = (_offscreenImageIndex + 1) % static_cast<uint32_t>(_swapChainImages.size());
+		}
+		else
+		{
+			result = vkAcquireNextImageKHR(_device, _swapChain, UINT64_MAX, _imageAvailableSemaphores[_currentFrame], VK_NULL_HANDLE, &imageIndex);
+		}
+
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			_recreateSwapChain();
+			return;
+		}
+		else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			throw std::runtime_error("Failed to acquire swap chain image!");
+		}
+
+		_waitFrame(_imageFrameNumbers[imageIndex]);
+		_imageFrameNumbers[imageIndex] = _frameNumber + 1;	// the frame submitted below
+
+		// the frame fence has signaled, so this frame's pools are no longer in use
+		auto recordStart = std::chrono::high_resolution_clock::now();
+		_recordCommandBuffer(_frameCommands[_currentFrame], _frameQueries[_currentFrame], imageIndex);
+		_lastRecordMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+
+		// submitting the command buffer
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+		VkSemaphore watsSemaphores[] = { _imageAvailableSemaphores[_currentFrame] };
+		VkPipelineStageFlags waitStages[] = { _backbufferWaitStage };
+		submitInfo.waitSemaphoreCount = _config.headless ? 0 : 1;
+		submitInfo.pWaitSemaphores = watsSemaphores;
+		submitInfo.pWaitDstStageMask = waitStages;
+
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &_frameCommands[_currentFrame].primary;
+
+		VkSemaphore signalSemaphores[] = { _renderFinishedSemaphores[_currentFrame] };
+		submitInfo.signalSemaphoreCount = _config.headless ? 0 : 1;
+		submitInfo.pSignalSemaphores = signalSemaphores;
+
+		TimelineSignal timelineSignal;
+		VkFence submitFence = VK_NULL_HANDLE;
+		if (_timelineSync)
+		{
+			_frameTimelineValues[_currentFrame] = _addTimelineSignal(submitInfo, timelineSignal);
+		}
+		else
+		{
+			// the probe may not have waited on this slot's last frame yet, resetting the fence would hide its signal
+			if (_latencyProbe)
+			{
+				_latencyProbe->waitProbed(_frameSlotNumbers[_currentFrame]);
+			}
+			submitFence = _inFlightFences[_currentFrame];
+			vkResetFences(_device, 1, &submitFence);
+		}
+
+		auto submitStart = std::chrono::high_resolution_clock::now();
+		if (vkQueueSubmit(_graphicsQueue, 1, &submitInfo, submitFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit draw command buffer");
+		}
+		_lastSubmitEnd = std::chrono::high_resolution_clock::now();
+		_lastSubmitMs = std::chrono::duration<double, std::milli>(_lastSubmitEnd - submitStart).count();
+		_frameQueries[_currentFrame].pending = _timestampsSupported;
+		_frameQueries[_currentFrame].frameNumber = _frameNumber;
+		_frameSlotNumbers[_currentFrame] = ++_frameNumber;
+		if (_latencyProbe)
+		{
+			VkDevice device = _device;
+			uint64_t value = _frameTimelineValues[_currentFrame];
+			std::function<void()> waitComplete = [device, submitFence] { vkWaitForFences(device, 1, &submitFence, VK_TRUE, UINT64_MAX); };
+			if (_timelineSync)
+			{
+				waitComplete = [this, value] { _waitTimeline(value); };
+			}
+			_latencyProbe->submitted(_frameNumber, waitComplete, _lastSubmitEnd);
+		}
+
+		// nothing to present in headless mode, the in-flight fence is the only sync needed
+		if (_config.headless)
+		{
+			_reportFirstFrame();
+			_currentFrame = (_currentFrame + 1) % _config.framesInFlight;
+			return;
+		}
+
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = signalSemaphores;
+
+		VkSwapchainKHR swapChains[] = { _swapChain };
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = swapChains;
+		presentInfo.pImageIndices = &imageIndex;
+
+		presentInfo.pResults = nullptr;
+
+		result = vkQueuePresentKHR(_presentQueue, &presentInfo);
+		_lastAcquireToPresentMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - acquireStart).count();
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || _framebufferResized)
+		{
+			_framebufferResized = false;
+			_recreateSwapChain();
+		}
+		else if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to present swap chain image!");
+		}
+		_reportFirstFrame();
+
+		_currentFrame = (_currentFrame + 1) % _config.framesInFlight;
+	}
+
+	// Startup as a dependency graph: file reads and mesh building overlap with window, instance and device
+	// creation, and after the device the swapchain chain, descriptor layouts, pipelines and uploads run side by side.
+	// Uploads stay in one chain, they share the staging ring and the queues.
+	void _initVulkan()
+	{
+		const bool culling = _usesCullingPipeline();
+
+		StartupGraph graph;
+		const size_t shaders = graph.add("load shaders", {}, [this, culling]()
+		{
+			_vertShaderCode = readFile("shaders/vert.spv");
+			_fragShaderCode = readFile("shaders/frag.spv");
+			if (culling)
+			{
+				_cullShaderCode = readFile("shaders/cull.spv");
+			}
+		});
+		const size_t cacheFile = graph.add("read cache file", {}, [this]() { _readPipelineCacheFile(); });
+		const size_t mesh = graph.add("build mesh", {}, [this]() { _prepareMesh(); });
+
+		std::vector<size_t> instanceDependencies;
+		if (!_config.headless)
+		{
+			// glfwInit has to run before the instance asks for the surface extensions
+			instanceDependencies.push_back(graph.add("window", {}, [this]() { _initWindow(); }, true));
+		}
+		const size_t instance = graph.add("instance", instanceDependencies, [this]()
+		{
+			_createInstance();
+			_setupMessenger();
+		});
+		size_t surface = instance;
+		if (!_config.headless)
+		{
+			// The window surface needs to be created right after the instance creation
+			surface = graph.add("surface", { instance }, [this]() { _createSurface(); }, true);
+		}
+		const size_t device = graph.add("device", { surface }, [this]()
+		{
+			_pickPhysicalDevice();
+			_createLogicDevice();
+			_allocator.init(_device, _physicalDevice);
+			_renderGraph.init(_device, _physicalDevice, _allocator);
+			_initMemoryBudget();
+			_createTimelineSemaphore();
+		});
+
+		const size_t cache = graph.add("pipeline cache", { device, cacheFile }, [this]() { _createPipelineCache(); });
+		const size_t swapchain = graph.add("swapchain", { device }, [this]()
+		{
+			if (_config.headless)
+			{
+				_createOffscreenTargets();
+			}
+			else
+			{
+				_createSwapchain();
+			}
+			_createImageViews();
+		}, !_config.headless);	// the swap extent may come from glfwGetFramebufferSize
+		const size_t renderPass = graph.add("render pass", { swapchain }, [this]()
+		{
+			_updateSceneExtent();
+			_createRenderPass();
+		});
+		const size_t layouts = graph.add("descriptor layouts", { device }, [this]()
+		{
+			_createUniformRing();
+			_createBindlessLayout();
+		});
+		const size_t vertexLayout = graph.add("vertex layout", { device, mesh }, [this]() { _selectVertexLayout(_config.vertexFormat); });
+		const size_t pipeline = graph.add("graphics pipeline", { renderPass, layouts, cache, shaders, vertexLayout }, [this]() { _createGraphicsPipeline(); });
+		const size_t commands = graph.add("command buffers", { device }, [this]()
+		{
+			if (_config.recordThreads > 1)
+			{
+				_recordPool.reset(new ThreadPool(_config.recordThreads));
+			}
+			_createCommandPool();
+			_createCommandBuffers();
+		});
+		const size_t queries = graph.add("query pools", { device }, [this]() { _createQueryPools(); });
+		const size_t sync = graph.add("sync objects", { swapchain }, [this]() { _createSyncObjects(); });
+		const size_t cullPipeline = graph.add("culling pipeline", { cache, shaders }, [this, culling]()
+		{
+			if (culling)
+			{
+				_createCullingPipeline();
+			}
+		});
+
+		const size_t uploader = graph.add("uploader", { device }, [this]() { _createUploader(); });
+		const size_t materials = graph.add("materials", { uploader, layouts }, [this]()
+		{
+			_createDefaultMaterials();
+			_createTextureStreaming();
+		});
+		const size_t geometry = graph.add("vertex buffers", { materials, vertexLayout }, [this]() { _createVertexBuffers(); });
+		const size_t cullBuffers = graph.add("culling buffers", { geometry, cullPipeline }, [this]() { _createCullingBuffers(); });
+
+		graph.add("ready", { pipeline, commands, queries, sync, cullBuffers }, []() {});
+
+		ThreadPool pool(std::max(2u, std::thread::hardware_concurrency() / 2));
+		graph.run(pool);
+
+		_initializationMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _launchTime).count();
+		graph.report();
+	}
+
+	bool _usesCullingPipeline() const
+	{
+		return _config.cullMode != CullMode::None || _config.benchmark == "culling";
+	}
+
+	// called once, after the first frame has been presented (submitted when headless)
+	void _reportFirstFrame()
+	{
+		if (_firstFrameReported)
+			return;
+
+		_firstFrameReported = true;
+		double firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _launchTime).count();
+		std::cout << "startup: first frame " << (_config.headless ? "submitted" : "presented") << " " << firstFrameMs
+			<< " ms after launch, initialization took " << _initializationMs << " ms" << std::endl;
+	}
+
+	uint32_t _findeMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+	{
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memProperties);
+
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		{
+			if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				return i;
+			}
+		}
+
+		throw std::runtime_error("Failed to find suitable memory type!");
+	}
+
+	void _createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, GpuAllocation& allocation)
+	{
+		VkBufferCreateInfo vertexBufferInfo = {};
+		vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		vertexBufferInfo.size = size;
+
+		vertexBufferInfo.usage = usage;
+		vertexBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(_device, &vertexBufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create vertex buffer!");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(_device, buffer, &memRequirements);
+
+		allocation = _allocator.allocate(memRequirements, _findeMemoryType(memRequirements.memoryTypeBits, properties), false);
+
+		vkBindBufferMemory(_device, buffer, allocation.memory, allocation.offset);
+	}
+
+	void _destroyBuffer(VkBuffer buffer, const GpuAllocation& allocation)
+	{
+		vkDestroyBuffer(_device, buffer, nullptr);
+		_allocator.free(allocation);
+	}
+
+	void _createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkImage& image, GpuAllocation& allocation)
+	{
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = format;
+		imageInfo.extent = { width, height, 1 };
+		imageInfo.mipLevels = mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if (vkCreateImage(_device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create image!");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(_device, image, &memRequirements);
+
+		allocation = _allocator.allocate(memRequirements, _findeMemoryType(memRequirements.memoryTypeBits, properties), true);
+
+		vkBindImageMemory(_device, image, allocation.memory, allocation.offset);
+	}
+
+	void _destroyImage(VkImage image, const GpuAllocation& allocation)
+	{
+		vkDestroyImage(_device, image, nullptr);
+		_allocator.free(allocation);
+	}
+
+	//====================== Memory Budget ==========================
+	void _initMemoryBudget()
+	{
+		_lastMemoryReport = std::chrono::high_resolution_clock::now();
+		if (!_enabledDeviceExtensions.count(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+		{
+			std::cout << "VK_EXT_memory_budget is not supported, budgets are estimated from the heap sizes" << std::endl;
+			return;
+		}
+
+		auto getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+		if (getMemoryProperties2)
+		{
+			_allocator.enableBudgetQuery(_physicalDevice, getMemoryProperties2);
+		}
+	}
+
+	// once per frame: refreshes the budget, moves the texture mip bias with the pressure and reports periodically
+	void _updateMemoryBudget()
+	{
+		_allocator.updateBudget();
+
+		double pressure = _allocator.deviceLocalPressure();
+		if (_frameNumber >= _lastBudgetReactionFrame + MEMORY_PRESSURE_REACTION_FRAMES)
+		{
+			uint32_t bias = _textureBudgetMipBias;
+			if (pressure > MEMORY_PRESSURE_HIGH && bias < MEMORY_PRESSURE_MAX_MIP_BIAS)
+			{
+				bias++;
+			}
+			else if (pressure < MEMORY_PRESSURE_LOW && bias > 0)
+			{
+				bias--;
+			}
+
+			if (bias != _textureBudgetMipBias)
+			{
+				std::cout << "memory: device-local pressure " << static_cast<int>(pressure * 100.0) << "%, texture mip bias "
+					<< _textureBudgetMipBias << " -> " << bias << std::endl;
+				_textureBudgetMipBias = bias;
+				_lastBudgetReactionFrame = _frameNumber;
+			}
+		}
+
+		if (_config.memoryReportSeconds > 0.0f)
+		{
+			auto now = std::chrono::high_resolution_clock::now();
+			if (std::chrono::duration<float>(now - _lastMemoryReport).count() >= _config.memoryReportSeconds)
+			{
+				_lastMemoryReport = now;
+				_allocator.printBudgets();
+			}
+		}
+	}
+
+	// runs the load-time optimizer over the triangle list and reports what it bought
+	Mesh _buildMesh()
+	{
+		std::vector<Vertex> triangleList = _config.gridSize > 0 ? makeGridTriangleList(_config.gridSize) : vertices;
+
+		Mesh mesh = deduplicateVertices(triangleList);
+		double acmrBefore = computeACMR(mesh.indices, mesh.vertices.size());
+
+		optimizeVertexCache(mesh.indices, mesh.vertices.size());
+		optimizeVertexFetch(mesh);
+		double acmrAfter = computeACMR(mesh.indices, mesh.vertices.size());
+
+		size_t indexSize = mesh.vertices.size() <= 0xFFFF ? sizeof(uint16_t) : sizeof(uint32_t);
+		size_t nonIndexedBytes = triangleList.size() * sizeof(Vertex);
+		size_t indexedBytes = mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * indexSize;
+
+		std::cout << "mesh: " << mesh.indices.size() / 3 << " triangles, " << triangleList.size() << " -> " << mesh.vertices.size()
+			<< " vertices, " << indexSize * 8 << "-bit indices, ACMR " << acmrBefore << " -> " << acmrAfter << ", "
+			<< nonIndexedBytes << " -> " << indexedBytes << " bytes (saved "
+			<< (nonIndexedBytes > indexedBytes ? nonIndexedBytes - indexedBytes : 0) << ")" << std::endl;
+		return mesh;
+	}
+
+	// startup step without device access, runs while the instance and device are created
+	void _prepareMesh()
+	{
+		if (!_config.meshFile.empty())
+		{
+			_meshFile.reset(new MappedFile(_config.meshFile));
+			_meshFileChunks = parseMeshFile(_meshFile->data(), _meshFile->size(), _meshFileHeader);
+			return;
+		}
+
+		_startupMesh = _buildMesh();
+		if (!_config.writeMeshFile.empty())
+		{
+			writeMeshFile(_config.writeMeshFile, _startupMesh);
+		}
+	}
+
+	void _createVertexBuffers()
+	{
+		if (!_config.meshFile.empty())
+		{
+			_openMeshFile();
+			_createInstanceBuffer();
+			return;
+		}
+
+		Mesh mesh = std::move(_startupMesh);
+		_uploadVertices(mesh.vertices);
+		if (_config.benchmark == "vertex-format")
+		{
+			_sourceVertices = mesh.vertices;
+		}
+
+		MeshDrawChunk chunk = {};
+		chunk.indexCount = static_cast<uint32_t>(mesh.indices.size());
+		float boundsMin[3], boundsMax[3];
+		computeBounds(mesh.vertices.data(), mesh.vertices.size(), boundsMin, boundsMax);
+		chunk.boundsMin = glm::vec3(boundsMin[0], boundsMin[1], boundsMin[2]);
+		chunk.boundsMax = glm::vec3(boundsMax[0], boundsMax[1], boundsMax[2]);
+		_meshChunks = { chunk };
+		_streamedChunkCount = 1;
+
+		if (mesh.vertices.size() <= 0xFFFF)
+		{
+			std::vector<uint16_t> indices16(mesh.indices.begin(), mesh.indices.end());
+			_indexType = VK_INDEX_TYPE_UINT16;
+			_createIndexBuffer(indices16.data(), sizeof(uint16_t) * indices16.size());
+		}
+		else
+		{
+			_indexType = VK_INDEX_TYPE_UINT32;
+			_createIndexBuffer(mesh.indices.data(), sizeof(uint32_t) * mesh.indices.size());
+		}
+
+		_createInstanceBuffer();
+	}
+
+	// packs the vertices with the current layout into a new vertex buffer; no wait needed, the graphics queue sees
+	// the data through the upload's queue ordering
+	void _uploadVertices(const std::vector<Vertex>& vertices)
+	{
+		std::vector<uint8_t> packed(vertices.size() * _vertexLayout.stride);
+		_vertexLayout.encode(vertices.data(), vertices.size(), packed.data());
+
+		_createBuffer(packed.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertexBuffer, _vertexBufferAllocation);
+		_uploadBuffer(_vertexBuffer, 0, packed.data(), packed.size(), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+		std::cout << "vertex format: " << _vertexLayout.name << ", " << _vertexLayout.stride << " bytes per vertex, " << packed.size() / 1024
+			<< " KiB (" << vertices.size() * sizeof(Vertex) / 1024 << " KiB as float)" << std::endl;
+	}
+
+	// The requested layout if the device can fetch its formats and, for snorm16, every position is within [-1, 1];
+	// otherwise half, then float. Returns whether the requested one was taken.
+	bool _selectVertexLayout(VertexFormat requested)
+	{
+		float extent = 0.0f;
+		if (_meshFileHeader)
+		{
+			for (uint32_t i = 0; i < _meshFileHeader->chunkCount; i++)
+			{
+				for (uint32_t axis = 0; axis < 2; axis++)
+				{
+					extent = std::max({ extent, std::abs(_meshFileChunks[i].boundsMin[axis]), std::abs(_meshFileChunks[i].boundsMax[axis]) });
+				}
+			}
+		}
+		else
+		{
+			const std::vector<Vertex>& vertices = _sourceVertices.empty() ? _startupMesh.vertices : _sourceVertices;
+			for (const Vertex& vertex : vertices)
+			{
+				extent = std::max({ extent, std::abs(vertex.pos.x), std::abs(vertex.pos.y) });
+			}
+		}
+
+		auto usable = [&](const VertexLayoutInfo& layout, std::string& reason)
+		{
+			if (layout.format == VertexFormat::Snorm16 && extent > 1.0f)
+			{
+				reason = "positions reach " + std::to_string(extent) + ", outside the snorm range";
+				return false;
+			}
+			for (const VkVertexInputAttributeDescription& attribute : layout.attributes)
+			{
+				VkFormatProperties properties;
+				vkGetPhysicalDeviceFormatProperties(_physicalDevice, attribute.format, &properties);
+				if (!(properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+				{
+					reason = "a format is not supported for vertex buffers";
+					return false;
+				}
+			}
+			return true;
+		};
+
+		for (VertexFormat format : { requested, VertexFormat::Half, VertexFormat::Float })
+		{
+			VertexLayoutInfo layout = vertexLayoutInfo(format);
+			std::string reason;
+			if (usable(layout, reason))
+			{
+				_vertexLayout = std::move(layout);
+				return _vertexLayout.format == requested;
+			}
+			std::cout << "vertex format: " << layout.name << " not used, " << reason << std::endl;
+		}
+		throw std::runtime_error("No usable vertex format!");
+	}
+
+	// sizes the buffers for the file mapped by _prepareMesh; the chunks themselves are streamed by _streamMeshChunks
+	void _openMeshFile()
+	{
+		if (_meshFileHeader->chunkCount == 0)
+		{
+			throw std::runtime_error("Mesh file has no chunks!");
+		}
+
+		_createBuffer(VkDeviceSize(_meshFileHeader->vertexCount) * _vertexLayout.stride, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _vertexBuffer, _vertexBufferAllocation);
+		_createBuffer(_meshFileHeader->indexCount * _meshFileHeader->indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indexBuffer, _indexBufferAllocation);
+		_indexType = _meshFileHeader->indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+		_meshChunks.resize(_meshFileHeader->chunkCount);
+		for (uint32_t i = 0; i < _meshFileHeader->chunkCount; i++)
+		{
+			const MeshFileChunk& fileChunk = _meshFileChunks[i];
+			MeshDrawChunk& chunk = _meshChunks[i];
+			chunk.firstIndex = fileChunk.firstIndex;
+			chunk.indexCount = fileChunk.indexCount;
+			chunk.vertexOffset = static_cast<int32_t>(fileChunk.firstVertex);
+			chunk.boundsMin = glm::vec3(fileChunk.boundsMin[0], fileChunk.boundsMin[1], fileChunk.boundsMin[2]);
+			chunk.boundsMax = glm::vec3(fileChunk.boundsMax[0], fileChunk.boundsMax[1], fileChunk.boundsMax[2]);
+		}
+		_streamedChunkCount = 0;
+		_meshStreamFrames = 0;
+
+		std::cout << "mesh: " << _config.meshFile << ", " << _meshFileHeader->chunkCount << " chunks, " << _meshFileHeader->vertexCount
+			<< " vertices, " << _meshFileHeader->indexCount << " indices, " << _meshFile->size() << " bytes" << std::endl;
+	}
+
+	// Copies one chunk from the file image (a mapping or an in-memory copy) into the staging ring and on into
+	// the vertex / index buffers after checking its indices. Returns the ticket of the last copy.
+	uint64_t _uploadMeshFileChunk(const char* fileData, const MeshFileHeader& header, const MeshFileChunk& chunk, VkBuffer vertexBuffer, VkBuffer indexBuffer)
+	{
+		if (header.indexSize == 2)
+			checkMeshChunkIndices<uint16_t>(fileData, chunk);
+		else
+			checkMeshChunkIndices<uint32_t>(fileData, chunk);
+
+		if (_vertexLayout.format == VertexFormat::Float)
+		{
+			_uploadBuffer(vertexBuffer, VkDeviceSize(chunk.firstVertex) * header.vertexStride, fileData + chunk.vertexDataOffset,
+				VkDeviceSize(chunk.vertexCount) * header.vertexStride, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+		}
+		else
+		{
+			// files always hold float vertices, packed layouts go through an encode
+			std::vector<Vertex> vertices(chunk.vertexCount);
+			memcpy(vertices.data(), fileData + chunk.vertexDataOffset, vertices.size() * sizeof(Vertex));
+			std::vector<uint8_t> packed(vertices.size() * _vertexLayout.stride);
+			_vertexLayout.encode(vertices.data(), vertices.size(), packed.data());
+
+			_uploadBuffer(vertexBuffer, VkDeviceSize(chunk.firstVertex) * _vertexLayout.stride, packed.data(), packed.size(),
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+		}
+		return _uploadBuffer(indexBuffer, VkDeviceSize(chunk.firstIndex) * header.indexSize, fileData + chunk.indexDataOffset,
+			VkDeviceSize(chunk.indexCount) * header.indexSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	}
+
+	// streams the next mesh chunks, up to MESH_STREAM_BYTES_PER_FRAME but at least one chunk per frame.
+	// Uploaded chunks are drawable right away, the graphics queue is ordered behind their copies.
+	void _streamMeshChunks()
+	{
+		if (!_meshFile)
+			return;
+
+		VkDeviceSize streamedBytes = 0;
+		while (_streamedChunkCount < _meshChunks.size() && (streamedBytes == 0 || streamedBytes < MESH_STREAM_BYTES_PER_FRAME))
+		{
+			const MeshFileChunk& chunk = _meshFileChunks[_streamedChunkCount];
+			_uploadMeshFileChunk(_meshFile->data(), *_meshFileHeader, chunk, _vertexBuffer, _indexBuffer);
+
+			streamedBytes += VkDeviceSize(chunk.vertexCount) * _meshFileHeader->vertexStride + VkDeviceSize(chunk.indexCount) * _meshFileHeader->indexSize;
+			_streamedChunkCount++;
+		}
+		_meshStreamFrames++;
+
+		if (_streamedChunkCount == _meshChunks.size())
+		{
+			std::cout << "mesh: streamed " << _meshChunks.size() << " chunks over " << _meshStreamFrames << " frames" << std::endl;
+
+			// everything has been copied into the staging ring, the mapping is no longer needed
+			_meshFile.reset();
+			_meshFileHeader = nullptr;
+			_meshFileChunks = nullptr;
+
+			// the culling sets of frames in flight have never been bound, so they can be written now
+			_createCullingBuffers();
+		}
+	}
+
+	void _createIndexBuffer(const void* indices, VkDeviceSize bufferSize)
+	{
+		_createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _indexBuffer, _indexBufferAllocation);
+
+		_uploadBuffer(_indexBuffer, 0, indices, bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	}
+
+	void _createInstanceBuffer()
+	{
+		std::vector<InstanceData> instances = makeInstanceGrid(_config.instanceCount);
+		VkDeviceSize bufferSize = sizeof(instances[0]) * instances.size();
+
+		_createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, _instanceBuffer, _instanceBufferAllocation);
+
+		_instanceUploadTicket = _uploadBuffer(_instanceBuffer, 0, instances.data(), bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	}
+
+	// replaces the instance buffer; used by the instancing benchmark to sweep instance counts
+	void _setInstanceCount(uint32_t instanceCount)
+	{
+		vkDeviceWaitIdle(_device);
+		_destroyBuffer(_instanceBuffer, _instanceBufferAllocation);
+
+		_config.instanceCount = instanceCount;
+		_createInstanceBuffer();
+		_updateDepthLayers();
+		_waitUpload(_instanceUploadTicket);
+
+		_destroyCullingBuffers();
+		_createCullingBuffers();
+	}
+
+	//====================== Uploads ==========================
+	void _createUploader()
+	{
+		QueueFamilyIndices indices = _findQueueFamily(_physicalDevice);
+
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		poolInfo.queueFamilyIndex = indices.transferFamily.value();
+		if (vkCreateCommandPool(_device, &poolInfo, nullptr, &_transferCommandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transfer command pool");
+		}
+
+		poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+		if (vkCreateCommandPool(_device, &poolInfo, nullptr, &_uploadAcquireCommandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create upload acquire command pool");
+		}
+
+		_createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			_stagingRingBuffer, _stagingRingAllocation);
+	}
+
+	// Copies data into a device-local buffer through the staging ring and the transfer queue.
+	// Returns immediately; the ticket completes once the data is visible to dstStage/dstAccess on the graphics queue.
+	uint64_t _uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		// large uploads go through the ring in pieces, the last piece's ticket covers all of them
+		const VkDeviceSize maxChunk = STAGING_RING_SIZE / 4;
+		uint64_t ticket = _completedUploadTicket;
+		for (VkDeviceSize done = 0; done < size; done += maxChunk)
+		{
+			VkDeviceSize chunk = std::min(maxChunk, size - done);
+			ticket = _uploadBufferChunk(dstBuffer, dstOffset + done, static_cast<const char*>(data) + done, chunk, dstStage, dstAccess);
+		}
+		return ticket;
+	}
+
+	uint64_t _uploadBufferChunk(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+	{
+		VkDeviceSize ringOffset = _reserveStagingRing(size);
+		memcpy(static_cast<char*>(_stagingRingAllocation.mapped) + ringOffset, data, (size_t)size);
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = ringOffset;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = size;
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dstAccess;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = dstBuffer;
+		barrier.offset = dstOffset;
+		barrier.size = size;
+
+		return _submitUpload(ringOffset, size, [&](VkCommandBuffer commandBuffer)
+		{
+			vkCmdCopyBuffer(commandBuffer, _stagingRingBuffer, dstBuffer, 1, &copyRegion);
+		}, &barrier, nullptr, dstStage);
+	}
+
+	// Copies tightly packed texels into mip 0 of a color image and leaves it in SHADER_READ_ONLY_OPTIMAL
+	// for fragment shaders; the level's previous contents are discarded.
+	uint64_t _uploadImage(VkImage image, uint32_t width, uint32_t height, const uint8_t* texels)
+	{
+		VkImageMemoryBarrier toShader = _mipZeroBarrier(image);
+		toShader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		toShader.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		toShader.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		return _uploadImageRows(image, width, 0, height, texels, &toShader, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	// Copies rows [firstRow, firstRow + rowCount) of a tightly packed level into mip 0, so large levels can be spread
+	// over several frames. The band starting at row 0 discards the level's old contents. finalBarrier goes with the
+	// last band and hands the whole level to dstStage on the graphics queue; bands before it only copy, the transfer
+	// queue runs them in order and the final barrier covers their writes too.
+	uint64_t _uploadImageRows(VkImage image, uint32_t width, uint32_t firstRow, uint32_t rowCount, const uint8_t* texels,
+		const VkImageMemoryBarrier* finalBarrier, VkPipelineStageFlags dstStage)
+	{
+		const VkDeviceSize rowBytes = VkDeviceSize(width) * TEXTURE_TEXEL_SIZE;
+		VkDeviceSize size = rowBytes * rowCount;
+		VkDeviceSize ringOffset = _reserveStagingRing(size);
+		memcpy(static_cast<char*>(_stagingRingAllocation.mapped) + ringOffset, texels + rowBytes * firstRow, (size_t)size);
+
+		VkImageMemoryBarrier toTransfer = _mipZeroBarrier(image);
+		toTransfer.srcAccessMask = 0;
+		toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = ringOffset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageOffset = { 0, static_cast<int32_t>(firstRow), 0 };
+		region.imageExtent = { width, rowCount, 1 };
+
+		return _submitUpload(ringOffset, size, [&](VkCommandBuffer commandBuffer)
+		{
+			if (firstRow == 0)
+			{
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+			}
+			vkCmdCopyBufferToImage(commandBuffer, _stagingRingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+		}, nullptr, finalBarrier, finalBarrier ? dstStage : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TRANSFER_BIT));
+	}
+
+	VkImageMemoryBarrier _mipZeroBarrier(VkImage image)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		return barrier;
+	}
+
+	// Records the copy on the transfer queue and, when the transfer family differs from the graphics family,
+	// releases the resource there and acquires it on the graphics queue (queue-family ownership transfer).
+	// At most one of bufferBarrier / imageBarrier is set; it describes the final access on the graphics side.
+	// With neither, the copy stays owned by the transfer queue for a later upload's barrier to publish.
+	uint64_t _submitUpload(VkDeviceSize ringOffset, VkDeviceSize size, const std::function<void(VkCommandBuffer)>& recordCopy,
+		const VkBufferMemoryBarrier* bufferBarrier, const VkImageMemoryBarrier* imageBarrier, VkPipelineStageFlags dstStage)
+	{
+		QueueFamilyIndices indices = _findQueueFamily(_physicalDevice);
+		bool ownershipTransfer = indices.transferFamily.value() != indices.graphicsFamily.value();
+
+		PendingUpload upload = {};
+		upload.ticket = _nextUploadTicket++;
+		upload.fence = _timelineSync ? VK_NULL_HANDLE : _acquireUploadFence();
+		upload.ringOffset = ringOffset;
+		upload.ringEnd = ringOffset + size;
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = _transferCommandPool;
+		allocInfo.commandBufferCount = 1;
+		vkAllocateCommandBuffers(_device, &allocInfo, &upload.transferCommandBuffer);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		VkBufferMemoryBarrier bufferRelease = {};
+		VkImageMemoryBarrier imageRelease = {};
+		if (bufferBarrier)
+		{
+			bufferRelease = *bufferBarrier;
+		}
+		if (imageBarrier)
+		{
+			imageRelease = *imageBarrier;
+		}
+
+		// same family: a plain barrier makes the copy visible. otherwise: release half of the ownership transfer,
+		// the destination access is ignored on the releasing queue
+		if (ownershipTransfer)
+		{
+			bufferRelease.dstAccessMask = 0;
+			bufferRelease.srcQueueFamilyIndex = indices.transferFamily.value();
+			bufferRelease.dstQueueFamilyIndex = indices.graphicsFamily.value();
+			imageRelease.dstAccessMask = 0;
+			imageRelease.srcQueueFamilyIndex = indices.transferFamily.value();
+			imageRelease.dstQueueFamilyIndex = indices.graphicsFamily.value();
+		}
+
+		vkBeginCommandBuffer(upload.transferCommandBuffer, &beginInfo);
+		recordCopy(upload.transferCommandBuffer);
+		vkCmdPipelineBarrier(upload.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			ownershipTransfer ? static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT) : dstStage, 0,
+			0, nullptr, bufferBarrier ? 1 : 0, &bufferRelease, imageBarrier ? 1 : 0, &imageRelease);
+		vkEndCommandBuffer(upload.transferCommandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &upload.transferCommandBuffer;
+
+		TimelineSignal timelineSignal;
+		if (!ownershipTransfer)
+		{
+			// same family: the transfer queue is the graphics queue, so it may signal the timeline
+			if (_timelineSync)
+			{
+				upload.timelineValue = _addTimelineSignal(submitInfo, timelineSignal);
+			}
+			if (vkQueueSubmit(_transferQueue, 1, &submitInfo, upload.fence) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to submit upload!");
+			}
+			_pendingUploads.push_back(upload);
+			return upload.ticket;
+		}
+
+		upload.ownershipSemaphore = _acquireUploadSemaphore();
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &upload.ownershipSemaphore;
+
+		if (vkQueueSubmit(_transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit upload!");
+		}
+
+		// acquire half, recorded with the same barrier on the graphics queue
+		VkBufferMemoryBarrier bufferAcquire = bufferRelease;
+		VkImageMemoryBarrier imageAcquire = imageRelease;
+		bufferAcquire.srcAccessMask = 0;
+		imageAcquire.srcAccessMask = 0;
+		if (bufferBarrier)
+		{
+			bufferAcquire.dstAccessMask = bufferBarrier->dstAccessMask;
+		}
+		if (imageBarrier)
+		{
+			imageAcquire.dstAccessMask = imageBarrier->dstAccessMask;
+		}
+
+		allocInfo.commandPool = _uploadAcquireCommandPool;
+		vkAllocateCommandBuffers(_device, &allocInfo, &upload.acquireCommandBuffer);
+
+		vkBeginCommandBuffer(upload.acquireCommandBuffer, &beginInfo);
+		vkCmdPipelineBarrier(upload.acquireCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStage, 0,
+			0, nullptr, bufferBarrier ? 1 : 0, &bufferAcquire, imageBarrier ? 1 : 0, &imageAcquire);
+		vkEndCommandBuffer(upload.acquireCommandBuffer);
+
+		VkPipelineStageFlags waitStage = dstStage;
+		VkSubmitInfo acquireInfo = {};
+		acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireInfo.waitSemaphoreCount = 1;
+		acquireInfo.pWaitSemaphores = &upload.ownershipSemaphore;
+		acquireInfo.pWaitDstStageMask = &waitStage;
+		acquireInfo.commandBufferCount = 1;
+		acquireInfo.pCommandBuffers = &upload.acquireCommandBuffer;
+		if (_timelineSync)
+		{
+			upload.timelineValue = _addTimelineSignal(acquireInfo, timelineSignal);
+		}
+
+		if (vkQueueSubmit(_graphicsQueue, 1, &acquireInfo, upload.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit upload ownership acquire!");
+		}
+
+		_pendingUploads.push_back(upload);
+		return upload.ticket;
+	}
+
+	// returns an offset in the staging ring with room for size bytes, waiting for old uploads only when the ring is full
+	VkDeviceSize _reserveStagingRing(VkDeviceSize size)
+	{
+		const VkDeviceSize alignment = 16;
+		if (size > STAGING_RING_SIZE)
+		{
+			throw std::runtime_error("Upload does not fit into the staging ring!");
+		}
+
+		for (;;)
+		{
+			_collectUploads();
+			if (_pendingUploads.empty())
+			{
+				return 0;
+			}
+
+			// live region runs from the oldest pending upload to the newest one, possibly wrapping around the end
+			VkDeviceSize tail = _pendingUploads.front().ringOffset;
+			VkDeviceSize head = alignUp(_pendingUploads.back().ringEnd, alignment);
+			bool wrapped = _pendingUploads.back().ringOffset < tail;
+
+			if (!wrapped)
+			{
+				if (head + size <= STAGING_RING_SIZE)
+					return head;
+				if (size <= tail)
+					return 0;
+			}
+			else if (head + size <= tail)
+			{
+				return head;
+			}
+
+			// ring is full, block on the oldest upload
+			_waitUploadSignal(_pendingUploads.front());
+		}
+	}
+
+	// retires finished uploads in submission order, never blocks
+	void _collectUploads()
+	{
+		uint64_t completedValue = _timelineSync ? _completedTimelineValue() : 0;
+		while (!_pendingUploads.empty() && _isUploadSignaled(_pendingUploads.front(), completedValue))
+		{
+			PendingUpload& upload = _pendingUploads.front();
+
+			vkFreeCommandBuffers(_device, _transferCommandPool, 1, &upload.transferCommandBuffer);
+			if (upload.acquireCommandBuffer != VK_NULL_HANDLE)
+			{
+				vkFreeCommandBuffers(_device, _uploadAcquireCommandPool, 1, &upload.acquireCommandBuffer);
+			}
+			if (upload.ownershipSemaphore != VK_NULL_HANDLE)
+			{
+				_freeUploadSemaphores.push_back(upload.ownershipSemaphore);
+			}
+			if (upload.fence != VK_NULL_HANDLE)
+			{
+				vkResetFences(_device, 1, &upload.fence);
+				_freeUploadFences.push_back(upload.fence);
+			}
+
+			_completedUploadTicket = upload.ticket;
+			_pendingUploads.pop_front();
+		}
+	}
+
+	bool _isUploadComplete(uint64_t ticket)
+	{
+		_collectUploads();
+		return ticket <= _completedUploadTicket;
+	}
+
+	void _waitUpload(uint64_t ticket)
+	{
+		while (!_isUploadComplete(ticket))
+		{
+			_waitUploadSignal(_pendingUploads.front());
+		}
+	}
+
+	bool _isUploadSignaled(const PendingUpload& upload, uint64_t completedTimelineValue)
+	{
+		if (_timelineSync)
+			return completedTimelineValue >= upload.timelineValue;
+		return vkGetFenceStatus(_device, upload.fence) == VK_SUCCESS;
+	}
+
+	void _waitUploadSignal(const PendingUpload& upload)
+	{
+		if (_timelineSync)
+			_waitTimeline(upload.timelineValue);
+		else
+			vkWaitForFences(_device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+	}
+
+	VkFence _acquireUploadFence()
+	{
+		if (!_freeUploadFences.empty())
+		{
+			VkFence fence = _freeUploadFences.back();
+			_freeUploadFences.pop_back();
+			return fence;
+		}
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		VkFence fence;
+		if (vkCreateFence(_device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create upload fence!");
+		}
+		return fence;
+	}
+
+	VkSemaphore _acquireUploadSemaphore()
+	{
+		if (!_freeUploadSemaphores.empty())
+		{
+			VkSemaphore semaphore = _freeUploadSemaphores.back();
+			_freeUploadSemaphores.pop_back();
+			return semaphore;
+		}
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkSemaphore semaphore;
+		if (vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create upload semaphore!");
+		}
+		return semaphore;
+	}
+
+	void _destroyUploader()
+	{
+		_waitUpload(_nextUploadTicket - 1);
+
+		for (VkFence fence : _freeUploadFences)
+		{
+			vkDestroyFence(_device, fence, nullptr);
+		}
+		for (VkSemaphore semaphore : _freeUploadSemaphores)
+		{
+			vkDestroySemaphore(_device, semaphore, nullptr);
+		}
+		_freeUploadFences.clear();
+		_freeUploadSemaphores.clear();
+
+		_destroyBuffer(_stagingRingBuffer, _stagingRingAllocation);
+		vkDestroyCommandPool(_device, _uploadAcquireCommandPool, nullptr);
+		vkDestroyCommandPool(_device, _transferCommandPool, nullptr);
+	}
+
+
+	void _createSyncObjects()
+	{
+		_imageAvailableSemaphores.resize(_config.framesInFlight);
+		_renderFinishedSemaphores.resize(_config.framesInFlight);
+		_imageFrameNumbers.resize(_swapChainImages.size(), 0);
+		_frameSlotNumbers.resize(_config.framesInFlight, 0);
+		_frameTimelineValues.resize(_config.framesInFlight, 0);
+
+		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		for (size_t i = 0; i < _config.framesInFlight; ++i)
+		{
+			if (vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_imageAvailableSemaphores[i]) != VK_SUCCESS ||
+				vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderFinishedSemaphores[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create synchronization objects for a frame!");
+			}
+		}
+
+		// the timeline backend tracks frames by value, no per-frame fences
+		if (!_timelineSync)
+		{
+			_inFlightFences.resize(_config.framesInFlight);
+			for (size_t i = 0; i < _config.framesInFlight; ++i)
+			{
+				if (vkCreateFence(_device, &fenceInfo, nullptr, &_inFlightFences[i]) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create synchronization objects for a frame!");
+				}
+			}
+		}
+	}
+
+	//====================== Timeline ==========================
+	// created before anything is uploaded, uploads signal it too
+	void _createTimelineSemaphore()
+	{
+		if (!_timelineSync)
+			return;
+
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+
+		if (vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_timeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create timeline semaphore!");
+		}
+	}
+
+	// extra signal of a graphics-queue submit, must stay alive until vkQueueSubmit returns
+	struct TimelineSignal
+	{
+		VkTimelineSemaphoreSubmitInfoKHR	info;
+		VkSemaphore							semaphores[2];
+		uint64_t							values[2];
+	};
+
+	// Makes submitInfo also signal the next timeline value and returns it. Only graphics-queue submits may
+	// signal: values have to be signaled in increasing order, which a single queue guarantees.
+	uint64_t _addTimelineSignal(VkSubmitInfo& submitInfo, TimelineSignal& signal)
+	{
+		uint32_t count = submitInfo.signalSemaphoreCount;
+		if (count > 1)
+		{
+			throw std::runtime_error("Timeline signal supports one extra binary semaphore only!");
+		}
+		if (count == 1)
+		{
+			signal.semaphores[0] = submitInfo.pSignalSemaphores[0];
+			signal.values[0] = 0;	// ignored for binary semaphores
+		}
+		signal.semaphores[count] = _timeline;
+		signal.values[count] = ++_timelineValue;
+
+		signal.info = {};
+		signal.info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		signal.info.pNext = submitInfo.pNext;
+		signal.info.signalSemaphoreValueCount = count + 1;
+		signal.info.pSignalSemaphoreValues = signal.values;
+
+		submitInfo.pNext = &signal.info;
+		submitInfo.signalSemaphoreCount = count + 1;
+		submitInfo.pSignalSemaphores = signal.semaphores;
+		return _timelineValue;
+	}
+
+	uint64_t _completedTimelineValue()
+	{
+		uint64_t value = 0;
+		_vkGetSemaphoreCounterValue(_device, _timeline, &value);
+		return value;
+	}
+
+	void _waitTimeline(uint64_t value)
+	{
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &_timeline;
+		waitInfo.pValues = &value;
+
+		_vkWaitSemaphores(_device, &waitInfo, UINT64_MAX);
+	}
+
+	// A frame still owning an in-flight slot is tracked by that slot's timeline value or fence. Older frames
+	// are complete: a slot is only reused after waiting for its previous frame.
+	bool _isFrameComplete(uint64_t frameNumber)
+	{
+		for (size_t i = 0; i < _frameSlotNumbers.size(); i++)
+		{
+			if (frameNumber == 0 || _frameSlotNumbers[i] != frameNumber)
+				continue;
+
+			if (_timelineSync)
+				return _completedTimelineValue() >= _frameTimelineValues[i];
+			return vkGetFenceStatus(_device, _inFlightFences[i]) == VK_SUCCESS;
+		}
+		return true;
+	}
+
+	void _waitFrame(uint64_t frameNumber)
+	{
+		for (size_t i = 0; i < _frameSlotNumbers.size(); i++)
+		{
+			if (frameNumber == 0 || _frameSlotNumbers[i] != frameNumber)
+				continue;
+
+			if (_timelineSync)
+				_waitTimeline(_frameTimelineValues[i]);
+			else
+				vkWaitForFences(_device, 1, &_inFlightFences[i], VK_TRUE, UINT64_MAX);
+		}
+	}
+
+	// raises _completedFrameNumber to the newest finished frame without blocking
+	void _pollCompletedFrames()
+	{
+		for (uint64_t frame : _frameSlotNumbers)
+		{
+			if (frame > _completedFrameNumber && _isFrameComplete(frame))
+			{
+				_completedFrameNumber = frame;
+			}
+		}
+	}
+
+	void _createCommandBuffers()
+	{
+		for (auto& frame : _frameCommands)
+		{
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = frame.commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+
+			if (vkAllocateCommandBuffers(_device, &allocInfo, &frame.primary) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create command buffers!");
+			}
+
+			frame.secondaries.resize(frame.workerPools.size());
+			for (size_t i = 0; i < frame.workerPools.size(); i++)
+			{
+				allocInfo.commandPool = frame.workerPools[i];
+				allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+				if (vkAllocateCommandBuffers(_device, &allocInfo, &frame.secondaries[i]) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create secondary command buffers!");
+				}
+			}
+		}
+	}
+
+	// records the frame into frame.primary, fanning the draws out to _recordPool when there is one
+	void _recordCommandBuffer(FrameCommands& frame, FrameQueries& queries, uint32_t imageIndex)
+	{
+		vkResetCommandPool(_device, frame.commandPool, 0);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+
+		if (vkBeginCommandBuffer(frame.primary, &beginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to begin recording command buffer!");
+		}
+
+		// without inheritedQueries, secondaries must not execute while a query is active
+		queries.statisticsActive = queries.statisticsPool != VK_NULL_HANDLE && (!_recordPool || _enabledFeatures.inheritedQueries);
+		if (_timestampsSupported)
+		{
+			vkCmdResetQueryPool(frame.primary, queries.timestampPool, 0, 2);
+			vkCmdWriteTimestamp(frame.primary, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries.timestampPool, 0);
+		}
+		if (queries.statisticsActive)
+		{
+			vkCmdResetQueryPool(frame.primary, queries.statisticsPool, 0, 1);
+			vkCmdBeginQuery(frame.primary, queries.statisticsPool, 0, 0);
+		}
+
+		_cpuVisibleObjects = 0;
+
+		// written before any job starts, the secondaries only bind it
+		_updateBindlessSet();
+		_beginUniformFrame();
+		FrameUniforms* frameUniforms = static_cast<FrameUniforms*>(_allocateUniforms(sizeof(FrameUniforms), _frameUniformOffset));
+		frameUniforms->view = _viewConstants();
+		frameUniforms->time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - _startTime).count();
+		frameUniforms->frameNumber = static_cast<uint32_t>(_frameNumber + 1);
+
+		_buildFrameGraph(imageIndex);
+		_renderGraph.execute(frame.primary);
+
+		if (queries.statisticsActive)
+		{
+			vkCmdEndQuery(frame.primary, queries.statisticsPool, 0);
+		}
+		if (_timestampsSupported)
+		{
+			vkCmdWriteTimestamp(frame.primary, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queries.timestampPool, 1);
+		}
+
+		if (vkEndCommandBuffer(frame.primary) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to record command buffer!");
+		}
+
+		_flushUniformFrame();
+	}
+
+	// the frame as render graph passes: culling, texture mips, the optional depth pre-pass, the scene and, at a
+	// render scale other than 1, the blit of the scene into the swapchain image. The passes capture at most two
+	// words, which std::function keeps without allocating
+	void _buildFrameGraph(uint32_t imageIndex)
+	{
+		RenderGraph& graph = _renderGraph;
+		graph.beginFrame(_frameNumber + 1);
+
+		RenderGraph::ImageDesc backbufferDesc;
+		backbufferDesc.format = _swapChainImageFormat;
+		backbufferDesc.extent = _swapChainExtent;
+		const RenderGraph::Resource backbuffer = graph.importImage("backbuffer", _swapChainImages[imageIndex], _swapChainImageViews[imageIndex],
+			backbufferDesc, _config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+		// declared whenever the buffers exist, the graph culls the passes while another path draws
+		RenderGraph::Resource drawCommands = 0;
+		RenderGraph::Resource drawCount = 0;
+		if (_cullObjectBuffer != VK_NULL_HANDLE)
+		{
+			const CullFrame& cull = _cullFrames[_currentFrame];
+			drawCommands = graph.importBuffer("draw commands", cull.drawCommands);
+			drawCount = graph.importBuffer("draw count", cull.drawCount);
+			_addCullingPasses(cull, drawCommands, drawCount);
+		}
+
+		if (!_textureMipJobs.empty())
+		{
+			// the streamed textures are not graph resources, the pass keeps its own barriers
+			const size_t mips = graph.addPass("texture mips", [this](const RenderGraph::PassContext& context) { _recordTextureMips(context.commandBuffer); });
+			graph.setSideEffects(mips);
+		}
+
+		const bool scaled = _sceneExtent.width != _swapChainExtent.width || _sceneExtent.height != _swapChainExtent.height;
+		RenderGraph::Resource sceneColor = backbuffer;
+		if (scaled)
+		{
+			RenderGraph::ImageDesc sceneDesc = backbufferDesc;
+			sceneDesc.extent = _sceneExtent;
+			sceneColor = graph.createImage("scene color", sceneDesc);
+		}
+
+		// follows the scene extent, so swapchain recreation and render scale changes rebuild it with the graph's transients
+		RenderGraph::ImageDesc depthDesc;
+		depthDesc.format = _depthFormat;
+		depthDesc.extent = _sceneExtent;
+		depthDesc.samples = _sampleCount;
+		depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT | (_depthFormat == VK_FORMAT_D32_SFLOAT ? 0 : VK_IMAGE_ASPECT_STENCIL_BIT);
+		const RenderGraph::Resource depth = graph.createImage("depth", depthDesc);
+		VkClearValue depthClear = {};
+		depthClear.depthStencil = { 1.0f, 0 };
+
+		auto readIndirectDraws = [&](size_t pass)
+		{
+			if (_useGpuCulling())
+			{
+				graph.read(pass, drawCommands, RenderGraph::Access::IndirectRead);
+				if (_useDrawIndirectCount())
+				{
+					graph.read(pass, drawCount, RenderGraph::Access::IndirectRead);
+				}
+			}
+		};
+
+		// recorded inline: the secondaries are one per job and already taken by the scene pass
+		if (_config.depthPrepass)
+		{
+			const size_t prepass = graph.addPass("depth pre-pass", [this](const RenderGraph::PassContext& context)
+			{
+				_recordDraws(context.commandBuffer, 0, _config.drawCount, true);
+			});
+			graph.depthAttachment(prepass, depth, VK_ATTACHMENT_LOAD_OP_CLEAR, depthClear);
+			readIndirectDraws(prepass);
+		}
+
+		const size_t scene = graph.addPass("scene", [this](const RenderGraph::PassContext& context)
+		{
+			_recordScene(context, _frameCommands[_currentFrame], _frameQueries[_currentFrame]);
+		});
+		VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+		const VkAttachmentLoadOp depthLoad = _config.depthPrepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+		if (_sampleCount == VK_SAMPLE_COUNT_1_BIT)
+		{
+			graph.colorAttachment(scene, sceneColor, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+			graph.depthAttachment(scene, depth, depthLoad, depthClear);
+		}
+		else
+		{
+			// resolved at the end of the subpass; never loaded or stored, so the graph makes it a lazy transient
+			RenderGraph::ImageDesc msaaDesc;
+			msaaDesc.format = _swapChainImageFormat;
+			msaaDesc.extent = _sceneExtent;
+			msaaDesc.samples = _sampleCount;
+			const RenderGraph::Resource msaaColor = graph.createImage("msaa color", msaaDesc);
+
+			graph.colorAttachment(scene, msaaColor, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+			graph.depthAttachment(scene, depth, depthLoad, depthClear);
+			graph.resolveAttachment(scene, sceneColor);
+		}
+		readIndirectDraws(scene);
+		if (_recordPool)
+		{
+			graph.setSecondaryContents(scene);
+		}
+
+		if (scaled)
+		{
+			const size_t upscale = graph.addPass("upscale", [this, sceneColor, backbuffer](const RenderGraph::PassContext& context)
+			{
+				_recordUpscale(context.commandBuffer, _renderGraph.image(sceneColor), _renderGraph.image(backbuffer));
+			});
+			graph.read(upscale, sceneColor, RenderGraph::Access::TransferRead);
+			graph.write(upscale, backbuffer, RenderGraph::Access::TransferWrite);
+		}
+
+		graph.compile();
+		_backbufferWaitStage = graph.firstStages(backbuffer);
+
+		_renderGraphFrames++;
+		_renderGraphBarriers += graph.stats().barrierCount;
+		if (!(graph.stats() == _lastRenderGraphStats))
+		{
+			_lastRenderGraphStats = graph.stats();
+			graph.printStats();
+		}
+	}
+
+	// the draws, inline or fanned out to _recordPool as secondaries
+	void _recordScene(const RenderGraph::PassContext& context, FrameCommands& frame, FrameQueries& queries)
+	{
+		if (!_recordPool)
+		{
+			_recordDraws(context.commandBuffer, 0, _config.drawCount);
+			return;
+		}
+
+		// each job owns one pool and one secondary, so no pool is ever touched by two threads
+		const uint32_t jobCount = static_cast<uint32_t>(frame.secondaries.size());
+		const uint32_t drawsPerJob = (_config.drawCount + jobCount - 1) / jobCount;
+
+		_recordPool->parallelFor(jobCount, [&](uint32_t job)
+		{
+			vkResetCommandPool(_device, frame.workerPools[job], 0);
+
+			VkCommandBufferInheritanceInfo inheritanceInfo = {};
+			inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			inheritanceInfo.renderPass = context.renderPass;
+			inheritanceInfo.subpass = 0;
+			inheritanceInfo.framebuffer = context.framebuffer;
+			inheritanceInfo.pipelineStatistics = queries.statisticsActive ? GPU_STATISTICS_FLAGS : 0;
+
+			VkCommandBufferBeginInfo secondaryBeginInfo = {};
+			secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+			VkCommandBuffer secondary = frame.secondaries[job];
+			if (vkBeginCommandBuffer(secondary, &secondaryBeginInfo) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to begin recording secondary command buffer!");
+			}
+
+			uint32_t first = std::min(job * drawsPerJob, _config.drawCount);
+			uint32_t last = std::min(first + drawsPerJob, _config.drawCount);
+			_recordDraws(secondary, first, last);
+
+			if (vkEndCommandBuffer(secondary) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to record secondary command buffer!");
+			}
+		});
+
+		vkCmdExecuteCommands(context.commandBuffer, jobCount, frame.secondaries.data());
+	}
+
+	// scales the scene image to the swapchain extent
+	void _recordUpscale(VkCommandBuffer commandBuffer, VkImage scene, VkImage backbuffer)
+	{
+		VkImageBlit blit = {};
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		blit.srcOffsets[1] = { static_cast<int32_t>(_sceneExtent.width), static_cast<int32_t>(_sceneExtent.height), 1 };
+		blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		blit.dstOffsets[1] = { static_cast<int32_t>(_swapChainExtent.width), static_cast<int32_t>(_swapChainExtent.height), 1 };
+		vkCmdBlitImage(commandBuffer, scene, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, backbuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, _upscaleFilter);
+	}
+
+	// the scene is drawn at renderScale times the swapchain extent; other than 1 it is blitted into the swapchain image
+	void _updateSceneExtent()
+	{
+		_sceneExtent = _swapChainExtent;
+		if (_config.renderScale == 1.0f)
+			return;
+
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(_physicalDevice, _swapChainImageFormat, &properties);
+		const VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+		if ((properties.optimalTilingFeatures & blit) != blit || !_swapchainTransferDst)
+		{
+			std::cout << "render scale: the swapchain images cannot be blitted to, rendering at full resolution" << std::endl;
+			_config.renderScale = 1.0f;
+			return;
+		}
+
+		_upscaleFilter = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+		_sceneExtent.width = std::max(1u, static_cast<uint32_t>(_swapChainExtent.width * _config.renderScale + 0.5f));
+		_sceneExtent.height = std::max(1u, static_cast<uint32_t>(_swapChainExtent.height * _config.renderScale + 0.5f));
+	}
+
+	void _reportRenderGraph()
+	{
+		if (_renderGraphFrames == 0)
+			return;
+
+		std::cout << "render graph: " << _renderGraphFrames << " frames, " << (double)_renderGraphBarriers / _renderGraphFrames
+			<< " barriers per frame on average" << std::endl;
+		_renderGraph.printStats();
+	}
+
+	// one timestamp pool (and optionally one pipeline statistics pool) per frame in flight
+	void _createQueryPools()
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+		uint32_t validBits = queueFamilies[_findQueueFamily(_physicalDevice).graphicsFamily.value()].timestampValidBits;
+		_timestampsSupported = validBits > 0 && properties.limits.timestampPeriod > 0.0f;
+		_timestampPeriod = properties.limits.timestampPeriod;
+		_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+		if (!_timestampsSupported)
+		{
+			std::cout << "gpu timestamps are not supported on the graphics queue, gpu timings disabled" << std::endl;
+		}
+		if (_config.pipelineStatistics && !_enabledFeatures.pipelineStatisticsQuery)
+		{
+			std::cout << "pipelineStatisticsQuery is not supported, pipeline statistics disabled" << std::endl;
+		}
+
+		_frameQueries.resize(_config.framesInFlight);
+		for (auto& queries : _frameQueries)
+		{
+			queries = {};
+
+			VkQueryPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+
+			if (_timestampsSupported)
+			{
+				poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				poolInfo.queryCount = 2;
+				if (vkCreateQueryPool(_device, &poolInfo, nullptr, &queries.timestampPool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create timestamp query pool");
+				}
+			}
+
+			if (_timestampsSupported && _enabledFeatures.pipelineStatisticsQuery)
+			{
+				poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+				poolInfo.queryCount = 1;
+				poolInfo.pipelineStatistics = GPU_STATISTICS_FLAGS;
+				if (vkCreateQueryPool(_device, &poolInfo, nullptr, &queries.statisticsPool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create pipeline statistics query pool");
+				}
+			}
+		}
+	}
+
+	// called once the frame's fence has signaled, so the results are available and this never waits
+	void _readFrameQueries(FrameQueries& queries)
+	{
+		if (!queries.pending)
+			return;
+		queries.pending = false;
+
+		uint64_t timestamps[2] = {};
+		if (vkGetQueryPoolResults(_device, queries.timestampPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+			return;
+
+		GpuFrameHistory::Sample sample = {};
+		sample.frame = queries.frameNumber;
+		sample.gpuMs = static_cast<double>((timestamps[1] - timestamps[0]) & _timestampMask) * _timestampPeriod / 1000000.0;
+
+		if (queries.statisticsActive)
+		{
+			// results come in bit order: vertex shader invocations, then fragment shader invocations
+			uint64_t statistics[2] = {};
+			if (vkGetQueryPoolResults(_device, queries.statisticsPool, 0, 1, sizeof(statistics), statistics, sizeof(statistics), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+			{
+				sample.vertexInvocations = statistics[0];
+				sample.fragmentInvocations = statistics[1];
+			}
+		}
+
+		_gpuHistory.add(sample);
+	}
+
+	void _destroyQueryPools()
+	{
+		for (auto& queries : _frameQueries)
+		{
+			vkDestroyQueryPool(_device, queries.timestampPool, nullptr);
+			vkDestroyQueryPool(_device, queries.statisticsPool, nullptr);
+		}
+		_frameQueries.clear();
+	}
+
+	// overdraw: fragment shader invocations over the pixels of the scene
+	double _fragmentsPerPixel(double fragmentInvocations) const
+	{
+		return fragmentInvocations / (static_cast<double>(_sceneExtent.width) * _sceneExtent.height);
+	}
+
+	// prints the gpu time summary and writes the csv/json dumps; the device must be idle
+	void _reportGpuTimings()
+	{
+		for (auto& queries : _frameQueries)
+		{
+			_readFrameQueries(queries);
+		}
+
+		if (_gpuHistory.window.empty())
+			return;
+
+		FrameStats stats = _gpuHistory.gpuStats();
+		std::cout << "gpu: " << _gpuHistory.totalSamples << " frames timed, last " << _gpuHistory.window.size()
+			<< " frames p50 " << stats.percentile(0.50) << " ms, p99 " << stats.percentile(0.99) << " ms";
+		const GpuFrameHistory::Sample& last = _gpuHistory.window.back();
+		if (last.vertexInvocations || last.fragmentInvocations)
+		{
+			std::cout << ", last frame " << last.vertexInvocations << " vertex / " << last.fragmentInvocations << " fragment invocations ("
+				<< _fragmentsPerPixel(last.fragmentInvocations) << " per pixel)";
+		}
+		std::cout << std::endl;
+
+		if (!_config.gpuReport.empty())
+		{
+			_gpuHistory.writeCsv(_config.gpuReport + ".csv");
+			_gpuHistory.writeJson(_config.gpuReport + ".json");
+		}
+	}
+
+	// draws [first, last) of the frame, with the pre-pass pipeline when depthPrepass is set; dynamic state is not
+	// inherited, so every command buffer sets it
+	void _recordDraws(VkCommandBuffer commandBuffer, uint32_t first, uint32_t last, bool depthPrepass = false)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepass ? _depthPrepassPipeline : _graphicsPipeline);
+
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float)_sceneExtent.width;
+		viewport.height = (float)_sceneExtent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = {};
+		scissor.offset = { 0, 0 };
+		scissor.extent = _sceneExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		// descriptor sets and push constants are not inherited by secondaries either; one bind per command
+		// buffer covers every draw, materials only change a push constant
+		VkDescriptorSet sets[] = { _uniformSet, _currentBindlessSet() };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 2, sets, 1, &_frameUniformOffset);
+		_descriptorBinds++;
+
+		DrawConstants draw;
+		draw.offset = glm::vec2(0.0f, 0.0f);
+		draw.scale = glm::vec2(1.0f, 1.0f);
+
+		VkBuffer vertexBuffers[] = { _vertexBuffer, _instanceBuffer };
+		VkDeviceSize offset[] = { 0, 0 };
+
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offset);
+		vkCmdBindIndexBuffer(commandBuffer, _indexBuffer, 0, _indexType);
+
+		// every instance of every draw is its own depth layer, later ones nearer: the depth test keeps what painting
+		// in submission order used to leave on top, whatever order the draws are recorded in
+		draw.depthStep = _instanceDepthStep;
+
+		for (uint32_t slot = first; slot < last; slot++)
+		{
+			// front to back, what the nearer draws cover fails the early depth test instead of being shaded
+			const uint32_t i = _config.frontToBack ? _config.drawCount - 1 - slot : slot;
+			draw.materialId = i % _config.materialCount;
+			draw.textureIndex = _drawTextureSlot(i);
+			draw.depth = 1.0f - static_cast<float>(std::min(i * _depthLayersPerDraw + 1, _depthLayerCount)) * _depthStep;
+			vkCmdPushConstants(commandBuffer, _pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw), &draw);
+
+			if (_useGpuCulling())
+			{
+				_recordIndirectDraws(commandBuffer, _cullFrames[_currentFrame]);
+				continue;
+			}
+			if (_config.cullMode != CullMode::None && !_cullObjects.empty())
+			{
+				uint32_t visible = _recordCpuCulledDraws(commandBuffer);
+				_cpuVisibleObjects += depthPrepass ? 0 : visible;
+				continue;
+			}
+
+			for (uint32_t c = 0; c < _streamedChunkCount; c++)
+			{
+				const MeshDrawChunk& chunk = _meshChunks[c];
+				vkCmdDrawIndexed(commandBuffer, chunk.indexCount, _config.instanceCount, chunk.firstIndex, chunk.vertexOffset, 0);
+			}
+		}
+	}
+
+	//====================== Uniform Ring ==========================
+	// Host-visible buffer split into one region per frame in flight. A frame writes only its own region, and the
+	// slot's previous user (frame N - framesInFlight) has been waited on before recording, so writes never stall.
+	void _createUniformRing()
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		_uniformAlignment = properties.limits.minUniformBufferOffsetAlignment;
+		_nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+
+		// regions start on both alignments, so a region's flush range never touches its neighbour
+		VkDeviceSize regionAlignment = std::max(_uniformAlignment, _nonCoherentAtomSize);
+		_uniformRegionSize = alignUp(UNIFORM_RING_FRAME_SIZE, regionAlignment);
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = _uniformRegionSize * _config.framesInFlight;
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(_device, &bufferInfo, nullptr, &_uniformRingBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create uniform ring buffer!");
+		}
+
+		// atom-aligned offset and size keep every flush range inside this allocation
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(_device, _uniformRingBuffer, &memRequirements);
+		memRequirements.alignment = std::max(memRequirements.alignment, regionAlignment);
+		memRequirements.size = alignUp(memRequirements.size, regionAlignment);
+
+		uint32_t memoryType = _findeMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		_uniformRingAllocation = _allocator.allocate(memRequirements, memoryType, false);
+		vkBindBufferMemory(_device, _uniformRingBuffer, _uniformRingAllocation.memory, _uniformRingAllocation.offset);
+
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memProperties);
+		_uniformRingCoherent = (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		binding.descriptorCount = 1;
+		binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = 1;
+		layoutInfo.pBindings = &binding;
+
+		if (vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &_uniformSetLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create uniform descriptor set layout!");
+		}
+
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSize.descriptorCount = 1;
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = 1;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+
+		if (vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_uniformDescriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create uniform descriptor pool!");
+		}
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _uniformDescriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_uniformSetLayout;
+
+		if (vkAllocateDescriptorSets(_device, &allocInfo, &_uniformSet) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate uniform descriptor set!");
+		}
+
+		// one descriptor for the whole ring, the dynamic offset picks the frame's data
+		VkDescriptorBufferInfo bufferDescriptor = {};
+		bufferDescriptor.buffer = _uniformRingBuffer;
+		bufferDescriptor.offset = 0;
+		bufferDescriptor.range = sizeof(FrameUniforms);
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = _uniformSet;
+		write.dstBinding = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		write.pBufferInfo = &bufferDescriptor;
+		vkUpdateDescriptorSets(_device, 1, &write, 0, nullptr);
+	}
+
+	void _destroyUniformRing()
+	{
+		vkDestroyDescriptorPool(_device, _uniformDescriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _uniformSetLayout, nullptr);
+		_destroyBuffer(_uniformRingBuffer, _uniformRingAllocation);
+	}
+
+	// the current frame's slot has been waited on, its region is free again
+	void _beginUniformFrame()
+	{
+		_uniformHead = 0;
+	}
+
+	// bump allocation in the current frame's region; dynamicOffset is relative to the ring buffer
+	void* _allocateUniforms(VkDeviceSize size, uint32_t& dynamicOffset)
+	{
+		VkDeviceSize offset = alignUp(_uniformHead, _uniformAlignment);
+		if (offset + size > _uniformRegionSize)
+		{
+			throw std::runtime_error("Uniform ring region is full!");
+		}
+		_uniformHead = offset + size;
+
+		VkDeviceSize ringOffset = _currentFrame * _uniformRegionSize + offset;
+		dynamicOffset = static_cast<uint32_t>(ringOffset);
+		return static_cast<char*>(_uniformRingAllocation.mapped) + ringOffset;
+	}
+
+	// makes the frame's host writes visible before the submit, non-coherent memory needs an explicit flush
+	void _flushUniformFrame()
+	{
+		if (_uniformRingCoherent || _uniformHead == 0)
+			return;
+
+		VkMappedMemoryRange range = {};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = _uniformRingAllocation.memory;
+		range.offset = _uniformRingAllocation.offset + _currentFrame * _uniformRegionSize;
+		range.size = alignUp(_uniformHead, _nonCoherentAtomSize);
+		vkFlushMappedMemoryRanges(_device, 1, &range);
+	}
+
+	//====================== Bindless ==========================
+	// Set 1 of the graphics pipeline: an array of combined image samplers (binding 0) and an array of storage
+	// buffers (binding 1). With descriptor indexing there is a single update-after-bind, partially bound set and
+	// new slots are written while frames are in flight; otherwise each frame in flight has its own set, rewritten
+	// whole at the start of a frame whose table version is stale.
+	void _createBindlessLayout()
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+
+		if (_descriptorIndexing)
+		{
+			VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+			indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+			VkPhysicalDeviceProperties2 properties2 = {};
+			properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+			properties2.pNext = &indexingProperties;
+
+			auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceProperties2KHR");
+			getProperties2(_physicalDevice, &properties2);
+
+			_textureCapacity = std::min({ BINDLESS_TEXTURE_CAPACITY, indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+				indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages, indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
+			_bufferCapacity = std::min({ BINDLESS_BUFFER_CAPACITY, indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+				indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers });
+		}
+		else
+		{
+			_textureCapacity = std::min({ FALLBACK_TEXTURE_CAPACITY, properties.limits.maxPerStageDescriptorSamplers, properties.limits.maxPerStageDescriptorSampledImages });
+			_bufferCapacity = std::min(FALLBACK_BUFFER_CAPACITY, properties.limits.maxPerStageDescriptorStorageBuffers);
+		}
+
+		std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+		bindings[0].binding = 0;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[0].descriptorCount = _textureCapacity;
+		bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		bindings[1].binding = 1;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[1].descriptorCount = _bufferCapacity;
+		bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		const VkDescriptorBindingFlagsEXT bindingFlags[] =
+		{
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+		};
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+		if (_descriptorIndexing)
+		{
+			layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+			layoutInfo.pNext = &bindingFlagsInfo;
+		}
+
+		if (vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &_bindlessSetLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create bindless descriptor set layout!");
+		}
+
+		uint32_t setCount = _descriptorIndexing ? 1 : _config.framesInFlight;
+
+		std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[0].descriptorCount = _textureCapacity * setCount;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[1].descriptorCount = _bufferCapacity * setCount;
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = _descriptorIndexing ? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT : 0;
+		poolInfo.maxSets = setCount;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+
+		if (vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_bindlessPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create bindless descriptor pool!");
+		}
+
+		std::vector<VkDescriptorSetLayout> setLayouts(setCount, _bindlessSetLayout);
+		_bindlessSets.resize(setCount);
+		_bindlessSetVersions.assign(setCount, 0);
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _bindlessPool;
+		allocInfo.descriptorSetCount = setCount;
+		allocInfo.pSetLayouts = setLayouts.data();
+
+		if (vkAllocateDescriptorSets(_device, &allocInfo, _bindlessSets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate bindless descriptor sets!");
+		}
+	}
+
+	// texture slot 0 is a 1x1 white texture and material 0 is an untinted material using it, so untextured
+	// geometry renders unchanged; further materials get distinct tints
+	void _createDefaultMaterials()
+	{
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.maxLod = 16.0f;
+		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+
+		if (vkCreateSampler(_device, &samplerInfo, nullptr, &_defaultSampler) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create default sampler!");
+		}
+
+		const uint8_t white[TEXTURE_TEXEL_SIZE] = { 255, 255, 255, 255 };
+		_createImage(1, 1, 1, TEXTURE_FORMAT, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			_defaultTexture, _defaultTextureAllocation);
+		_uploadImage(_defaultTexture, 1, 1, white);
+		_defaultTextureView = _createTextureView(_defaultTexture, TEXTURE_FORMAT, 1);
+		_registerTexture(_defaultTextureView);
+
+		uint32_t materialCount = std::min(std::max(1u, _config.materialCount), MAX_MATERIALS);
+		std::vector<Material> materials(materialCount);
+		for (uint32_t i = 0; i < materialCount; i++)
+		{
+			// golden-angle hue steps keep neighbouring materials apart
+			float hue = i * 0.618034f;
+			hue -= std::floor(hue);
+			glm::vec3 tint = hueToRgb(hue);
+			materials[i].tint = i == 0 ? glm::vec4(1.0f, 1.0f, 1.0f, 1.0f) : glm::vec4(0.5f + 0.5f * tint.x, 0.5f + 0.5f * tint.y, 0.5f + 0.5f * tint.z, 1.0f);
+		}
+
+		VkDeviceSize bufferSize = sizeof(Material) * materials.size();
+		_createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			_materialBuffer, _materialBufferAllocation);
+		_uploadBuffer(_materialBuffer, 0, materials.data(), bufferSize, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		uint32_t slot = _registerStorageBuffer(_materialBuffer, 0, bufferSize);
+		if (slot != MATERIAL_TABLE_SLOT)
+		{
+			throw std::runtime_error("Material table must be the first registered storage buffer!");
+		}
+	}
+
+	VkImageView _createTextureView(VkImage image, VkFormat format, uint32_t mipLevels)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = format;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = mipLevels;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		VkImageView view;
+		if (vkCreateImageView(_device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create texture view!");
+		}
+		return view;
+	}
+
+	// returns the texture's index in the bindless array
+	uint32_t _registerTexture(VkImageView view)
+	{
+		if (!_hasFreeTextureSlot())
+		{
+			throw std::runtime_error("Bindless texture array is full!");
+		}
+
+		VkDescriptorImageInfo info = { _defaultSampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		uint32_t index;
+		if (!_freeTextureSlots.empty())
+		{
+			index = _freeTextureSlots.back();
+			_freeTextureSlots.pop_back();
+			_bindlessTextures[index] = info;
+		}
+		else
+		{
+			index = static_cast<uint32_t>(_bindlessTextures.size());
+			_bindlessTextures.push_back(info);
+		}
+		_writeBindlessDescriptors(0, index, 1);
+		return index;
+	}
+
+	bool _hasFreeTextureSlot() const
+	{
+		return !_freeTextureSlots.empty() || _bindlessTextures.size() < _textureCapacity;
+	}
+
+	// the slot must not be used by any pending frame; it points at the default texture until reused
+	void _releaseTexture(uint32_t index)
+	{
+		_bindlessTextures[index] = _bindlessTextures[0];
+		_freeTextureSlots.push_back(index);
+		_writeBindlessDescriptors(0, index, 1);
+	}
+
+	// returns the buffer's index in the bindless storage buffer array
+	uint32_t _registerStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+	{
+		if (_bindlessBuffers.size() >= _bufferCapacity)
+		{
+			throw std::runtime_error("Bindless storage buffer array is full!");
+		}
+
+		uint32_t index = static_cast<uint32_t>(_bindlessBuffers.size());
+		_bindlessBuffers.push_back({ buffer, offset, range });
+		_writeBindlessDescriptors(1, index, 1);
+		return index;
+	}
+
+	// update-after-bind: the new slots are unused by frames in flight and are written right away;
+	// otherwise the table version moves on and every set picks it up when its frame starts
+	void _writeBindlessDescriptors(uint32_t binding, uint32_t first, uint32_t count)
+	{
+		if (!_descriptorIndexing)
+		{
+			_bindlessVersion++;
+			return;
+		}
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = _bindlessSets[0];
+		write.dstBinding = binding;
+		write.dstArrayElement = first;
+		write.descriptorCount = count;
+		if (binding == 0)
+		{
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = &_bindlessTextures[first];
+		}
+		else
+		{
+			write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			write.pBufferInfo = &_bindlessBuffers[first];
+		}
+		vkUpdateDescriptorSets(_device, 1, &write, 0, nullptr);
+		_descriptorWrites += count;
+	}
+
+	// fallback path: the current frame's set is no longer in use, rewrite it whole if the table changed;
+	// not partially bound, so unused slots point at the defaults
+	void _updateBindlessSet()
+	{
+		if (_descriptorIndexing || _bindlessSetVersions[_currentFrame] == _bindlessVersion)
+			return;
+
+		std::vector<VkDescriptorImageInfo> textures(_textureCapacity, _bindlessTextures[0]);
+		std::copy(_bindlessTextures.begin(), _bindlessTextures.end(), textures.begin());
+		std::vector<VkDescriptorBufferInfo> buffers(_bufferCapacity, _bindlessBuffers[0]);
+		std::copy(_bindlessBuffers.begin(), _bindlessBuffers.end(), buffers.begin());
+
+		std::array<VkWriteDescriptorSet, 2> writes = {};
+		for (uint32_t i = 0; i < writes.size(); i++)
+		{
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = _bindlessSets[_currentFrame];
+			writes[i].dstBinding = i;
+		}
+		writes[0].descriptorCount = _textureCapacity;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = textures.data();
+		writes[1].descriptorCount = _bufferCapacity;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[1].pBufferInfo = buffers.data();
+
+		vkUpdateDescriptorSets(_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+		_descriptorWrites += _textureCapacity + _bufferCapacity;
+		_bindlessSetVersions[_currentFrame] = _bindlessVersion;
+	}
+
+	VkDescriptorSet _currentBindlessSet() const
+	{
+		return _descriptorIndexing ? _bindlessSets[0] : _bindlessSets[_currentFrame];
+	}
+
+	void _reportDescriptorStats()
+	{
+		uint64_t frames = std::max<uint64_t>(1, _frameNumber);
+		std::cout << "descriptors: " << _bindlessTextures.size() << " textures, " << _bindlessBuffers.size() << " storage buffers registered; "
+			<< _descriptorWrites.load() << " descriptor writes (" << (double)_descriptorWrites.load() / frames << "/frame), "
+			<< _descriptorBinds.load() << " set binds (" << (double)_descriptorBinds.load() / frames << "/frame) over " << _frameNumber << " frames" << std::endl;
+	}
+
+	void _destroyBindless()
+	{
+		_destroyBuffer(_materialBuffer, _materialBufferAllocation);
+		vkDestroyImageView(_device, _defaultTextureView, nullptr);
+		_destroyImage(_defaultTexture, _defaultTextureAllocation);
+		vkDestroySampler(_device, _defaultSampler, nullptr);
+		vkDestroyDescriptorPool(_device, _bindlessPool, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _bindlessSetLayout, nullptr);
+	}
+
+	//====================== Texture Streaming ==========================
+	// Textures (--texture files and --stream-textures procedural ones) are decoded on _textureStreamPool. Each one
+	// is resident as a version holding mips [baseMip, mipLevels): the top level is built on a worker (downsampled
+	// from the decoded image when baseMip > 0), copied through the staging ring in row bands under the per-frame
+	// budget, and the rest of the chain is blitted on the graphics queue by the first frame that samples it.
+	// Promoting or evicting mips builds a new version in a new bindless slot and retires the old one.
+	void _createTextureStreaming()
+	{
+		std::vector<std::string> sources = _config.textureFiles;
+		sources.resize(sources.size() + _config.streamedTextureCount);
+		if (sources.empty())
+			return;
+
+		// one slot for the default texture, one per texture and at least one spare for the next version to swap into
+		if (sources.size() + 2 > _textureCapacity)
+		{
+			throw std::runtime_error("More streamed textures than bindless texture slots (" + std::to_string(_textureCapacity - 2) + ")!");
+		}
+
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(_physicalDevice, TEXTURE_FORMAT, &formatProperties);
+		const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+		if ((formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures)
+		{
+			throw std::runtime_error("Texture format does not support blits for mip generation!");
+		}
+		_mipFilter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+		_textureStreamPool.reset(new ThreadPool(std::max(1u, std::thread::hardware_concurrency() / 2)));
+		_streamedTextures.resize(sources.size());
+		for (uint32_t i = 0; i < sources.size(); i++)
+		{
+			// the vector is never resized again, workers may hold on to its elements
+			StreamedTexture& texture = _streamedTextures[i];
+			texture.source = sources[i];
+			const uint32_t size = _config.textureSize;
+			texture.decodeJob = _textureStreamPool->submit([&texture, i, size]()
+			{
+				texture.decoded = texture.source.empty() ? makeCheckerTexture(size, i) : decodePPM(readFile(texture.source));
+			});
+		}
+
+		std::cout << "textures: streaming " << sources.size() << " textures, decoded on " << _textureStreamPool->size() << " threads, "
+			<< _config.textureBudgetKiB << " KiB upload budget per frame" << std::endl;
+	}
+
+	// called once per frame before recording: retires unused versions, moves uploads along within the budget and
+	// swaps in versions whose upload has landed
+	void _streamTextures()
+	{
+		_lastTextureUploadBytes = 0;
+		if (_streamedTextures.empty())
+			return;
+
+		while (!_retiredTextureVersions.empty() && _retiredTextureVersions.front()->lastFrame <= _completedFrameNumber)
+		{
+			_destroyTextureVersion(*_retiredTextureVersions.front());
+			_retiredTextureVersions.pop_front();
+		}
+		_updateTextureResidency();
+
+		const VkDeviceSize budget = VkDeviceSize(_config.textureBudgetKiB) * 1024;
+		VkDeviceSize spent = 0;
+		for (StreamedTexture& texture : _streamedTextures)
+		{
+			if (texture.mipLevels == 0)
+			{
+				if (!isFutureReady(texture.decodeJob))
+					continue;
+
+				texture.decodeJob.get();
+				texture.mipLevels = mipLevelCount(texture.decoded.width, texture.decoded.height);
+			}
+
+			uint32_t wanted = std::min(texture.requestedMip, texture.mipLevels - 1);
+			if (!texture.pending && (!texture.resident || (texture.resident->baseMip != wanted && !texture.resident->mipsPending)))
+			{
+				_beginTextureVersion(texture, wanted);
+			}
+			if (!texture.pending || !isFutureReady(texture.pending->prepared))
+				continue;
+
+			TextureVersion& version = *texture.pending;
+			if (version.image == VK_NULL_HANDLE)
+			{
+				if (version.prepared.valid())
+				{
+					version.prepared.get();
+				}
+				_createImage(version.width, version.height, version.levels, TEXTURE_FORMAT,
+					VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, version.image, version.allocation);
+			}
+
+			if (version.uploadedRows < version.height)
+			{
+				spent += _uploadTextureRows(texture, version, budget > spent ? budget - spent : 0, spent == 0);
+			}
+			else if (_isUploadComplete(version.uploadTicket) && _hasFreeTextureSlot())
+			{
+				_swapTextureVersion(texture);
+			}
+		}
+
+		_lastTextureUploadBytes = spent;
+		_peakTextureUploadBytes = std::max(_peakTextureUploadBytes, spent);
+		_textureUploadBytes += spent;
+	}
+
+	// residency follows the on-screen size of the textured geometry: mips finer than one texel per pixel are left out
+	void _updateTextureResidency()
+	{
+		if (_textureResidencyPinned)
+			return;
+
+		float footprint = std::max(1.0f, _config.zoom * std::min(_sceneExtent.width, _sceneExtent.height));
+		for (StreamedTexture& texture : _streamedTextures)
+		{
+			if (texture.mipLevels == 0)
+				continue;	// still being decoded
+
+			float ratio = std::max(texture.decoded.width, texture.decoded.height) / footprint;
+			texture.requestedMip = (ratio > 1.0f ? static_cast<uint32_t>(std::floor(std::log2(ratio))) : 0) + _textureBudgetMipBias;
+		}
+	}
+
+	void _beginTextureVersion(StreamedTexture& texture, uint32_t baseMip)
+	{
+		texture.pending.reset(new TextureVersion());
+		TextureVersion& version = *texture.pending;
+		version.baseMip = baseMip;
+		version.width = std::max(1u, texture.decoded.width >> baseMip);
+		version.height = std::max(1u, texture.decoded.height >> baseMip);
+		version.levels = texture.mipLevels - baseMip;
+
+		if (baseMip > 0)
+		{
+			TextureVersion* target = &version;
+			const TextureImage* decoded = &texture.decoded;
+			version.prepared = _textureStreamPool->submit([target, decoded, baseMip]()
+			{
+				TextureImage level = downsampleTexture(*decoded);
+				for (uint32_t mip = 1; mip < baseMip; mip++)
+				{
+					level = downsampleTexture(level);
+				}
+				target->baseLevel = std::move(level);
+			});
+		}
+	}
+
+	// copies the next band of the version's top level, at least one row when mustProgress, otherwise only what
+	// fits into the remaining budget; returns the bytes copied
+	VkDeviceSize _uploadTextureRows(StreamedTexture& texture, TextureVersion& version, VkDeviceSize remainingBudget, bool mustProgress)
+	{
+		const TextureImage& level = version.baseMip == 0 ? texture.decoded : version.baseLevel;
+		const VkDeviceSize rowBytes = VkDeviceSize(version.width) * TEXTURE_TEXEL_SIZE;
+
+		VkDeviceSize rows = std::min<VkDeviceSize>(version.height - version.uploadedRows, (STAGING_RING_SIZE / 4) / rowBytes);
+		rows = std::min(rows, remainingBudget / rowBytes);
+		if (rows == 0)
+		{
+			if (!mustProgress)
+				return 0;
+			rows = 1;
+		}
+
+		bool lastBand = version.uploadedRows + rows == version.height;
+		VkImageMemoryBarrier toBlitSource = _mipZeroBarrier(version.image);
+		toBlitSource.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toBlitSource.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		toBlitSource.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		toBlitSource.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+		version.uploadTicket = _uploadImageRows(version.image, version.width, version.uploadedRows, static_cast<uint32_t>(rows), level.texels.data(),
+			lastBand ? &toBlitSource : nullptr, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		version.uploadedRows += static_cast<uint32_t>(rows);
+
+		if (lastBand && version.baseMip > 0)
+		{
+			version.baseLevel = TextureImage();		// copied into the staging ring, no longer needed
+		}
+		return rows * rowBytes;
+	}
+
+	// the new version takes a slot no pending frame uses, so nothing in flight is rewritten; the old one
+	// stays alive until every frame submitted so far has finished with it
+	void _swapTextureVersion(StreamedTexture& texture)
+	{
+		TextureVersion& version = *texture.pending;
+		version.view = _createTextureView(version.image, TEXTURE_FORMAT, version.levels);
+		version.slot = _registerTexture(version.view);
+		version.mipsPending = true;
+		_textureMipJobs.push_back(&version);
+
+		if (texture.resident)
+		{
+			if (version.baseMip > texture.resident->baseMip)
+				_textureEvictions++;
+			else
+				_texturePromotions++;
+
+			texture.resident->lastFrame = _frameNumber;
+			_retiredTextureVersions.push_back(std::move(texture.resident));
+		}
+		else
+		{
+			_texturePromotions++;
+		}
+		texture.resident = std::move(texture.pending);
+	}
+
+	// Blits mips [1, levels) of swapped-in versions, each from the level above, and hands every level to the fragment
+	// shader. Recorded ahead of the render pass in the first frame whose draws use the new slot; mip 0 was
+	// left in TRANSFER_SRC_OPTIMAL by its upload.
+	void _recordTextureMips(VkCommandBuffer commandBuffer)
+	{
+		for (TextureVersion* version : _textureMipJobs)
+		{
+			VkImageMemoryBarrier barrier = _mipZeroBarrier(version->image);
+			if (version->levels > 1)
+			{
+				barrier.subresourceRange.baseMipLevel = 1;
+				barrier.subresourceRange.levelCount = version->levels - 1;
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			}
+
+			int32_t width = static_cast<int32_t>(version->width);
+			int32_t height = static_cast<int32_t>(version->height);
+			for (uint32_t level = 1; level < version->levels; level++)
+			{
+				VkImageBlit blit = {};
+				blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+				blit.srcOffsets[1] = { width, height, 1 };
+				width = std::max(1, width / 2);
+				height = std::max(1, height / 2);
+				blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+				blit.dstOffsets[1] = { width, height, 1 };
+				vkCmdBlitImage(commandBuffer, version->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, version->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, _mipFilter);
+
+				// the new level is the next blit's source
+				barrier.subresourceRange.baseMipLevel = level;
+				barrier.subresourceRange.levelCount = 1;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			}
+
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = version->levels;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			version->mipsPending = false;
+		}
+		_textureMipJobs.clear();
+	}
+
+	// bindless slot sampled by draw i: its streamed texture once resident, the default texture otherwise
+	uint32_t _drawTextureSlot(uint32_t draw) const
+	{
+		if (_streamedTextures.empty())
+			return 0;
+
+		const StreamedTexture& texture = _streamedTextures[draw % _streamedTextures.size()];
+		return texture.resident ? texture.resident->slot : 0;
+	}
+
+	// every texture is resident at its requested mip with no upload or mip generation outstanding
+	bool _texturesSettled() const
+	{
+		for (const StreamedTexture& texture : _streamedTextures)
+		{
+			if (texture.mipLevels == 0 || texture.pending || !texture.resident || texture.resident->mipsPending ||
+				texture.resident->baseMip != std::min(texture.requestedMip, texture.mipLevels - 1))
+				return false;
+		}
+		return true;
+	}
+
+	void _destroyTextureVersion(TextureVersion& version)
+	{
+		if (version.view != VK_NULL_HANDLE)
+		{
+			_releaseTexture(version.slot);
+			vkDestroyImageView(_device, version.view, nullptr);
+		}
+		if (version.image != VK_NULL_HANDLE)
+		{
+			_destroyImage(version.image, version.allocation);
+		}
+	}
+
+	void _reportTextureStreaming()
+	{
+		if (_streamedTextures.empty())
+			return;
+
+		VkDeviceSize residentBytes = 0;
+		for (const StreamedTexture& texture : _streamedTextures)
+		{
+			if (texture.resident)
+			{
+				residentBytes += texture.resident->allocation.size;
+			}
+		}
+		std::cout << "textures: " << _streamedTextures.size() << " streamed, " << _textureUploadBytes / 1024 << " KiB uploaded, peak "
+			<< _peakTextureUploadBytes / 1024 << " KiB/frame (budget " << _config.textureBudgetKiB << " KiB), " << _texturePromotions << " promotions, "
+			<< _textureEvictions << " evictions, " << residentBytes / 1024 << " KiB resident" << std::endl;
+	}
+
+	// the device is idle; the pool finishes queued jobs before its workers exit
+	void _destroyTextureStreaming()
+	{
+		_textureStreamPool.reset();
+
+		for (StreamedTexture& texture : _streamedTextures)
+		{
+			if (texture.resident)
+			{
+				_destroyTextureVersion(*texture.resident);
+			}
+			if (texture.pending)
+			{
+				_destroyTextureVersion(*texture.pending);
+			}
+		}
+		for (auto& version : _retiredTextureVersions)
+		{
+			_destroyTextureVersion(*version);
+		}
+		_streamedTextures.clear();
+		_retiredTextureVersions.clear();
+		_textureMipJobs.clear();
+	}
+
+	//====================== Culling ==========================
+	ViewConstants _viewConstants() const
+	{
+		ViewConstants view;
+		view.scale = glm::vec2(_config.zoom, _config.zoom);
+		view.offset = glm::vec2(0.0f, 0.0f);
+		return view;
+	}
+
+	// compute pipeline writing indexed indirect draws; needs drawIndirectFirstInstance to pick each object's instance
+	void _createCullingPipeline()
+	{
+		if (!_enabledFeatures.drawIndirectFirstInstance)
+		{
+			std::cout << "drawIndirectFirstInstance is not supported, gpu culling disabled" << std::endl;
+			return;
+		}
+
+		std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+		for (uint32_t i = 0; i < bindings.size(); i++)
+		{
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+
+		if (vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &_cullDescriptorSetLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create culling descriptor set layout!");
+		}
+
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(CullConstants);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &_cullDescriptorSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_cullPipelineLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create culling pipeline layout!");
+		}
+
+		VkShaderModule cullShaderModule = _createShaderModule(_cullShaderCode);
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = cullShaderModule;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = _cullPipelineLayout;
+
+		VkResult result = vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineInfo, nullptr, &_cullPipeline);
+		vkDestroyShaderModule(_device, cullShaderModule, nullptr);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create culling pipeline!");
+		}
+
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSize.descriptorCount = static_cast<uint32_t>(bindings.size()) * _config.framesInFlight;
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = _config.framesInFlight;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+
+		if (vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_cullDescriptorPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create culling descriptor pool!");
+		}
+
+		std::vector<VkDescriptorSetLayout> setLayouts(_config.framesInFlight, _cullDescriptorSetLayout);
+		std::vector<VkDescriptorSet> sets(_config.framesInFlight);
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = _cullDescriptorPool;
+		allocInfo.descriptorSetCount = _config.framesInFlight;
+		allocInfo.pSetLayouts = setLayouts.data();
+
+		if (vkAllocateDescriptorSets(_device, &allocInfo, sets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate culling descriptor sets!");
+		}
+
+		_cullFrames.resize(_config.framesInFlight);
+		for (size_t i = 0; i < _config.framesInFlight; i++)
+		{
+			_cullFrames[i].descriptorSet = sets[i];
+		}
+		_gpuCullingSupported = true;
+	}
+
+	void _destroyCullingPipeline()
+	{
+		vkDestroyDescriptorPool(_device, _cullDescriptorPool, nullptr);
+		vkDestroyPipeline(_device, _cullPipeline, nullptr);
+		vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _cullDescriptorSetLayout, nullptr);
+		_cullFrames.clear();
+	}
+
+	// one object per (instance, mesh chunk) with world-space bounds; needs every chunk uploaded
+	void _createCullingBuffers()
+	{
+		if (_config.cullMode == CullMode::None || _streamedChunkCount < _meshChunks.size())
+			return;
+
+		std::vector<InstanceData> instances = makeInstanceGrid(_config.instanceCount);
+
+		_cullObjects.clear();
+		_cullObjects.reserve(instances.size() * _meshChunks.size());
+		for (uint32_t instance = 0; instance < instances.size(); instance++)
+		{
+			const InstanceData& data = instances[instance];
+			for (const MeshDrawChunk& chunk : _meshChunks)
+			{
+				CullObject object;
+				object.boundsMin = glm::vec4(chunk.boundsMin.x * data.scale + data.offset.x, chunk.boundsMin.y * data.scale + data.offset.y, 0.0f, 0.0f);
+				object.boundsMax = glm::vec4(chunk.boundsMax.x * data.scale + data.offset.x, chunk.boundsMax.y * data.scale + data.offset.y, 0.0f, 0.0f);
+				object.firstIndex = chunk.firstIndex;
+				object.indexCount = chunk.indexCount;
+				object.vertexOffset = chunk.vertexOffset;
+				object.instance = instance;
+				_cullObjects.push_back(object);
+			}
+		}
+
+		if (!_gpuCullingSupported)
+			return;
+
+		VkDeviceSize objectBytes = sizeof(CullObject) * _cullObjects.size();
+		_createBuffer(objectBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			_cullObjectBuffer, _cullObjectAllocation);
+		_uploadBuffer(_cullObjectBuffer, 0, _cullObjects.data(), objectBytes, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		VkDeviceSize commandBytes = sizeof(VkDrawIndexedIndirectCommand) * _cullObjects.size();
+		for (auto& cull : _cullFrames)
+		{
+			_createBuffer(commandBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				cull.drawCommands, cull.drawCommandsAllocation);
+			_createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cull.drawCount, cull.drawCountAllocation);
+
+			VkDescriptorBufferInfo bufferInfos[3] = {};
+			bufferInfos[0] = { _cullObjectBuffer, 0, VK_WHOLE_SIZE };
+			bufferInfos[1] = { cull.drawCommands, 0, VK_WHOLE_SIZE };
+			bufferInfos[2] = { cull.drawCount, 0, VK_WHOLE_SIZE };
+
+			VkWriteDescriptorSet writes[3] = {};
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[i].dstSet = cull.descriptorSet;
+				writes[i].dstBinding = i;
+				writes[i].descriptorCount = 1;
+				writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[i].pBufferInfo = &bufferInfos[i];
+			}
+			vkUpdateDescriptorSets(_device, 3, writes, 0, nullptr);
+		}
+	}
+
+	// the device must be idle
+	void _destroyCullingBuffers()
+	{
+		for (auto& cull : _cullFrames)
+		{
+			_destroyBuffer(cull.drawCommands, cull.drawCommandsAllocation);
+			_destroyBuffer(cull.drawCount, cull.drawCountAllocation);
+			cull = CullFrame{ VK_NULL_HANDLE, {}, VK_NULL_HANDLE, {}, cull.descriptorSet };
+		}
+		_destroyBuffer(_cullObjectBuffer, _cullObjectAllocation);
+		_cullObjectBuffer = VK_NULL_HANDLE;
+		_cullObjectAllocation = GpuAllocation();
+		_cullObjects.clear();
+	}
+
+	bool _useGpuCulling() const
+	{
+		return _config.cullMode == CullMode::Gpu && _cullObjectBuffer != VK_NULL_HANDLE;
+	}
+
+	// the compacted list has a single count, so it cannot be split over several calls: when the objects do not fit
+	// into maxDrawIndirectCount the culling keeps one slot per object and the draws are batched instead
+	bool _useDrawIndirectCount() const
+	{
+		return _vkCmdDrawIndexedIndirectCount && _cullObjects.size() <= _maxDrawIndirectCount;
+	}
+
+	// clearing the count and culling every object; the graph puts the barriers between them and before the indirect draws
+	void _addCullingPasses(const CullFrame& cull, RenderGraph::Resource drawCommands, RenderGraph::Resource drawCount)
+	{
+		const size_t clear = _renderGraph.addPass("clear draw count", [&cull](const RenderGraph::PassContext& context)
+		{
+			vkCmdFillBuffer(context.commandBuffer, cull.drawCount, 0, sizeof(uint32_t), 0);
+		});
+		_renderGraph.write(clear, drawCount, RenderGraph::Access::TransferWrite);
+
+		const size_t culling = _renderGraph.addPass("culling", [this, &cull](const RenderGraph::PassContext& context) { _recordCulling(context.commandBuffer, cull); });
+		_renderGraph.write(culling, drawCount, RenderGraph::Access::ComputeWrite);
+		_renderGraph.write(culling, drawCommands, RenderGraph::Access::ComputeWrite);
+	}
+
+	// one invocation per object writes its draw command, or appends it when the count is compacted
+	void _recordCulling(VkCommandBuffer commandBuffer, const CullFrame& cull)
+	{
+		ViewConstants view = _viewConstants();
+		CullConstants constants;
+		constants.viewScale = view.scale;
+		constants.viewOffset = view.offset;
+		constants.objectCount = static_cast<uint32_t>(_cullObjects.size());
+		constants.compact = _useDrawIndirectCount() ? 1 : 0;
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &cull.descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (constants.objectCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+	}
+
+	// a fixed number of commands whatever the object count: one count draw, or batches of multi-draw
+	void _recordIndirectDraws(VkCommandBuffer commandBuffer, const CullFrame& cull)
+	{
+		const uint32_t objectCount = static_cast<uint32_t>(_cullObjects.size());
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+		if (_useDrawIndirectCount())
+		{
+			_vkCmdDrawIndexedIndirectCount(commandBuffer, cull.drawCommands, 0, cull.drawCount, 0, objectCount, stride);
+		}
+		else if (_enabledFeatures.multiDrawIndirect)
+		{
+			for (uint32_t first = 0; first < objectCount; first += _maxDrawIndirectCount)
+			{
+				uint32_t count = std::min(_maxDrawIndirectCount, objectCount - first);
+				vkCmdDrawIndexedIndirect(commandBuffer, cull.drawCommands, VkDeviceSize(first) * stride, count, stride);
+			}
+		}
+		else
+		{
+			// no multi-draw: one call per object, cpu cost grows with the object count again
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, cull.drawCommands, VkDeviceSize(i) * stride, 1, stride);
+			}
+		}
+	}
+
+	// cpu reference path: the same test as cull.comp, one vkCmdDrawIndexed per visible object
+	uint32_t _recordCpuCulledDraws(VkCommandBuffer commandBuffer)
+	{
+		const ViewConstants view = _viewConstants();
+		uint32_t visibleCount = 0;
+		for (const CullObject& object : _cullObjects)
+		{
+			if (isObjectVisible(object, view))
+			{
+				vkCmdDrawIndexed(commandBuffer, object.indexCount, 1, object.firstIndex, object.vertexOffset, object.instance);
+				visibleCount++;
+			}
+		}
+		return visibleCount;
+	}
+
+	// one transient pool per frame in flight plus one per recording job; a frame's pools are reset
+	// together once its fence has signaled instead of freeing individual command buffers
+	void _createCommandPool()
+	{
+		QueueFamilyIndices queueFamilyIndice = _findQueueFamily(_physicalDevice);
+
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamilyIndice.graphicsFamily.value();
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+		const uint32_t jobCount = _recordPool ? _recordPool->size() : 0;
+
+		_frameCommands.resize(_config.framesInFlight);
+		for (auto& frame : _frameCommands)
+		{
+			if (vkCreateCommandPool(_device, &poolInfo, nullptr, &frame.commandPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create Command pool");
+			}
+
+			frame.workerPools.resize(jobCount);
+			for (auto& pool : frame.workerPools)
+			{
+				if (vkCreateCommandPool(_device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create Command pool");
+				}
+			}
+		}
+	}
+
+	void _destroyCommandPool()
+	{
+		for (auto& frame : _frameCommands)
+		{
+			for (auto pool : frame.workerPools)
+			{
+				vkDestroyCommandPool(_device, pool, nullptr);
+			}
+			vkDestroyCommandPool(_device, frame.commandPool, nullptr);
+		}
+		_frameCommands.clear();
+	}
+
+	// swaps the recording setup; used by the record benchmark to sweep thread counts
+	void _setRecordThreads(uint32_t threadCount)
+	{
+		vkDeviceWaitIdle(_device);
+
+		_destroyCommandPool();
+		_recordPool.reset();
+
+		_config.recordThreads = threadCount;
+		if (threadCount > 1)
+		{
+			_recordPool.reset(new ThreadPool(threadCount));
+		}
+
+		_createCommandPool();
+		_createCommandBuffers();
+	}
+	
+	// the pipelines only need render passes compatible with the scene and pre-pass, the graph's cache has them;
+	// the attachments are in the order _buildFrameGraph adds them
+	void _createRenderPass()
+	{
+		if (_depthFormat == VK_FORMAT_UNDEFINED)
+		{
+			// _checkDeviceCapabilities rejected devices without one
+			_depthFormat = _findDepthFormat(_physicalDevice);
+			_updateDepthLayers();
+		}
+
+		// an unsupported --msaa value is lowered and reported once, later calls ask for the lowered value
+		_sampleCount = _selectSampleCount(_config.msaaSamples);
+		if (_sampleCount != _config.msaaSamples)
+		{
+			std::cout << "msaa: " << _config.msaaSamples << " samples not supported, using " << _sampleCount << std::endl;
+			_config.msaaSamples = _sampleCount;
+		}
+
+		RenderGraph::AttachmentKey color;
+		color.format = _swapChainImageFormat;
+		color.samples = _sampleCount;
+		RenderGraph::AttachmentKey depth;
+		depth.format = _depthFormat;
+		depth.samples = _sampleCount;
+		depth.depth = true;
+		RenderGraph::AttachmentKey resolve;
+		resolve.format = _swapChainImageFormat;
+		resolve.resolve = true;
+
+		if (_sampleCount == VK_SAMPLE_COUNT_1_BIT)
+		{
+			_renderPass = _renderGraph.getRenderPass({ color, depth });
+		}
+		else
+		{
+			_renderPass = _renderGraph.getRenderPass({ color, depth, resolve });
+		}
+		_depthPrepassRenderPass = _renderGraph.getRenderPass({ depth });
+	}
+
+	// the highest supported sample count not above the requested one; the depth buffer is multisampled as well,
+	// so it has to be a color and a depth framebuffer sample count. Quiet, --bench msaa probes every count with it
+	VkSampleCountFlagBits _selectSampleCount(uint32_t requested) const
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		const VkSampleCountFlags supported = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+
+		uint32_t samples = 1;
+		for (uint32_t count = 2; count <= std::min(requested, 64u); count *= 2)
+		{
+			if (supported & count)
+			{
+				samples = count;
+			}
+		}
+		return static_cast<VkSampleCountFlagBits>(samples);
+	}
+
+	// the first depth format the device can render to, VK_FORMAT_UNDEFINED if none
+	static VkFormat _findDepthFormat(VkPhysicalDevice device)
+	{
+		for (VkFormat format : { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT })
+		{
+			VkFormatProperties properties;
+			vkGetPhysicalDeviceFormatProperties(device, format, &properties);
+			if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+				return format;
+		}
+		return VK_FORMAT_UNDEFINED;
+	}
+
+	// distinct depths a layer stepping down from 1.0 can take: D24 has 2^24 values, and the spacing of D32 floats
+	// just below 1.0 is 2^-24 as well, finer only further down
+	static uint32_t _depthFormatLayers(VkFormat format)
+	{
+		return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D16_UNORM_S8_UINT ? (1u << 16) : (1u << 24);
+	}
+
+	// Every instance of every draw gets its own depth layer, later ones nearer. Past what the depth format resolves
+	// the steps would round together, so the instances of a draw share its layer instead (they then resolve in
+	// instance order rather than painter's order); draws past the last layer share it as well. Reported once.
+	void _updateDepthLayers()
+	{
+		const uint32_t maxLayers = _depthFormatLayers(_depthFormat);
+		const uint64_t layersPerDraw = std::max(1u, _config.instanceCount);
+		const uint64_t layers = uint64_t(_config.drawCount) * layersPerDraw + 1;
+		if (layers <= maxLayers)
+		{
+			_depthLayersPerDraw = static_cast<uint32_t>(layersPerDraw);
+			_depthLayerCount = static_cast<uint32_t>(layers - 1);
+			_depthStep = 1.0f / static_cast<float>(layers);
+			_instanceDepthStep = _depthStep;
+			return;
+		}
+
+		_depthLayersPerDraw = 1;
+		_depthLayerCount = static_cast<uint32_t>(std::min<uint64_t>(uint64_t(_config.drawCount) + 1, maxLayers) - 1);
+		_depthStep = 1.0f / static_cast<float>(_depthLayerCount + 1);
+		_instanceDepthStep = 0.0f;
+		std::cout << "depth: " << layers - 1 << " layers exceed the " << maxLayers - 1 << " the depth format resolves, instances of a draw share one"
+			<< (_config.drawCount > _depthLayerCount ? ", the last draws share the nearest" : "") << std::endl;
+	}
+
+	// every permutation we ship; the first entry is the one drawn with, followed by the pre-pass one when enabled
+	std::vector<PipelineVariant> _enumeratePipelineVariants()
+	{
+		PipelineVariant drawVariant;
+		drawVariant.shaderFeatures = _config.shaderFeatures;
+		drawVariant.depthState = _config.depthPrepass ? DepthState::Equal : DepthState::TestWrite;
+
+		const VkCullModeFlags cullModes[] = { VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE };
+		const VkPrimitiveTopology topologies[] = { VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP };
+
+		std::vector<PipelineVariant> variants = { drawVariant };
+		if (_config.depthPrepass)
+		{
+			PipelineVariant prepassVariant = drawVariant;
+			prepassVariant.depthState = DepthState::Prepass;
+			variants.push_back(prepassVariant);
+		}
+		for (VkCullModeFlags cullMode : cullModes)
+		{
+			for (VkPrimitiveTopology topology : topologies)
+			{
+				for (bool blend : { false, true })
+				{
+					for (uint32_t features = 0; features <= (SHADER_FEATURE_INSTANCE_COLOR | SHADER_FEATURE_GRAYSCALE); features++)
+					{
+						PipelineVariant variant;
+						variant.cullMode = cullMode;
+						variant.topology = topology;
+						variant.blend = blend;
+						variant.shaderFeatures = features;
+						if (!(variant == drawVariant))
+						{
+							variants.push_back(variant);
+						}
+					}
+				}
+			}
+		}
+		return variants;
+	}
+
+	// Compiles all variants on a thread pool and blocks only until the first-frame variant is ready.
+	void _createGraphicsPipeline()
+	{
+		_vertShaderModule = _createShaderModule(_vertShaderCode);
+		_fragShaderModule = _createShaderModule(_fragShaderCode);
+
+		_createPipelineLayout();
+		_compilePipelineVariants();
+	}
+
+	// queues every variant on the compile pool and waits for the draw variant
+	void _compilePipelineVariants()
+	{
+		if (!_pipelineCompilePool)
+		{
+			_pipelineCompilePool.reset(new ThreadPool(std::max(2u, std::thread::hardware_concurrency()) - 1));
+		}
+
+		std::vector<PipelineVariant> variants = _enumeratePipelineVariants();
+		const size_t firstFrameVariants = _config.depthPrepass ? 2 : 1;
+
+		// sized up front, the jobs keep pointers into it
+		_pipelineVariants = std::vector<PipelineVariantEntry>(variants.size());
+		_pendingPipelineVariants = static_cast<uint32_t>(variants.size());
+		_pipelineVariantsReported = false;
+		_pipelineCompileStart = std::chrono::high_resolution_clock::now();
+
+		// first-frame variants are queued first so they never wait behind background work
+		for (size_t i = 0; i < variants.size(); i++)
+		{
+			PipelineVariantEntry* entry = &_pipelineVariants[i];
+			entry->variant = variants[i];
+			entry->compiled = _pipelineCompilePool->submit([this, entry]()
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				try
+				{
+					entry->pipeline = _compilePipelineVariant(entry->variant);
+				}
+				catch (...)
+				{
+					_pendingPipelineVariants--;
+					throw;
+				}
+				entry->compileMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				_pendingPipelineVariants--;
+			});
+		}
+
+		for (size_t i = 0; i < firstFrameVariants; i++)
+		{
+			_pipelineVariants[i].compiled.wait();
+		}
+		_pipelineCriticalPathMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _pipelineCompileStart).count();
+
+		// rethrows if a first-frame variant failed to compile
+		for (size_t i = 0; i < firstFrameVariants; i++)
+		{
+			_pipelineVariants[i].compiled.get();
+		}
+		_graphicsPipeline = _pipelineVariants[0].pipeline;
+		_depthPrepassPipeline = _config.depthPrepass ? _pipelineVariants[1].pipeline : VK_NULL_HANDLE;
+
+		std::cout << "graphics pipeline ready in " << _pipelineCriticalPathMs << " ms (" << (_pipelineCacheWarm ? "warm" : "cold")
+			<< " pipeline cache), " << variants.size() - firstFrameVariants << " more variants compiling in the background" << std::endl;
+	}
+
+	// called every frame: reports once all background variants are done
+	void _pollPipelineVariants()
+	{
+		if (_pipelineVariantsReported || _pendingPipelineVariants.load() != 0)
+			return;
+
+		_pipelineVariantsReported = true;
+		double wallMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _pipelineCompileStart).count();
+
+		double summedMs = 0.0;
+		uint32_t failed = 0;
+		for (auto& entry : _pipelineVariants)
+		{
+			summedMs += entry.compileMs;
+			failed += entry.pipeline == VK_NULL_HANDLE ? 1 : 0;
+		}
+
+		std::cout << "pipeline variants: " << _pipelineVariants.size() << " compiled on " << _pipelineCompilePool->size() << " threads, critical path "
+			<< _pipelineCriticalPathMs << " ms, all done after " << wallMs << " ms, " << summedMs << " ms total compile time";
+		if (failed)
+		{
+			std::cout << ", " << failed << " failed";
+		}
+		std::cout << std::endl;
+
+		// later pipelines find the shaders in the cache
+		_pipelineCacheWarm = true;
+	}
+
+	// blocks until no compile job is running anymore, background failures are only reported
+	void _waitPipelineVariants()
+	{
+		for (auto& entry : _pipelineVariants)
+		{
+			if (!entry.compiled.valid())
+				continue;
+
+			try
+			{
+				entry.compiled.get();
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << e.what() << std::endl;
+			}
+		}
+		_pollPipelineVariants();
+	}
+
+	// the pipeline for a variant, or VK_NULL_HANDLE while it is still compiling
+	VkPipeline _getPipelineVariant(const PipelineVariant& variant)
+	{
+		for (auto& entry : _pipelineVariants)
+		{
+			if (entry.variant == variant)
+			{
+				bool ready = entry.compiled.valid() ? entry.compiled.wait_for(std::chrono::seconds(0)) == std::future_status::ready : true;
+				return ready ? entry.pipeline : VK_NULL_HANDLE;
+			}
+		}
+		return VK_NULL_HANDLE;
+	}
+
+	void _createPipelineLayout()
+	{
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(DrawConstants);
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		// set 0: per-frame uniforms, set 1: bindless table
+		VkDescriptorSetLayout setLayouts[] = { _uniformSetLayout, _bindlessSetLayout };
+		pipelineLayoutInfo.setLayoutCount = 2;
+		pipelineLayoutInfo.pSetLayouts = setLayouts;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create Pipeline layout!");
+		}
+	}
+
+	// runs on a compile thread; only reads shared state (modules, layout, render pass, cache - which is internally synchronized)
+	VkPipeline _compilePipelineVariant(const PipelineVariant& variant)
+	{
+		// shader features as specialization constant 0, the driver folds the dead branches away;
+		// 1 and 2 size the bindless arrays to the descriptor set layout
+		const uint32_t specializationData[] = { variant.shaderFeatures, _textureCapacity, _bufferCapacity };
+		VkSpecializationMapEntry specializationEntries[3] = {};
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			specializationEntries[i].constantID = i;
+			specializationEntries[i].offset = i * sizeof(uint32_t);
+			specializationEntries[i].size = sizeof(uint32_t);
+		}
+
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = 3;
+		specializationInfo.pMapEntries = specializationEntries;
+		specializationInfo.dataSize = sizeof(specializationData);
+		specializationInfo.pData = specializationData;
+
+		// shader stage
+		VkPipelineShaderStageCreateInfo vertShaderStageCreateInfo = {};
+		vertShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		vertShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		vertShaderStageCreateInfo.module = _vertShaderModule;
+		vertShaderStageCreateInfo.pName = "main";
+		vertShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+
+		VkPipelineShaderStageCreateInfo fragShaderStageCreateInfo = {};
+		fragShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		fragShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		fragShaderStageCreateInfo.module = _fragShaderModule;
+		fragShaderStageCreateInfo.pName = "main";
+		fragShaderStageCreateInfo.pSpecializationInfo = &specializationInfo;
+
+		VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageCreateInfo, fragShaderStageCreateInfo };
+		const bool depthOnly = variant.depthState == DepthState::Prepass;
+
+		// vertex input
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+		// binding 0: per-vertex in the selected layout, binding 1: per-instance
+		std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = { _vertexLayout.binding, InstanceData::getBindingDescription() };
+
+		auto instanceAttributes = InstanceData::getAttributeDescriptions();
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions = _vertexLayout.attributes;
+		attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributes.begin(), instanceAttributes.end());
+
+		vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+		vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+		// input assembly
+		VkPipelineInputAssemblyStateCreateInfo inputAssmbly = {};
+		inputAssmbly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssmbly.topology = variant.topology;
+		inputAssmbly.primitiveRestartEnable = VK_FALSE;
+
+		// viewports and scissors, set at record time so the pipeline survives swapchain resizes
+		VkPipelineViewportStateCreateInfo viewportsCreateInfo = {};
+		viewportsCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportsCreateInfo.viewportCount = 1;
+		viewportsCreateInfo.pViewports = nullptr;
+		viewportsCreateInfo.scissorCount = 1;
+		viewportsCreateInfo.pScissors = nullptr;
+
+		VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+		VkPipelineDynamicStateCreateInfo dynamicState = {};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = 2;
+		dynamicState.pDynamicStates = dynamicStates;
+
+		// rasterizer
+		VkPipelineRasterizationStateCreateInfo rasterizer = {};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.depthClampEnable = VK_FALSE;
+		rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = variant.cullMode;
+		rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+		rasterizer.depthBiasEnable = VK_FALSE;
+		rasterizer.depthBiasConstantFactor = 0.0f;
+		rasterizer.depthBiasClamp = 0.0f;
+		rasterizer.depthBiasSlopeFactor = 0.0f;
+
+		// multisampling
+		VkPipelineMultisampleStateCreateInfo multisampling = {};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.sampleShadingEnable = VK_FALSE;
+		multisampling.rasterizationSamples = _sampleCount;
+		multisampling.minSampleShading = 1.0f;
+		multisampling.pSampleMask = nullptr;
+		multisampling.alphaToCoverageEnable = VK_FALSE;
+		multisampling.alphaToOneEnable = VK_FALSE;
+
+		// color blending
+		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachment.blendEnable = variant.blend ? VK_TRUE : VK_FALSE;
+		colorBlendAttachment.srcColorBlendFactor = variant.blend ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstColorBlendFactor = variant.blend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+		colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+
+		VkPipelineColorBlendStateCreateInfo colorBlending = {};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.logicOp = VK_LOGIC_OP_COPY;
+		colorBlending.attachmentCount = depthOnly ? 0 : 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+		colorBlending.blendConstants[0] = 0.0f;
+		colorBlending.blendConstants[1] = 0.0f;
+		colorBlending.blendConstants[2] = 0.0f;
+		colorBlending.blendConstants[3] = 0.0f;
+
+		// depth: each draw layer has its own depth, so a pixel keeps exactly one fragment
+		VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depthStencil.depthTestEnable = VK_TRUE;
+		depthStencil.depthWriteEnable = variant.depthState != DepthState::Equal && !variant.blend ? VK_TRUE : VK_FALSE;
+		depthStencil.depthCompareOp = variant.depthState == DepthState::Equal ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+		depthStencil.depthBoundsTestEnable = VK_FALSE;
+		depthStencil.stencilTestEnable = VK_FALSE;
+
+		VkGraphicsPipelineCreateInfo graphicsPipelineInfo = {};
+		graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		graphicsPipelineInfo.stageCount = depthOnly ? 1 : 2;
+		graphicsPipelineInfo.pStages = shaderStages;
+
+		graphicsPipelineInfo.pVertexInputState = &vertexInputInfo;
+		graphicsPipelineInfo.pInputAssemblyState = &inputAssmbly;
+		graphicsPipelineInfo.pViewportState = &viewportsCreateInfo;
+		graphicsPipelineInfo.pRasterizationState = &rasterizer;
+		graphicsPipelineInfo.pMultisampleState = &multisampling;
+		graphicsPipelineInfo.pDepthStencilState = &depthStencil;
+		graphicsPipelineInfo.pColorBlendState = &colorBlending;
+		graphicsPipelineInfo.pDynamicState = &dynamicState;
+
+		graphicsPipelineInfo.layout = _pipelineLayout;
+
+		graphicsPipelineInfo.renderPass = depthOnly ? _depthPrepassRenderPass : _renderPass;
+		graphicsPipelineInfo.subpass = 0;
+
+		graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		graphicsPipelineInfo.basePipelineIndex = -1;
+
+		VkPipeline pipeline;
+		if (vkCreateGraphicsPipelines(_device, _pipelineCache, 1, &graphicsPipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed create graphics pipeline!");
+		}
+		return pipeline;
+	}
+
+	//====================== Pipeline Cache ==========================
+	// startup step without device access; the contents are checked against the device in _createPipelineCache
+	void _readPipelineCacheFile()
+	{
+		try
+		{
+			_pipelineCacheData = readFile(PIPELINE_CACHE_FILE);
+		}
+		catch (const std::runtime_error&)
+		{
+			// first launch, nothing cached yet
+		}
+	}
+
+	void _createPipelineCache()
+	{
+		std::vector<char> cacheData = std::move(_pipelineCacheData);
+		if (!cacheData.empty() && !_isPipelineCacheCompatible(cacheData))
+		{
+			std::cout << "ignoring " << PIPELINE_CACHE_FILE << ": created by a different device or driver" << std::endl;
+			cacheData.clear();
+		}
+
+		VkPipelineCacheCreateInfo cacheInfo = {};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = cacheData.size();
+		cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+		if (vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create pipeline cache!");
+		}
+
+		_pipelineCacheWarm = !cacheData.empty();
+	}
+
+	// drivers reject foreign caches anyway, but checking the header ourselves lets us report it
+	bool _isPipelineCacheCompatible(const std::vector<char>& cacheData)
+	{
+		VkPipelineCacheHeaderVersionOne header;
+		if (cacheData.size() < sizeof(header))
+			return false;
+
+		memcpy(&header, cacheData.data(), sizeof(header));
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+
+		return header.headerSize >= sizeof(header) &&
+			header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header.vendorID == properties.vendorID &&
+			header.deviceID == properties.deviceID &&
+			memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	void _savePipelineCache()
+	{
+		size_t dataSize = 0;
+		if (vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+			return;
+
+		std::vector<char> data(dataSize);
+		if (vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+			return;
+
+		std::ofstream file(PIPELINE_CACHE_FILE, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cerr << "Failed to write " << PIPELINE_CACHE_FILE << std::endl;
+			return;
+		}
+		file.write(data.data(), dataSize);
+	}
+
+	VkShaderModule _createShaderModule(const std::vector<char>& code)
+	{
+		VkShaderModuleCreateInfo createInfo = {};
+
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code.size();
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		
+		VkShaderModule shaderModule;
+		if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create shader module");
+		}
+
+		return shaderModule;
+	}
+
+	void _createImageViews()
+	{
+		_swapChainImageViews.resize(_swapChainImages.size());
+
+		for (size_t i = 0; i < _swapChainImages.size(); i++)
+		{
+			VkImageViewCreateInfo imgViewCreateInfo = {};
+			imgViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			imgViewCreateInfo.image = _swapChainImages[i];
+			imgViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			imgViewCreateInfo.format = _swapChainImageFormat;
+
+			imgViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+			imgViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+			imgViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+			imgViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+			imgViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			imgViewCreateInfo.subresourceRange.baseMipLevel = 0;
+			imgViewCreateInfo.subresourceRange.levelCount = 1;
+			imgViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+			imgViewCreateInfo.subresourceRange.layerCount = 1;
+
+			if (vkCreateImageView(_device, &imgViewCreateInfo, nullptr, &_swapChainImageViews[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create image views");
+			}
+		}
+	}
+
+	void _recreateSwapChain()
+	{
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(_window, &width, &height);
+		while (width == 0 || height == 0)
+		{
+			glfwGetFramebufferSize(_window, &width, &height);
+			glfwWaitEvents();
+		}
+
+		// no vkDeviceWaitIdle: the old swapchain is handed to the new one as oldSwapchain and its
+		// views and framebuffers stay alive until the frames using them have finished
+		VkFormat oldFormat = _swapChainImageFormat;
+
+		RetiredSwapchain retired = _retireSwapchain();
+
+		_createSwapchain();
+		_retiredSwapchains.push_back(std::move(retired));
+		_createImageViews();
+		_updateSceneExtent();
+
+		// viewport and scissor are dynamic, so the render pass and pipeline only depend on the surface format
+		if (_swapChainImageFormat != oldFormat)
+		{
+			// rare enough that draining the queue is fine, in-flight frames still reference the old pipeline
+			vkDeviceWaitIdle(_device);
+			_completedFrameNumber = _frameNumber;
+			_collectRetiredSwapchains();
+
+			_cleanupPipeline();
+			_createRenderPass();
+			_createGraphicsPipeline();
+		}
+
+		// the image count may change, and none of the new images has been submitted yet
+		_imageFrameNumbers.assign(_swapChainImages.size(), 0);
+		_swapchainRecreations++;
+	}
+
+	// moves the current swapchain objects out, tagged with the last frame submitted against them
+	RetiredSwapchain _retireSwapchain()
+	{
+		RetiredSwapchain retired;
+		retired.swapChain = _swapChain;
+		retired.imageViews = std::move(_swapChainImageViews);
+		retired.lastFrame = _frameNumber;
+
+		_swapChainImageViews.clear();
+		return retired;
+	}
+
+	void _destroyRetiredSwapchain(RetiredSwapchain& retired)
+	{
+		_renderGraph.releaseImageViews(retired.imageViews);
+
+		for (auto imageView : retired.imageViews)
+		{
+			vkDestroyImageView(_device, imageView, nullptr);
+		}
+
+		if (retired.swapChain != VK_NULL_HANDLE)
+		{
+			vkDestroySwapchainKHR(_device, retired.swapChain, nullptr);
+		}
+	}
+
+	// destroys retired swapchains whose last frame has completed on the gpu
+	void _collectRetiredSwapchains()
+	{
+		while (!_retiredSwapchains.empty() && _retiredSwapchains.front().lastFrame <= _completedFrameNumber)
+		{
+			_destroyRetiredSwapchain(_retiredSwapchains.front());
+			_retiredSwapchains.pop_front();
+		}
+	}
+
+	void _createSwapchain()
+	{
+		SwapchainSupportDetails swapChainSupport = _querySwapchainSupport(_physicalDevice);
+
+		VkSurfaceFormatKHR surfaceFormat = _chooseSwapSurfaceFormat(swapChainSupport.formats);
+		VkPresentModeKHR presentMode = _chooseSwapPresentMode(swapChainSupport.presentModes);
+		_presentMode = presentMode;
+		VkExtent2D extent = _chooseSwapExtent(swapChainSupport.capabilities);
+
+		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+		{
+			imageCount = swapChainSupport.capabilities.maxImageCount;
+		}
+
+		VkSwapchainCreateInfoKHR createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		createInfo.surface = _surface;
+		createInfo.minImageCount = imageCount;
+		createInfo.imageFormat = surfaceFormat.format;
+		createInfo.imageColorSpace = surfaceFormat.colorSpace;
+		createInfo.imageExtent = extent;
+		createInfo.imageArrayLayers = 1;
+		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+		// a scaled scene is blitted into the images
+		_swapchainTransferDst = (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+		if (_config.renderScale != 1.0f && _swapchainTransferDst)
+		{
+			createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		}
+
+		QueueFamilyIndices indices = _findQueueFamily(_physicalDevice);
+		uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+
+		if (indices.graphicsFamily != indices.presentFamily)
+		{
+			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		else
+		{
+			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			createInfo.queueFamilyIndexCount = 0;
+			createInfo.pQueueFamilyIndices = nullptr;
+		}
+
+		createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+
+		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		createInfo.presentMode = presentMode;
+		createInfo.clipped = VK_TRUE;
+
+		// lets the driver reuse the old swapchain's resources; it is retired either way and destroyed later
+		createInfo.oldSwapchain = _swapChain;
+
+		if (vkCreateSwapchainKHR(_device, &createInfo, nullptr, &_swapChain) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create swap chain");
+		}
+
+		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
+		_swapChainImages.resize(imageCount);
+		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, _swapChainImages.data());
+		_swapChainImageFormat = surfaceFormat.format;
+		_swapChainExtent = extent;
+	}
+
+	// headless replacement for the swapchain: a ring of device-local color images
+	void _createOffscreenTargets()
+	{
+		_swapChainImageFormat = OFFSCREEN_FORMAT;
+		_swapChainExtent = { _config.width, _config.height };
+
+		_swapChainImages.resize(OFFSCREEN_IMAGE_COUNT);
+		_offscreenImageAllocations.resize(OFFSCREEN_IMAGE_COUNT);
+		_swapchainTransferDst = true;
+
+		for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; i++)
+		{
+			_createImage(_swapChainExtent.width, _swapChainExtent.height, 1, _swapChainImageFormat,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				_swapChainImages[i], _offscreenImageAllocations[i]);
+		}
+	}
+
+	//====================== Surface ================================
+	void _createSurface()
+	{
+		if (glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create window surface.");
+		}
+	}
+
+	//====================== Physical Device ==========================
+	void _pickPhysicalDevice() // graphics card choose(GPU)
+	{
+		uint32_t deviceCount = 0;
+		vkEnumeratePhysicalDevices(_instance, &deviceCount, nullptr); // get the number of GPUs first
+
+		// do we have any GPUs with Vulkan support?
+		if (deviceCount == 0)
+		{
+			throw std::runtime_error("Failed to find GPUs with Vulkan support!");
+		}
+
+		// fill with all the GPUs
+		std::vector<VkPhysicalDevice> devices(deviceCount);
+		vkEnumeratePhysicalDevices(_instance, &deviceCount, devices.data());
+
+		// keep the devices that can run this application, say why the others cannot
+		std::vector<VkPhysicalDevice> candidates;
+		for (const auto& device : devices)
+		{
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(device, &properties);
+
+			std::string reason;
+			if (!_isDeviceSuitable(device))
+			{
+				reason = "missing queues, extensions or swapchain support";
+			}
+			else
+			{
+				reason = _checkDeviceCapabilities(device);
+			}
+
+			if (reason.empty())
+			{
+				candidates.push_back(device);
+			}
+			else
+			{
+				std::cout << "device: skipping " << properties.deviceName << ", " << reason << std::endl;
+			}
+		}
+
+		// if no suitable GPU
+		if (candidates.empty())
+		{
+			throw std::runtime_error("Failed to find a suitable GPU!");
+		}
+		if (candidates.size() == 1)
+		{
+			_physicalDevice = candidates[0];
+			return;
+		}
+
+		// measured results win over the static ranking, but only if every candidate has them
+		std::map<std::string, DeviceBenchmark> cache = _loadDeviceBenchmarks();
+		std::vector<DeviceBenchmark> results(candidates.size());
+		bool measured = true;
+		bool cacheChanged = false;
+		for (size_t i = 0; i < candidates.size() && measured; i++)
+		{
+			std::string key = _deviceBenchmarkKey(candidates[i]);
+			auto cached = cache.find(key);
+			if (cached != cache.end())
+			{
+				results[i] = cached->second;
+			}
+			else if (_config.deviceBenchmark)
+			{
+				// a failed benchmark costs the measurement, not the startup
+				try
+				{
+					results[i] = _benchmarkDevice(candidates[i]);
+					cache[key] = results[i];
+					cacheChanged = true;
+				}
+				catch (const std::exception& e)
+				{
+					std::cerr << "device: benchmark failed, using the static ranking: " << e.what() << std::endl;
+					measured = false;
+				}
+			}
+			else
+			{
+				measured = false;
+			}
+		}
+		if (cacheChanged)
+		{
+			_saveDeviceBenchmarks(cache);
+		}
+
+		if (!measured)
+		{
+			_physicalDevice = *std::max_element(candidates.begin(), candidates.end(), [this](VkPhysicalDevice a, VkPhysicalDevice b)
+			{
+				return _rankDevice(a) < _rankDevice(b);
+			});
+			return;
+		}
+
+		// each metric relative to the best candidate, combined with a geometric mean so no unit dominates
+		DeviceBenchmark best;
+		for (const DeviceBenchmark& result : results)
+		{
+			best.fillGpixels = std::max(best.fillGpixels, result.fillGpixels);
+			best.uploadGBs = std::max(best.uploadGBs, result.uploadGBs);
+			best.computeGflops = std::max(best.computeGflops, result.computeGflops);
+		}
+
+		double bestScore = -1.0;
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			const DeviceBenchmark& result = results[i];
+			double score = std::cbrt((best.fillGpixels > 0.0 ? result.fillGpixels / best.fillGpixels : 1.0) *
+				(best.uploadGBs > 0.0 ? result.uploadGBs / best.uploadGBs : 1.0) *
+				(best.computeGflops > 0.0 ? result.computeGflops / best.computeGflops : 1.0));
+
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(candidates[i], &properties);
+			std::cout << "device: " << properties.deviceName << ", fill " << result.fillGpixels << " Gpix/s, upload " << result.uploadGBs
+				<< " GB/s, compute " << result.computeGflops << " GFLOPS, score " << score << std::endl;
+
+			if (score > bestScore)
+			{
+				bestScore = score;
+				_physicalDevice = candidates[i];
+			}
+		}
+	}
+
+	// features and formats this application relies on beyond the core minimums; empty if the device has them all
+	std::string _checkDeviceCapabilities(VkPhysicalDevice device)
+	{
+		VkPhysicalDeviceFeatures features;
+		vkGetPhysicalDeviceFeatures(device, &features);
+
+		// shader.frag indexes the bindless arrays with the draw's texture and material
+		if (!features.shaderSampledImageArrayDynamicIndexing)
+			return "no dynamic indexing of sampled image arrays";
+		if (!features.shaderStorageBufferArrayDynamicIndexing)
+			return "no dynamic indexing of storage buffer arrays";
+
+		if (_config.cullMode == CullMode::Gpu && !(features.multiDrawIndirect && features.drawIndirectFirstInstance))
+			return "no multi-draw indirect or drawIndirectFirstInstance for --cull gpu";
+
+		if (_findDepthFormat(device) == VK_FORMAT_UNDEFINED)
+			return "no renderable depth format";
+
+		VkFormatProperties textureFormat;
+		vkGetPhysicalDeviceFormatProperties(device, TEXTURE_FORMAT, &textureFormat);
+		VkFormatFeatureFlags textureFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+		if (!_config.textureFiles.empty() || _config.streamedTextureCount > 0)
+		{
+			textureFeatures |= VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+		}
+		if ((textureFormat.optimalTilingFeatures & textureFeatures) != textureFeatures)
+			return "texture format cannot be sampled or blitted";
+
+		if (_config.headless)
+		{
+			VkFormatProperties offscreenFormat;
+			vkGetPhysicalDeviceFormatProperties(device, OFFSCREEN_FORMAT, &offscreenFormat);
+			if (!(offscreenFormat.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+				return "offscreen format is not renderable";
+		}
+		return std::string();
+	}
+
+	// without measurements: discrete before integrated before virtual before cpu, then the largest device-local heap
+	double _rankDevice(VkPhysicalDevice device)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+
+		double typeRank = 0.0;
+		switch (properties.deviceType)
+		{
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:		typeRank = 3.0; break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:	typeRank = 2.0; break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:		typeRank = 1.0; break;
+		default:										break;
+		}
+
+		VkDeviceSize localHeap = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		{
+			if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			{
+				localHeap = std::max(localHeap, memoryProperties.memoryHeaps[i].size);
+			}
+		}
+		return typeRank * 1e6 + localHeap / (1024.0 * 1024.0);
+	}
+
+	//====================== Device Benchmark ==========================
+	// device UUID (VkPhysicalDeviceIDProperties) or vendor, device and pipeline cache UUID otherwise, plus the driver
+	// version: a driver update invalidates the cached results
+	std::string _deviceBenchmarkKey(VkPhysicalDevice device)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+
+		char text[3];
+		std::string key;
+		auto appendHex = [&](const uint8_t* bytes, size_t count)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				snprintf(text, sizeof(text), "%02x", bytes[i]);
+				key += text;
+			}
+		};
+
+		if (_physicalDeviceIdProperties)
+		{
+			VkPhysicalDeviceIDProperties idProperties = {};
+			idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+			VkPhysicalDeviceProperties2 properties2 = {};
+			properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+			properties2.pNext = &idProperties;
+
+			auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceProperties2KHR");
+			getProperties2(device, &properties2);
+			appendHex(idProperties.deviceUUID, VK_UUID_SIZE);
+		}
+		else
+		{
+			key = std::to_string(properties.vendorID) + "-" + std::to_string(properties.deviceID) + "-";
+			appendHex(properties.pipelineCacheUUID, VK_UUID_SIZE);
+		}
+		return key + "-" + std::to_string(properties.driverVersion);
+	}
+
+	std::map<std::string, DeviceBenchmark> _loadDeviceBenchmarks()
+	{
+		std::map<std::string, DeviceBenchmark> cache;
+		std::ifstream file(DEVICE_BENCHMARK_FILE);
+
+		std::string key;
+		DeviceBenchmark result;
+		while (file >> key >> result.fillGpixels >> result.uploadGBs >> result.computeGflops)
+		{
+			cache[key] = result;
+		}
+		return cache;
+	}
+
+	void _saveDeviceBenchmarks(const std::map<std::string, DeviceBenchmark>& cache)
+	{
+		std::ofstream file(DEVICE_BENCHMARK_FILE, std::ios::trunc);
+		for (const auto& entry : cache)
+		{
+			file << entry.first << " " << entry.second.fillGpixels << " " << entry.second.uploadGBs << " " << entry.second.computeGflops << "\n";
+		}
+
+		if (!file)
+		{
+			std::cerr << "Failed to write " << DEVICE_BENCHMARK_FILE << std::endl;
+		}
+	}
+
+	// A few milliseconds of work on a throwaway logical device: clears of a 2048x2048 image (fill rate), copies from
+	// host-visible to device-local memory (upload bandwidth) and an fma loop in devicebench.comp (compute). Each test
+	// runs twice and the faster run counts, so first-use costs stay out; gpu time comes from timestamps when the
+	// queue has them, from the cpu around submit and wait otherwise. Throws on any failure, after destroying the device.
+	DeviceBenchmark _benchmarkDevice(VkPhysicalDevice physicalDevice)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+		uint32_t family = _findQueueFamily(physicalDevice).graphicsFamily.value();
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+		const uint32_t timestampBits = families[family].timestampValidBits;
+
+		VkDevice device = VK_NULL_HANDLE;
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		VkImage image = VK_NULL_HANDLE;
+		VkShaderModule module = VK_NULL_HANDLE;
+		VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		std::vector<VkBuffer> buffers;
+		std::vector<VkDeviceMemory> memories;
+
+		// also runs when a test fails halfway, so everything created so far goes with the device
+		auto destroy = [&]()
+		{
+			if (device == VK_NULL_HANDLE)
+				return;
+
+			vkDeviceWaitIdle(device);
+			vkDestroyPipeline(device, pipeline, nullptr);
+			vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+			vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+			vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+			vkDestroyShaderModule(device, module, nullptr);
+			vkDestroyImage(device, image, nullptr);
+			for (VkBuffer buffer : buffers)
+			{
+				vkDestroyBuffer(device, buffer, nullptr);
+			}
+			for (VkDeviceMemory memory : memories)
+			{
+				vkFreeMemory(device, memory, nullptr);
+			}
+			vkDestroyFence(device, fence, nullptr);
+			vkDestroyQueryPool(device, queryPool, nullptr);
+			vkDestroyCommandPool(device, commandPool, nullptr);
+			vkDestroyDevice(device, nullptr);
+			device = VK_NULL_HANDLE;
+		};
+
+		DeviceBenchmark result;
+		try
+		{
+			float queuePriority = 1.0f;
+			VkDeviceQueueCreateInfo queueInfo = {};
+			queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueInfo.queueFamilyIndex = family;
+			queueInfo.queueCount = 1;
+			queueInfo.pQueuePriorities = &queuePriority;
+
+			VkDeviceCreateInfo deviceInfo = {};
+			deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+			deviceInfo.queueCreateInfoCount = 1;
+			deviceInfo.pQueueCreateInfos = &queueInfo;
+
+			if (vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VK_SUCCESS)
+			{
+				device = VK_NULL_HANDLE;
+				throw std::runtime_error("Failed to create benchmark device!");
+			}
+			VkQueue queue;
+			vkGetDeviceQueue(device, family, 0, &queue);
+
+			VkCommandPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			poolInfo.queueFamilyIndex = family;
+			if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+			{
+				commandPool = VK_NULL_HANDLE;
+				throw std::runtime_error("Failed to create device benchmark command pool!");
+			}
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+			VkCommandBuffer commandBuffer;
+			if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate device benchmark command buffer!");
+			}
+
+			// queues without timestamps must not write them, the cpu timing is used there
+			if (timestampBits > 0)
+			{
+				VkQueryPoolCreateInfo queryInfo = {};
+				queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+				queryInfo.queryCount = 2;
+				if (vkCreateQueryPool(device, &queryInfo, nullptr, &queryPool) != VK_SUCCESS)
+				{
+					queryPool = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark query pool!");
+				}
+			}
+
+			VkFenceCreateInfo fenceInfo = {};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+			{
+				fence = VK_NULL_HANDLE;
+				throw std::runtime_error("Failed to create device benchmark fence!");
+			}
+
+			// best of two runs, in seconds
+			auto timeCommands = [&](const std::function<void(VkCommandBuffer)>& record) -> double
+			{
+				double best = DBL_MAX;
+				for (int run = 0; run < 2; run++)
+				{
+					VkCommandBufferBeginInfo beginInfo = {};
+					beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+					beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+					if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+					{
+						throw std::runtime_error("Failed to begin device benchmark command buffer!");
+					}
+					if (queryPool != VK_NULL_HANDLE)
+					{
+						vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+						vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+					}
+					record(commandBuffer);
+					if (queryPool != VK_NULL_HANDLE)
+					{
+						vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+					}
+					if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+					{
+						throw std::runtime_error("Failed to record device benchmark command buffer!");
+					}
+
+					VkSubmitInfo submitInfo = {};
+					submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+					submitInfo.commandBufferCount = 1;
+					submitInfo.pCommandBuffers = &commandBuffer;
+
+					auto start = std::chrono::high_resolution_clock::now();
+					if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS ||
+						vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+					{
+						throw std::runtime_error("Failed to run device benchmark commands!");
+					}
+					double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+					vkResetFences(device, 1, &fence);
+
+					uint64_t timestamps[2];
+					if (queryPool != VK_NULL_HANDLE && vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+						VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS)
+					{
+						const uint64_t mask = timestampBits >= 64 ? ~0ull : (1ull << timestampBits) - 1;
+						seconds = double((timestamps[1] - timestamps[0]) & mask) * properties.limits.timestampPeriod * 1e-9;
+					}
+					best = std::min(best, std::max(seconds, 1e-9));
+				}
+				return best;
+			};
+
+			auto findMemoryType = [&](uint32_t typeBits, VkMemoryPropertyFlags flags) -> uint32_t
+			{
+				for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+				{
+					if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+						return i;
+				}
+				throw std::runtime_error("Failed to find memory type for the device benchmark!");
+			};
+			auto bindMemory = [&](const VkMemoryRequirements& requirements, VkMemoryPropertyFlags flags) -> VkDeviceMemory
+			{
+				VkMemoryAllocateInfo memoryInfo = {};
+				memoryInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+				memoryInfo.allocationSize = requirements.size;
+				memoryInfo.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, flags);
+
+				VkDeviceMemory memory;
+				if (vkAllocateMemory(device, &memoryInfo, nullptr, &memory) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to allocate device benchmark memory!");
+				}
+				memories.push_back(memory);
+				return memory;
+			};
+			auto createBuffer = [&](VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags) -> VkBuffer
+			{
+				VkBufferCreateInfo bufferInfo = {};
+				bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+				bufferInfo.size = size;
+				bufferInfo.usage = usage;
+				bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+				VkBuffer buffer;
+				if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to create device benchmark buffer!");
+				}
+				buffers.push_back(buffer);
+
+				VkMemoryRequirements requirements;
+				vkGetBufferMemoryRequirements(device, buffer, &requirements);
+				if (vkBindBufferMemory(device, buffer, bindMemory(requirements, flags), 0) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to bind device benchmark buffer memory!");
+				}
+				return buffer;
+			};
+
+			// fill rate
+			{
+				const uint32_t size = 2048;
+				const uint32_t clears = 16;
+
+				VkImageCreateInfo imageInfo = {};
+				imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+				imageInfo.imageType = VK_IMAGE_TYPE_2D;
+				imageInfo.format = TEXTURE_FORMAT;
+				imageInfo.extent = { size, size, 1 };
+				imageInfo.mipLevels = 1;
+				imageInfo.arrayLayers = 1;
+				imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+				imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+				imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+				imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+				imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+				if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+				{
+					image = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark image!");
+				}
+				VkMemoryRequirements requirements;
+				vkGetImageMemoryRequirements(device, image, &requirements);
+				if (vkBindImageMemory(device, image, bindMemory(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), 0) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to bind device benchmark image memory!");
+				}
+
+				VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+				double seconds = timeCommands([&](VkCommandBuffer cmd)
+				{
+					VkImageMemoryBarrier barrier = {};
+					barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+					barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+					barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+					barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+					barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					barrier.image = image;
+					barrier.subresourceRange = range;
+					vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+					for (uint32_t i = 0; i < clears; i++)
+					{
+						// a different color each time, so clears cannot be skipped as redundant
+						VkClearColorValue color = { { i / float(clears), 0.5f, 0.25f, 1.0f } };
+						vkCmdClearColorImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+					}
+				});
+				result.fillGpixels = double(size) * size * clears / seconds * 1e-9;
+			}
+
+			// upload bandwidth
+			{
+				const VkDeviceSize size = 32ull * 1024 * 1024;
+				const uint32_t copies = 4;
+				VkBuffer source = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+				VkBuffer destination = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+				double seconds = timeCommands([&](VkCommandBuffer cmd)
+				{
+					VkBufferCopy region = { 0, 0, size };
+					for (uint32_t i = 0; i < copies; i++)
+					{
+						vkCmdCopyBuffer(cmd, source, destination, 1, &region);
+					}
+				});
+				result.uploadGBs = double(size) * copies / seconds * 1e-9;
+			}
+
+			// compute throughput
+			{
+				const uint32_t groupCount = 4096;
+				const VkDeviceSize outputSize = VkDeviceSize(groupCount) * DEVICE_BENCH_WORKGROUP_SIZE * sizeof(glm::vec4);
+				VkBuffer output = createBuffer(outputSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+				std::vector<char> code = readFile("shaders/devicebench.spv");
+				VkShaderModuleCreateInfo moduleInfo = {};
+				moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+				moduleInfo.codeSize = code.size();
+				moduleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+				if (vkCreateShaderModule(device, &moduleInfo, nullptr, &module) != VK_SUCCESS)
+				{
+					module = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark shader module!");
+				}
+
+				VkDescriptorSetLayoutBinding binding = {};
+				binding.binding = 0;
+				binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				binding.descriptorCount = 1;
+				binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+				VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+				layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+				layoutInfo.bindingCount = 1;
+				layoutInfo.pBindings = &binding;
+				if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+				{
+					setLayout = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark descriptor set layout!");
+				}
+
+				VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 };
+				VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+				descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+				descriptorPoolInfo.maxSets = 1;
+				descriptorPoolInfo.poolSizeCount = 1;
+				descriptorPoolInfo.pPoolSizes = &poolSize;
+				if (vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+				{
+					descriptorPool = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark descriptor pool!");
+				}
+
+				VkDescriptorSetAllocateInfo setInfo = {};
+				setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				setInfo.descriptorPool = descriptorPool;
+				setInfo.descriptorSetCount = 1;
+				setInfo.pSetLayouts = &setLayout;
+				VkDescriptorSet set;
+				if (vkAllocateDescriptorSets(device, &setInfo, &set) != VK_SUCCESS)
+				{
+					throw std::runtime_error("Failed to allocate device benchmark descriptor set!");
+				}
+
+				VkDescriptorBufferInfo bufferInfo = { output, 0, outputSize };
+				VkWriteDescriptorSet write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = set;
+				write.dstBinding = 0;
+				write.descriptorCount = 1;
+				write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				write.pBufferInfo = &bufferInfo;
+				vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+				VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+				pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+				pipelineLayoutInfo.setLayoutCount = 1;
+				pipelineLayoutInfo.pSetLayouts = &setLayout;
+				if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+				{
+					pipelineLayout = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark pipeline layout!");
+				}
+
+				VkSpecializationMapEntry iterationsEntry = { 0, 0, sizeof(uint32_t) };
+				VkSpecializationInfo specializationInfo = {};
+				specializationInfo.mapEntryCount = 1;
+				specializationInfo.pMapEntries = &iterationsEntry;
+				specializationInfo.dataSize = sizeof(uint32_t);
+				specializationInfo.pData = &DEVICE_BENCH_ITERATIONS;
+
+				VkComputePipelineCreateInfo pipelineInfo = {};
+				pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+				pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+				pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+				pipelineInfo.stage.module = module;
+				pipelineInfo.stage.pName = "main";
+				pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+				pipelineInfo.layout = pipelineLayout;
+				if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+				{
+					pipeline = VK_NULL_HANDLE;
+					throw std::runtime_error("Failed to create device benchmark pipeline!");
+				}
+
+				double seconds = timeCommands([&](VkCommandBuffer cmd)
+				{
+					vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+					vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+					vkCmdDispatch(cmd, groupCount, 1, 1);
+				});
+				result.computeGflops = double(groupCount) * DEVICE_BENCH_WORKGROUP_SIZE * DEVICE_BENCH_ITERATIONS * DEVICE_BENCH_FLOPS_PER_ITERATION / seconds * 1e-9;
+			}
+		}
+		catch (...)
+		{
+			destroy();
+			throw;
+		}
+		destroy();
+
+		std::cout << "device: benchmarked " << properties.deviceName << std::endl;
+		return result;
+	}
+
+	bool _isDeviceSuitable(VkPhysicalDevice device)
+	{
+		QueueFamilyIndices indices = _findQueueFamily(device);
+
+		// check device for swapchain support
+		bool extensionsSupported = _checkDeviceExtensionSupport(device);
+
+		bool swapChainAdequate = _config.headless;
+		if (extensionsSupported && !_config.headless)
+		{
+			SwapchainSupportDetails swapChainSupport = _querySwapchainSupport(device);
+			swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+		}
+
+		return indices.isComplete() && extensionsSupported && swapChainAdequate;
+	}
+
+	VkSurfaceFormatKHR _chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+	{
+		for (const VkSurfaceFormatKHR& availableFormat : availableFormats)
+		{
+			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+				return availableFormat;
+		}
+
+		return availableFormats[0];
+	}
+
+	VkPresentModeKHR _chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+	{
+		for (const auto& presentMode : availablePresentModes)
+		{
+			if (presentMode == _config.presentMode)
+			{
+				return presentMode;
+			}
+		}
+
+		// FIFO is the only mode every surface has to support
+		if (_config.presentMode != VK_PRESENT_MODE_FIFO_KHR)
+		{
+			std::cout << "present mode " << presentModeName(_config.presentMode) << " is not supported, using fifo" << std::endl;
+		}
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
+	VkExtent2D _chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+	{
+		if (capabilities.currentExtent.width != UINT32_MAX)
+		{
+			return capabilities.currentExtent;
+		}
+		else
+		{
+			int width, height;
+			glfwGetFramebufferSize(_window, &width, &height);
+
+			VkExtent2D actualExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+
+			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+			return actualExtent;
+		}
+	}
+
+	bool _checkDeviceExtensionSupport(VkPhysicalDevice device)
+	{
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+		std::vector<const char*> extensions = _getDeviceExtensions();
+		std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
+
+		for (const auto& extension : availableExtensions)
+		{
+			requiredExtensions.erase(extension.extensionName); // do we have swapchain support?
+		}
+
+		return requiredExtensions.empty();
+	}
+
+	std::vector<const char*> _getDeviceExtensions()
+	{
+		// no swapchain without a surface
+		if (_config.headless)
+		{
+			return {};
+		}
+
+		return deviceExtensions;
+	}
+
+	SwapchainSupportDetails _querySwapchainSupport(VkPhysicalDevice device)
+	{
+		SwapchainSupportDetails details;
+
+		// surface
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, _surface, &details.capabilities);
+
+		// support format
+		uint32_t formatCount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, nullptr);
+		if (formatCount != 0)
+		{
+			details.formats.resize(formatCount);
+			vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, details.formats.data());
+		}
+
+		// query present
+		uint32_t presentModeCount;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, nullptr);
+		if (presentModeCount != 0)
+		{
+			details.presentModes.resize(presentModeCount);
+			vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, details.presentModes.data());
+		}
+
+		return details;
+	}
+
+	//====================== Queue Family ==========================
+	QueueFamilyIndices _findQueueFamily(VkPhysicalDevice device)
+	{
+		QueueFamilyIndices indices;
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+		int i = 0;
+		VkBool32 presentSupport = false;
+		for (const auto& queueFamily : queueFamilies)
+		{
+			if (!_config.headless)
+			{
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &presentSupport);
+			}
+			if (presentSupport)
+			{
+				indices.presentFamily = i;
+			}
+			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				indices.graphicsFamily = i;
+
+				// headless mode never presents, alias the graphics family so the device setup stays the same
+				if (_config.headless)
+				{
+					indices.presentFamily = i;
+				}
+			}
+			if (indices.isComplete())
+				break;
+			i++;
+		}
 
-		VkSurfaceFormatKHR surfaceFormat = _chooseSwapSurfaceFormat(swapChainSupport.formats);
-		VkPresentModeKHR presentMode = _chooseSwapPresentMode(swapChainSupport.presentModes);
-		VkExtent2D extent = _chooseSwapExtent(swapChainSupport.capabilities);
+		// prefer a transfer-only family (DMA engine), then any non-graphics one, then fall back to the graphics queue
+		int bestScore = -1;
+		for (uint32_t f = 0; f < queueFamilyCount; f++)
+		{
+			VkQueueFlags flags = queueFamilies[f].queueFlags;
+			if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+				continue;
 
-		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+			int score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+			if (score > bestScore)
+			{
+				bestScore = score;
+				indices.transferFamily = f;
+			}
+		}
+		if (!indices.transferFamily.has_value())
 		{
-			imageCount = swapChainSupport.capabilities.maxImageCount;
+			indices.transferFamily = indices.graphicsFamily;
 		}
+		return indices;
+	}
 
-		VkSwapchainCreateInfoKHR createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		createInfo.surface = _surface;
-		createInfo.minImageCount = imageCount;
-		createInfo.imageFormat = surfaceFormat.format;
-		createInfo.imageColorSpace = surfaceFormat.colorSpace;
-		createInfo.imageExtent = extent;
-		createInfo.imageArrayLayers = 1;
-		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
+	//====================== Logic Device ==========================
+	void _createLogicDevice()
+	{
 		QueueFamilyIndices indices = _findQueueFamily(_physicalDevice);
-		uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
 
-		if (indices.graphicsFamily != indices.presentFamily)
+		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+		std::set<uint32_t> uniqueQueueFamiles = { indices.graphicsFamily.value(), indices.presentFamily.value(), indices.transferFamily.value() };
+		float queuePriority = 1.0f;
+		for (uint32_t queueFamily : uniqueQueueFamiles)
 		{
-			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-			createInfo.queueFamilyIndexCount = 2;
-			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+			VkDeviceQueueCreateInfo queueCreateInfo = {};
+			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+			queueCreateInfo.queueFamilyIndex = queueFamily;
+			queueCreateInfo.queueCount = 1;
+			queueCreateInfo.pQueuePriorities = &queuePriority;
+
+			queueCreateInfos.push_back(queueCreateInfo);
 		}
-		else
+
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(_physicalDevice, &supportedFeatures);
+
+		VkPhysicalDeviceFeatures deviceFeatures = {};
+		if (_config.pipelineStatistics && supportedFeatures.pipelineStatisticsQuery)
 		{
-			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-			createInfo.queueFamilyIndexCount = 0;
-			createInfo.pQueueFamilyIndices = nullptr;
+			deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+			deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;	// statistics across secondary command buffers
 		}
+		// indirect draws of the culling path
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		// bindless arrays are indexed with the draw's (dynamically uniform) material; required, see _checkDeviceCapabilities
+		deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+		deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+		_enabledFeatures = deviceFeatures;
 
-		createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+		VkDeviceCreateInfo deviceCreateInfo = {};
+		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 
-		createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-		createInfo.presentMode = presentMode;
-		createInfo.clipped = VK_TRUE;
+		deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+		// enable swapchain
+		std::vector<const char*> extensions = _getDeviceExtensions();
 
-		if (vkCreateSwapchainKHR(_device, &createInfo, nullptr, &_swapChain) != VK_SUCCESS)
+		uint32_t availableExtensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &availableExtensionCount, nullptr);
+		std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+		vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &availableExtensionCount, availableExtensions.data());
+		for (const char* optional : optionalDeviceExtensions)
 		{
-			throw std::runtime_error("Failed to create swap chain");
+			// the timeline and descriptor indexing extensions depend on the properties2 instance extension
+			if (strcmp(optional, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) != 0 && !_physicalDeviceProperties2)
+				continue;
+			if (strcmp(optional, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0 && !_config.timelineSync)
+				continue;
+
+			for (const auto& available : availableExtensions)
+			{
+				if (strcmp(optional, available.extensionName) == 0)
+				{
+					extensions.push_back(optional);
+					break;
+				}
+			}
 		}
+		_enabledDeviceExtensions = std::set<std::string>(extensions.begin(), extensions.end());
 
-		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, nullptr);
-		_swapChainImages.resize(imageCount);
-		vkGetSwapchainImagesKHR(_device, _swapChain, &imageCount, _swapChainImages.data());
-		_swapChainImageFormat = surfaceFormat.format;
-		_swapChainExtent = extent;
-	}
+		// extension features are queried through one chain and enabled by passing the same structs to the device
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+		timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+		indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
 
-	//====================== Surface ================================
-	void _createSurface()
-	{
-		if (glfwCreateWindowSurface(_instance, _window, nullptr, &_surface) != VK_SUCCESS)
+		void* featureChain = nullptr;
+		if (_enabledDeviceExtensions.count(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
 		{
-			throw std::runtime_error("Failed to create window surface.");
+			timelineFeatures.pNext = featureChain;
+			featureChain = &timelineFeatures;
 		}
-	}
-
-	//====================== Physical Device ==========================
-	void _pickPhysicalDevice() // graphics card choose(GPU)
-	{
-		uint32_t deviceCount = 0;
-		vkEnumeratePhysicalDevices(_instance, &deviceCount, nullptr); // get the number of GPUs first
-
-		// do we have any GPUs with Vulkan support?
-		if (deviceCount == 0)
+		if (_enabledDeviceExtensions.count(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
 		{
-			throw std::runtime_error("Failed to find GPUs with Vulkan support!");
+			indexingFeatures.pNext = featureChain;
+			featureChain = &indexingFeatures;
+		}
+		if (featureChain)
+		{
+			VkPhysicalDeviceFeatures2 features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features2.pNext = featureChain;
+
+			auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceFeatures2KHR");
+			getFeatures2(_physicalDevice, &features2);
+
+			// only what the bindless table uses
+			VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = indexingFeatures;
+			void* next = indexingFeatures.pNext;
+			indexingFeatures = {};
+			indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+			indexingFeatures.pNext = next;
+			indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = supported.descriptorBindingSampledImageUpdateAfterBind;
+			indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = supported.descriptorBindingStorageBufferUpdateAfterBind;
+			indexingFeatures.descriptorBindingUpdateUnusedWhilePending = supported.descriptorBindingUpdateUnusedWhilePending;
+			indexingFeatures.descriptorBindingPartiallyBound = supported.descriptorBindingPartiallyBound;
+
+			deviceCreateInfo.pNext = featureChain;
 		}
+		_timelineSync = timelineFeatures.timelineSemaphore == VK_TRUE;
+		_descriptorIndexing = indexingFeatures.descriptorBindingSampledImageUpdateAfterBind && indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+			indexingFeatures.descriptorBindingUpdateUnusedWhilePending && indexingFeatures.descriptorBindingPartiallyBound;
 
-		// fill with all the GPUs
-		std::vector<VkPhysicalDevice> devices(deviceCount);
-		vkEnumeratePhysicalDevices(_instance, &deviceCount, devices.data());
+		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+		deviceCreateInfo.ppEnabledExtensionNames = extensions.data();
 
-		for (const auto& device : devices)
+		if (enableValidationLayer)
 		{
-			if (_isDeviceSuitable(device))
-			{
-				_physicalDevice = device;
-				break;
-			}
+			deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+			deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+		}
+		else
+		{
+			deviceCreateInfo.enabledLayerCount = 0;
 		}
 
-		// if no suitable GPU
-		if (_physicalDevice == VK_NULL_HANDLE)
+		if (vkCreateDevice(_physicalDevice, &deviceCreateInfo, nullptr, &_device) != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to find a suitable GPU!");
+			throw std::runtime_error("Failed to create logical device");
 		}
 
-		// use an ordered map to automatically sort candidates by increasing score
-		std::multimap<int, VkPhysicalDevice> candidates;
+		// retrieving queue handle
+		vkGetDeviceQueue(_device, indices.graphicsFamily.value(), 0, &_graphicsQueue);
+		vkGetDeviceQueue(_device, indices.presentFamily.value(), 0, &_presentQueue);
+		vkGetDeviceQueue(_device, indices.transferFamily.value(), 0, &_transferQueue);
 
-		for (const auto& device : devices)
+		if (_timelineSync)
 		{
-			int score = _rateDeviceSuitability(device);
-			candidates.insert(std::make_pair(score, device));
+			_vkWaitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(_device, "vkWaitSemaphoresKHR");
+			_vkGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(_device, "vkGetSemaphoreCounterValueKHR");
 		}
+		std::cout << "sync: " << (_timelineSync ? "timeline semaphore" : "fences") << std::endl;
+		std::cout << "descriptors: " << (_descriptorIndexing ? "descriptor indexing (update-after-bind)" : "per-frame sets") << std::endl;
 
-		// check if the best candidate is suitable alt all
-		if (candidates.rbegin()->first > 0)
+		if (_enabledDeviceExtensions.count(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
 		{
-			_physicalDevice = candidates.rbegin()->second;
+			_vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(_device, "vkCmdDrawIndexedIndirectCountKHR");
 		}
-		else
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+		_maxDrawIndirectCount = std::max(1u, properties.limits.maxDrawIndirectCount);
+	}
+	void _setupMessenger()
+	{
+		if (!enableValidationLayer) return;
+
+		VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+		_populateDebugMessengerCreateInfo(createInfo);
+
+		if (CreateDebugUtilsMessengerEXT(_instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to find a suitalbe GPU");
+			throw std::runtime_error("failed to set up debug messenger");
 		}
 	}
 
-	int _rateDeviceSuitability(VkPhysicalDevice device)
+	void _mainLoop()
 	{
-		VkPhysicalDeviceProperties deviceProperties;
-		VkPhysicalDeviceFeatures deviceFeatures;
-		vkGetPhysicalDeviceProperties(device, &deviceProperties);
-		vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-		int score = 0;
-
-		// discrete GPUs have a significant performance advantage
-		if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+		while (!glfwWindowShouldClose(_window))
 		{
-			score += 1000;
+			glfwPollEvents();
+			_drawFrame();
 		}
 
-		// maximum possible size of textures affects graphics quality
-		score += deviceProperties.limits.maxImageDimension2D;
+		vkDeviceWaitIdle(_device);
+	}
 
-		// application can't funcion without geometry shaders
-		if (!deviceFeatures.geometryShader)
+	// headless benchmark: render a fixed number of frames and report throughput
+	void _offscreenLoop()
+	{
+		// a few frames to settle driver state before measuring
+		const uint32_t warmupFrames = std::min<uint32_t>(_config.frameCount, 10);
+		for (uint32_t i = 0; i < warmupFrames; i++)
 		{
-			return 0;
+			_drawFrame();
+		}
+		vkDeviceWaitIdle(_device);
+
+		FrameStats stats;
+		auto start = std::chrono::high_resolution_clock::now();
+		auto last = start;
+		for (uint32_t i = 0; i < _config.frameCount; i++)
+		{
+			_drawFrame();
+
+			auto now = std::chrono::high_resolution_clock::now();
+			stats.add(std::chrono::duration<double, std::milli>(now - last).count());
+			last = now;
 		}
+		vkDeviceWaitIdle(_device);
 
-		return score;
+		double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stats.report("offscreen", totalMs);
 	}
 
-	bool _isDeviceSuitable(VkPhysicalDevice device)
+	// frames stay pipelined as in the main loop; the probe thread timestamps each frame's fence so
+	// submit->complete covers queueing behind earlier frames, acquire->present covers blocking in acquire and present
+	void _latencyBenchmark()
 	{
-		QueueFamilyIndices indices = _findQueueFamily(device);
-
-		// check device for swapchain support
-		bool extensionsSupported = _checkDeviceExtensionSupport(device);
+		std::string setting = std::to_string(_config.framesInFlight) + " frames in flight";
+		if (!_config.headless)
+		{
+			if (_presentMode != _config.presentMode)
+			{
+				std::cout << "latency: " << presentModeName(_config.presentMode) << ", " << setting << ": skipped, present mode not supported" << std::endl;
+				return;
+			}
+			setting = std::string(presentModeName(_presentMode)) + ", " + setting;
+		}
 
-		bool swapChainAdequate = false;
-		if (extensionsSupported)
+		const uint32_t warmupFrames = std::min<uint32_t>(_config.frameCount, 10);
+		for (uint32_t i = 0; i < warmupFrames; i++)
 		{
-			SwapchainSupportDetails swapChainSupport = _querySwapchainSupport(device);
-			swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+			if (!_config.headless)
+			{
+				glfwPollEvents();
+			}
+			_drawFrame();
 		}
 
-		return indices.isComplete() && extensionsSupported && swapChainAdequate;
-	}
+		_latencyProbe.reset(new FrameLatencyProbe(_frameNumber));
 
-	VkSurfaceFormatKHR _chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
-	{
-		for (const VkSurfaceFormatKHR& availableFormat : availableFormats)
+		FrameStats acquireToPresent;
+		FrameStats frameInterval;
+		auto start = std::chrono::high_resolution_clock::now();
+		auto last = start;
+		for (uint32_t i = 0; i < _config.frameCount; i++)
 		{
-			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-				return availableFormat;
+			if (!_config.headless)
+			{
+				glfwPollEvents();
+			}
+			uint64_t submitted = _frameNumber;
+			_drawFrame();
+
+			auto now = std::chrono::high_resolution_clock::now();
+			frameInterval.add(std::chrono::duration<double, std::milli>(now - last).count());
+			last = now;
+			if (_frameNumber != submitted && !_config.headless)
+			{
+				acquireToPresent.add(_lastAcquireToPresentMs);
+			}
 		}
+		vkDeviceWaitIdle(_device);
 
-		return availableFormats[0];
+		FrameStats submitToComplete = _latencyProbe->latencies();
+		_latencyProbe.reset();
+
+		std::cout << "latency: " << setting
+			<< ": submit->complete p50 " << submitToComplete.percentile(0.50) << " ms, p99 " << submitToComplete.percentile(0.99) << " ms";
+		if (!_config.headless)
+		{
+			std::cout << ", acquire->present p50 " << acquireToPresent.percentile(0.50) << " ms, p99 " << acquireToPresent.percentile(0.99) << " ms";
+		}
+		std::cout << ", frame interval p50 " << frameInterval.percentile(0.50) << " ms" << std::endl;
 	}
 
-	VkPresentModeKHR _chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+	// windowed benchmark: resize the window every few frames and report the worst frame around a recreation
+	void _resizeStormLoop()
 	{
-		for (const auto& presentMode : availablePresentModes)
+		const VkExtent2D sizes[] = { { WIDTH, HEIGHT }, { WIDTH * 5 / 4, HEIGHT * 5 / 4 }, { WIDTH * 3 / 4, HEIGHT * 3 / 4 } };
+		const uint32_t framesPerResize = 4;
+
+		FrameStats stats;
+		double longestStallMs = 0.0;
+		auto start = std::chrono::high_resolution_clock::now();
+		auto last = start;
+		for (uint32_t i = 0; i < _config.frameCount && !glfwWindowShouldClose(_window); i++)
 		{
-			if (presentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+			if (i % framesPerResize == 0)
 			{
-				return presentMode;
+				const VkExtent2D& size = sizes[(i / framesPerResize) % 3];
+				glfwSetWindowSize(_window, static_cast<int>(size.width), static_cast<int>(size.height));
+			}
+
+			uint32_t recreationsBefore = _swapchainRecreations;
+			glfwPollEvents();
+			_drawFrame();
+
+			auto now = std::chrono::high_resolution_clock::now();
+			double frameMs = std::chrono::duration<double, std::milli>(now - last).count();
+			stats.add(frameMs);
+			if (_swapchainRecreations != recreationsBefore)
+			{
+				longestStallMs = std::max(longestStallMs, frameMs);
 			}
+			last = now;
 		}
-		return VK_PRESENT_MODE_FIFO_KHR;
+		vkDeviceWaitIdle(_device);
+
+		double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stats.report("resize-storm", totalMs);
+		std::cout << "resize-storm: " << _swapchainRecreations << " swapchain recreations, longest recreation frame "
+			<< longestStallMs << " ms" << std::endl;
 	}
 
-	VkExtent2D _chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+	// records the same frame with 1, 2, 4, .. threads and reports how the recording time scales
+	void _recordBenchmark()
 	{
-		if (capabilities.currentExtent.width != UINT32_MAX)
+		std::vector<uint32_t> threadCounts = { 1 };
+		const uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (uint32_t threadCount = 2; threadCount <= maxThreads; threadCount *= 2)
 		{
-			return capabilities.currentExtent;
+			threadCounts.push_back(threadCount);
 		}
-		else
+
+		double baselineMs = 0.0;
+		for (uint32_t threadCount : threadCounts)
 		{
-			int width, height;
-			glfwGetFramebufferSize(_window, &width, &height);
+			_setRecordThreads(threadCount);
 
-			VkExtent2D actualExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+			const uint32_t warmupFrames = std::min<uint32_t>(_config.frameCount, 10);
+			FrameStats stats;
+			for (uint32_t i = 0; i < warmupFrames + _config.frameCount; i++)
+			{
+				if (!_config.headless)
+				{
+					glfwPollEvents();
+				}
+				_drawFrame();
 
-			actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-			actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+				if (i >= warmupFrames)
+				{
+					stats.add(_lastRecordMs);
+				}
+			}
+			vkDeviceWaitIdle(_device);
 
-			return actualExtent;
+			double p50 = stats.percentile(0.50);
+			if (threadCount == 1)
+			{
+				baselineMs = p50;
+			}
+			std::cout << "record: " << threadCount << " thread(s), " << _config.drawCount << " draws, p50 " << p50
+				<< " ms, p99 " << stats.percentile(0.99) << " ms, speedup " << (p50 > 0.0 ? baselineMs / p50 : 0.0) << "x" << std::endl;
 		}
 	}
 
-	bool _checkDeviceExtensionSupport(VkPhysicalDevice device)
+	// Loads the --mesh file into scratch buffers, alternating between reading it through std::ifstream into a heap
+	// buffer and copying straight out of a mapping. Both end when the last chunk has landed on the gpu.
+	void _meshLoadBenchmark()
 	{
-		uint32_t extensionCount;
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+		if (_config.meshFile.empty())
+		{
+			throw std::runtime_error("--bench mesh-load needs --mesh <file>");
+		}
 
-		std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+		MappedFile probe(_config.meshFile);
+		const MeshFileHeader* probeHeader = nullptr;
+		parseMeshFile(probe.data(), probe.size(), probeHeader);
 
-		std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+		VkBuffer vertexBuffer, indexBuffer;
+		GpuAllocation vertexAllocation, indexAllocation;
+		_createBuffer(probeHeader->vertexCount * probeHeader->vertexStride, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexAllocation);
+		_createBuffer(probeHeader->indexCount * probeHeader->indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexAllocation);
 
-		for (const auto& extension : availableExtensions)
+		auto uploadAll = [&](const char* data, size_t size)
 		{
-			requiredExtensions.erase(extension.extensionName); // do we have swapchain support?
+			const MeshFileHeader* header = nullptr;
+			const MeshFileChunk* chunks = parseMeshFile(data, size, header);
+
+			uint64_t ticket = _completedUploadTicket;
+			for (uint32_t i = 0; i < header->chunkCount; i++)
+			{
+				ticket = _uploadMeshFileChunk(data, *header, chunks[i], vertexBuffer, indexBuffer);
+			}
+			_waitUpload(ticket);
+		};
+
+		const uint32_t iterations = 5;
+		FrameStats streamStats;
+		FrameStats mappedStats;
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			{
+				std::vector<char> bytes = readFile(_config.meshFile);
+				uploadAll(bytes.data(), bytes.size());
+			}
+			auto middle = std::chrono::high_resolution_clock::now();
+			{
+				MappedFile file(_config.meshFile);
+				uploadAll(file.data(), file.size());
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			streamStats.add(std::chrono::duration<double, std::milli>(middle - start).count());
+			mappedStats.add(std::chrono::duration<double, std::milli>(end - middle).count());
 		}
 
-		return requiredExtensions.empty();
+		vkDeviceWaitIdle(_device);
+		_destroyBuffer(vertexBuffer, vertexAllocation);
+		_destroyBuffer(indexBuffer, indexAllocation);
+
+		double megabytes = probe.size() / (1024.0 * 1024.0);
+		double streamMs = streamStats.percentile(0.50);
+		double mappedMs = mappedStats.percentile(0.50);
+		std::cout << "mesh-load: " << probe.size() << " bytes, " << iterations << " iterations" << std::endl;
+		std::cout << "mesh-load: ifstream p50 " << streamMs << " ms (" << (streamMs > 0.0 ? megabytes * 1000.0 / streamMs : 0.0) << " MB/s)" << std::endl;
+		std::cout << "mesh-load: mmap     p50 " << mappedMs << " ms (" << (mappedMs > 0.0 ? megabytes * 1000.0 / mappedMs : 0.0) << " MB/s)" << std::endl;
 	}
 
-	SwapchainSupportDetails _querySwapchainSupport(VkPhysicalDevice device)
+	// renders warmup + _config.frameCount frames, waiting on each one right after its submit so frames do not
+	// overlap; gpu time runs from submit until the frame completes, cpu time is record + submit
+	void _runSerializedFrames(FrameStats& gpuStats, FrameStats& cpuStats)
 	{
-		SwapchainSupportDetails details;
-
-		// surface
-		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, _surface, &details.capabilities);
-
-		// support format
-		uint32_t formatCount;
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, nullptr);
-		if (formatCount != 0)
+		const uint32_t warmupFrames = std::min<uint32_t>(_config.frameCount, 10);
+		for (uint32_t i = 0; i < warmupFrames + _config.frameCount; i++)
 		{
-			details.formats.resize(formatCount);
-			vkGetPhysicalDeviceSurfaceFormatsKHR(device, _surface, &formatCount, details.formats.data());
-		}
+			if (!_config.headless)
+			{
+				glfwPollEvents();
+			}
+			uint64_t submitted = _frameNumber;
+			_drawFrame();
+			if (_frameNumber == submitted)
+			{
+				continue;	// swapchain was recreated, nothing submitted
+			}
 
-		// query present
-		uint32_t presentModeCount;
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, nullptr);
-		if (presentModeCount != 0)
-		{
-			details.presentModes.resize(presentModeCount);
-			vkGetPhysicalDeviceSurfacePresentModesKHR(device, _surface, &presentModeCount, details.presentModes.data());
-		}
+			_waitFrame(_frameNumber);
+			double gpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - _lastSubmitEnd).count();
 
-		return details;
+			if (i >= warmupFrames)
+			{
+				gpuStats.add(gpuMs);
+				cpuStats.add(_lastSubmitMs + _lastRecordMs);
+			}
+		}
 	}
 
-	//====================== Queue Family ==========================
-	QueueFamilyIndices _findQueueFamily(VkPhysicalDevice device)
+	// cpu-recorded vs gpu-driven draws at 10k, 100k and 1M objects
+	void _cullingBenchmark()
 	{
-		QueueFamilyIndices indices;
+		const CullMode modes[] = { CullMode::Cpu, CullMode::Gpu };
+		for (uint32_t objectCount = 10000; objectCount <= 1000000; objectCount *= 10)
+		{
+			for (CullMode mode : modes)
+			{
+				if (mode == CullMode::Gpu && !_gpuCullingSupported)
+					continue;
 
-		uint32_t queueFamilyCount = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+				_config.cullMode = mode;
+				_setInstanceCount(std::max<uint32_t>(1, objectCount / static_cast<uint32_t>(_meshChunks.size())));
 
-		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+				FrameStats gpuStats;
+				FrameStats cpuStats;
+				_runSerializedFrames(gpuStats, cpuStats);
 
-		int i = 0;
-		VkBool32 presentSupport = false;
-		for (const auto& queueFamily : queueFamilies)
+				std::cout << "culling: " << (mode == CullMode::Cpu ? "cpu" : "gpu") << ", " << _cullObjects.size() << " objects";
+				if (mode == CullMode::Cpu)
+				{
+					std::cout << " (" << _cpuVisibleObjects.load() / std::max(1u, _config.drawCount) << " visible)";
+				}
+				std::cout << ", cpu record+submit p50 " << cpuStats.percentile(0.50) << " ms, gpu p50 " << gpuStats.percentile(0.50) << " ms" << std::endl;
+			}
+		}
+	}
+
+	// streams every texture in at full resolution, evicts the two finest mips and promotes them back, reporting
+	// frame times and upload bytes per frame of each phase; the upload budget is what keeps the frame time flat
+	void _textureStreamingBenchmark()
+	{
+		if (_streamedTextures.empty())
 		{
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, _surface, &presentSupport);
-			if (presentSupport)
+			throw std::runtime_error("--bench texture-streaming needs --stream-textures <count> or --texture <file>");
+		}
+
+		_textureResidencyPinned = true;
+		const struct { const char* name; uint32_t mip; } phases[] = { { "load", 0 }, { "evict", 2 }, { "promote", 0 } };
+		for (const auto& phase : phases)
+		{
+			for (StreamedTexture& texture : _streamedTextures)
 			{
-				indices.presentFamily = i;
+				texture.requestedMip = phase.mip;
 			}
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+
+			FrameStats frameStats;
+			VkDeviceSize peakBytes = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			while (!_texturesSettled())
 			{
-				indices.graphicsFamily = i;
+				if (!_config.headless)
+				{
+					glfwPollEvents();
+					if (glfwWindowShouldClose(_window))
+						break;
+				}
+
+				auto frameStart = std::chrono::high_resolution_clock::now();
+				_drawFrame();
+				frameStats.add(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count());
+				peakBytes = std::max(peakBytes, _lastTextureUploadBytes);
 			}
-			if (indices.isComplete())
-				break;
-			i++;
+			double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			std::cout << "texture-streaming: " << phase.name << " (mip " << phase.mip << "), " << frameStats.samples.size() << " frames in " << totalMs
+				<< " ms, frame p50 " << frameStats.percentile(0.50) << " ms, p99 " << frameStats.percentile(0.99) << " ms, peak upload "
+				<< peakBytes / 1024 << " KiB/frame (budget " << _config.textureBudgetKiB << " KiB)" << std::endl;
 		}
-		return indices;
+		vkDeviceWaitIdle(_device);
 	}
 
-	//====================== Logic Device ==========================
-	void _createLogicDevice()
+	// renders the built-in geometry with each vertex layout; vertex fetch shows up in the gpu time once the mesh is
+	// big enough, e.g. --grid 1024 --instances 16
+	void _vertexFormatBenchmark()
 	{
-		QueueFamilyIndices indices = _findQueueFamily(_physicalDevice);
-
-		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-		std::set<uint32_t> uniqueQueueFamiles = { indices.graphicsFamily.value(), indices.presentFamily.value() };
-		float queuePriority = 1.0f;
-		for (uint32_t queueFamily : uniqueQueueFamiles)
+		if (_sourceVertices.empty())
 		{
-			VkDeviceQueueCreateInfo queueCreateInfo = {};
-			queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-			queueCreateInfo.queueFamilyIndex = queueFamily;
-			queueCreateInfo.queueCount = 1;
-			queueCreateInfo.pQueuePriorities = &queuePriority;
-
-			queueCreateInfos.push_back(queueCreateInfo);
+			throw std::runtime_error("--bench vertex-format needs the built-in geometry (--grid N), not --mesh");
 		}
 
-		VkPhysicalDeviceFeatures deviceFeatures = {};
+		double floatGpuMs = 0.0;
+		for (VertexFormat format : { VertexFormat::Float, VertexFormat::Half, VertexFormat::Snorm16 })
+		{
+			vkDeviceWaitIdle(_device);
+			if (!_selectVertexLayout(format))
+			{
+				std::cout << "vertex-format: " << vertexLayoutInfo(format).name << " skipped" << std::endl;
+				continue;
+			}
 
-		VkDeviceCreateInfo deviceCreateInfo = {};
-		deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-		deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+			_destroyPipelineVariants();
+			_compilePipelineVariants();
+			_destroyBuffer(_vertexBuffer, _vertexBufferAllocation);
+			_uploadVertices(_sourceVertices);
 
-		deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+			FrameStats gpuStats;
+			FrameStats cpuStats;
+			_runSerializedFrames(gpuStats, cpuStats);
 
-		// enable swapchain
-		deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-		deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+			double gpuMs = gpuStats.percentile(0.50);
+			if (format == VertexFormat::Float)
+			{
+				floatGpuMs = gpuMs;
+			}
+			std::cout << "vertex-format: " << _vertexLayout.name << ", " << _vertexLayout.stride << " bytes per vertex, "
+				<< _sourceVertices.size() * _vertexLayout.stride / 1024 << " KiB, gpu p50 " << gpuMs << " ms, p99 " << gpuStats.percentile(0.99) << " ms";
+			if (floatGpuMs > 0.0 && format != VertexFormat::Float)
+			{
+				std::cout << " (" << floatGpuMs / gpuMs << "x float)";
+			}
+			std::cout << std::endl;
+		}
 
-		if (enableValidationLayer)
+		// no shipped layout has normals yet; report what the octahedral encoding would cost in precision
+		float maxErrorDegrees = 0.0f;
+		const uint32_t steps = 64;
+		for (uint32_t i = 0; i <= steps; i++)
 		{
-			deviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-			deviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+			for (uint32_t j = 0; j < 2 * steps; j++)
+			{
+				float theta = 3.14159265f * i / steps;
+				float phi = 3.14159265f * j / steps;
+				float normal[3] = { std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta) };
+
+				uint8_t packed[Octahedral16::size];
+				Octahedral16::encode(normal, packed);
+				int16_t snorm[2];
+				memcpy(snorm, packed, sizeof(snorm));
+				float encoded[2] = { std::max(snorm[0] / 32767.0f, -1.0f), std::max(snorm[1] / 32767.0f, -1.0f) };
+				float decoded[3];
+				decodeOctahedral(encoded, decoded);
+
+				float cosine = std::clamp(normal[0] * decoded[0] + normal[1] * decoded[1] + normal[2] * decoded[2], -1.0f, 1.0f);
+				maxErrorDegrees = std::max(maxErrorDegrees, std::acos(cosine) * 57.2957795f);
+			}
 		}
-		else
+		std::cout << "vertex-format: octahedral normals, " << Octahedral16::size << " bytes instead of 12, max error " << maxErrorDegrees << " degrees" << std::endl;
+	}
+
+	// the same frame drawn in submission order (back to front), front to back, and front to back after a depth
+	// pre-pass; overdraw is the fragment shader invocations per scene pixel
+	void _overdrawBenchmark()
+	{
+		if (_frameQueries.empty() || _frameQueries[0].statisticsPool == VK_NULL_HANDLE || (_recordPool && !_enabledFeatures.inheritedQueries))
 		{
-			deviceCreateInfo.enabledLayerCount = 0;
+			throw std::runtime_error("--bench overdraw needs pipeline statistics queries (pipelineStatisticsQuery, inheritedQueries with --record-threads)");
 		}
 
-		if (vkCreateDevice(_physicalDevice, &deviceCreateInfo, nullptr, &_device) != VK_SUCCESS)
+		struct Mode
 		{
-			throw std::runtime_error("Failed to create logical device");
-		}
+			const char*	name;
+			bool		frontToBack;
+			bool		depthPrepass;
+		};
+		const Mode modes[] = { { "submission order", false, false }, { "front to back", true, false }, { "depth pre-pass", true, true } };
 
-		// retrieving queue handle
-		vkGetDeviceQueue(_device, indices.graphicsFamily.value(), 0, &_graphicsQueue);
-		vkGetDeviceQueue(_device, indices.presentFamily.value(), 0, &_presentQueue);
-	}
-	void _setupMessenger()
-	{
-		if (!enableValidationLayer) return;
+		for (const Mode& mode : modes)
+		{
+			vkDeviceWaitIdle(_device);
+			_config.frontToBack = mode.frontToBack;
+			if (_config.depthPrepass != mode.depthPrepass)
+			{
+				_config.depthPrepass = mode.depthPrepass;
+				_destroyPipelineVariants();
+				_compilePipelineVariants();
+			}
 
-		VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
-		_populateDebugMessengerCreateInfo(createInfo);
+			const uint64_t samplesBefore = _gpuHistory.totalSamples;
+			FrameStats gpuStats;
+			FrameStats cpuStats;
+			_runSerializedFrames(gpuStats, cpuStats);
+			for (auto& queries : _frameQueries)
+			{
+				_readFrameQueries(queries);
+			}
 
-		if (CreateDebugUtilsMessengerEXT(_instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to set up debug messenger");
+			const size_t sampleCount = static_cast<size_t>(std::min<uint64_t>(_gpuHistory.totalSamples - samplesBefore, _gpuHistory.window.size()));
+			double fragments = 0.0;
+			for (size_t i = _gpuHistory.window.size() - sampleCount; i < _gpuHistory.window.size(); i++)
+			{
+				fragments += static_cast<double>(_gpuHistory.window[i].fragmentInvocations);
+			}
+
+			std::cout << "overdraw: " << mode.name << ", " << (sampleCount ? _fragmentsPerPixel(fragments / sampleCount) : 0.0)
+				<< " fragments per pixel, gpu p50 " << gpuStats.percentile(0.50) << " ms, p99 " << gpuStats.percentile(0.99) << " ms" << std::endl;
 		}
 	}
 
-	void _mainLoop()
+	// every supported sample count up to 8: frame time, and the memory of the transients, of which the lazily
+	// allocated part is reported with what the driver has committed to it after rendering
+	void _msaaBenchmark()
 	{
-		while (!glfwWindowShouldClose(_window))
+		for (uint32_t samples = 1; samples <= 8; samples *= 2)
 		{
-			glfwPollEvents();
-			_drawFrame();
+			if (_selectSampleCount(samples) != samples)
+				continue;
+
+			vkDeviceWaitIdle(_device);
+			_config.msaaSamples = samples;
+			_destroyPipelineVariants();
+			_createRenderPass();
+			_compilePipelineVariants();
+
+			FrameStats gpuStats;
+			FrameStats cpuStats;
+			_runSerializedFrames(gpuStats, cpuStats);
+
+			const RenderGraph::Stats& stats = _renderGraph.stats();
+			std::cout << "msaa: " << samples << "x, gpu p50 " << gpuStats.percentile(0.50) << " ms, p99 " << gpuStats.percentile(0.99) << " ms, transients "
+				<< stats.allocatedBytes / 1024 << " KiB, " << stats.lazyBytes / 1024 << " KiB lazily allocated ("
+				<< _renderGraph.lazyCommittedBytes() / 1024 << " KiB committed)" << std::endl;
 		}
+	}
 
-		vkDeviceWaitIdle(_device);
+	// sweeps the instance count from 1 to 1M; gpu time is taken from submit until the frame's fence signals,
+	// with the frame waited on right away so frames do not overlap
+	void _instancingBenchmark()
+	{
+		for (uint32_t instanceCount = 1; instanceCount <= 1000000; instanceCount *= 10)
+		{
+			_setInstanceCount(instanceCount);
+
+			FrameStats gpuStats;
+			FrameStats submitStats;
+			_runSerializedFrames(gpuStats, submitStats);
+
+			std::cout << "instancing: " << instanceCount << " instances x " << _config.drawCount << " draws, gpu p50 " << gpuStats.percentile(0.50)
+				<< " ms, p99 " << gpuStats.percentile(0.99) << " ms, cpu record+submit p50 " << submitStats.percentile(0.50) << " ms" << std::endl;
+		}
 	}
 
 	void _cleanupSwapChain()
 	{
-
-		for (auto framebuffer : _swapChainFrameBuffers)
+		for (auto& retired : _retiredSwapchains)
 		{
-			vkDestroyFramebuffer(_device, framebuffer, nullptr);
+			_destroyRetiredSwapchain(retired);
 		}
+		_retiredSwapchains.clear();
 
-		vkFreeCommandBuffers(_device, _commandPool, static_cast<uint32_t>(_commandBuffers.size()), _commandBuffers.data());
-
-		vkDestroyPipeline(_device, _graphicsPipeline, nullptr);
+		RetiredSwapchain current = _retireSwapchain();
+		_destroyRetiredSwapchain(current);
+		_swapChain = VK_NULL_HANDLE;
 
-		vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
+		if (_config.headless)
+		{
+			for (size_t i = 0; i < _swapChainImages.size(); i++)
+			{
+				_destroyImage(_swapChainImages[i], _offscreenImageAllocations[i]);
+			}
+		}
+	}
 
-		vkDestroyRenderPass(_device, _renderPass, nullptr);
+	void _destroyPipelineVariants()
+	{
+		// background compiles still use the modules, layout and render pass
+		_waitPipelineVariants();
 
-		for (auto imageView : _swapChainImageViews)
+		for (auto& entry : _pipelineVariants)
 		{
-			vkDestroyImageView(_device, imageView, nullptr);
+			vkDestroyPipeline(_device, entry.pipeline, nullptr);
 		}
+		_pipelineVariants.clear();
+		_graphicsPipeline = VK_NULL_HANDLE;
+		_depthPrepassPipeline = VK_NULL_HANDLE;
+	}
+
+	void _cleanupPipeline()
+	{
+		_destroyPipelineVariants();
+
+		vkDestroyShaderModule(_device, _fragShaderModule, nullptr);
+		vkDestroyShaderModule(_device, _vertShaderModule, nullptr);
 
-		vkDestroySwapchainKHR(_device, _swapChain, nullptr);
+		vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
 	}
 
 	void _cleanup()
 	{
 		_cleanupSwapChain();
 
-		vkDestroyBuffer(_device, _vertexBuffer, nullptr);
+		_cleanupPipeline();
+		_pipelineCompilePool.reset();
+		_reportRenderGraph();
+		_renderGraph.destroy();
+		_destroyUniformRing();
+
+		_reportGpuTimings();
+		_destroyQueryPools();
+
+		_destroyBuffer(_vertexBuffer, _vertexBufferAllocation);
+		_destroyBuffer(_indexBuffer, _indexBufferAllocation);
+		_destroyBuffer(_instanceBuffer, _instanceBufferAllocation);
+		_destroyCullingBuffers();
+		_destroyCullingPipeline();
+		_reportTextureStreaming();
+		_destroyTextureStreaming();
+		_reportDescriptorStats();
+		_destroyBindless();
+
+		_destroyUploader();
 
-		vkFreeMemory(_device, _vertexBufferMemory, nullptr);
+		_savePipelineCache();
+		vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
 
-		for (size_t i = 0; i < MAX_FRAMES; i++)
+		for (size_t i = 0; i < _config.framesInFlight; i++)
 		{
 			vkDestroySemaphore(_device, _imageAvailableSemaphores[i], nullptr);
 			vkDestroySemaphore(_device, _renderFinishedSemaphores[i], nullptr);
-			vkDestroyFence(_device, _inFlightFences[i], nullptr);
 		}
+		for (VkFence fence : _inFlightFences)
+		{
+			vkDestroyFence(_device, fence, nullptr);
+		}
+		vkDestroySemaphore(_device, _timeline, nullptr);
 
-		vkDestroyCommandPool(_device, _commandPool, nullptr);
+		_destroyCommandPool();
+		_recordPool.reset();
+
+		_allocator.printStats();
+		_allocator.updateBudget();
+		_allocator.printBudgets();
+		_allocator.destroy();
 
 		vkDestroyDevice(_device, nullptr);
 
@@ -1332,24 +9482,289 @@ private:
 		{
 			DestroyDebugUtilsMessengerEXT(_instance, debugMessenger, nullptr);
 		}
-		
-		vkDestroySurfaceKHR(_instance, _surface, nullptr);
+
+		if (!_config.headless)
+		{
+			vkDestroySurfaceKHR(_instance, _surface, nullptr);
+		}
 
 		vkDestroyInstance(_instance, nullptr);
 
-		glfwDestroyWindow(_window);
+		if (!_config.headless)
+		{
+			glfwDestroyWindow(_window);
 
-		glfwTerminate();
+			glfwTerminate();
+		}
 	}
 };
 
-int main()
+static AppConfig parseArgs(int argc, char** argv)
 {
-	HelloTriangleApplication app;
+	AppConfig config;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		auto nextValue = [&]() -> uint32_t
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			return static_cast<uint32_t>(std::stoul(argv[++i]));
+		};
+
+		if (arg == "--headless")
+		{
+			config.headless = true;
+		}
+		else if (arg == "--frames")
+		{
+			config.frameCount = nextValue();
+		}
+		else if (arg == "--width")
+		{
+			config.width = nextValue();
+		}
+		else if (arg == "--height")
+		{
+			config.height = nextValue();
+		}
+		else if (arg == "--bench")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			config.benchmark = argv[++i];
+		}
+		else if (arg == "--draws")
+		{
+			config.drawCount = nextValue();
+		}
+		else if (arg == "--instances")
+		{
+			config.instanceCount = std::max(1u, nextValue());
+		}
+		else if (arg == "--grid")
+		{
+			config.gridSize = nextValue();
+		}
+		else if (arg == "--pipeline-stats")
+		{
+			config.pipelineStatistics = true;
+		}
+		else if (arg == "--gpu-report")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			config.gpuReport = argv[++i];
+		}
+		else if (arg == "--mesh" || arg == "--write-mesh")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			(arg == "--mesh" ? config.meshFile : config.writeMeshFile) = argv[++i];
+		}
+		else if (arg == "--shader-features")
+		{
+			config.shaderFeatures = nextValue();
+		}
+		else if (arg == "--cull")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			std::string mode = argv[++i];
+			if (mode == "none")
+				config.cullMode = CullMode::None;
+			else if (mode == "cpu")
+				config.cullMode = CullMode::Cpu;
+			else if (mode == "gpu")
+				config.cullMode = CullMode::Gpu;
+			else
+				throw std::runtime_error("Unknown cull mode " + mode);
+		}
+		else if (arg == "--vertex-format")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			std::string format = argv[++i];
+			if (format == "float")
+				config.vertexFormat = VertexFormat::Float;
+			else if (format == "half")
+				config.vertexFormat = VertexFormat::Half;
+			else if (format == "snorm16")
+				config.vertexFormat = VertexFormat::Snorm16;
+			else
+				throw std::runtime_error("Unknown vertex format " + format);
+		}
+		else if (arg == "--memory-report")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			config.memoryReportSeconds = std::stof(argv[++i]);
+		}
+		else if (arg == "--zoom")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			config.zoom = std::stof(argv[++i]);
+		}
+		else if (arg == "--render-scale")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			config.renderScale = std::clamp(std::stof(argv[++i]), 0.25f, 2.0f);
+		}
+		else if (arg == "--draw-order")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			std::string order = argv[++i];
+			if (order != "front-to-back" && order != "submission")
+			{
+				throw std::runtime_error("Unknown draw order " + order);
+			}
+			config.frontToBack = order == "front-to-back";
+		}
+		else if (arg == "--msaa")
+		{
+			config.msaaSamples = std::max(1u, nextValue());
+		}
+		else if (arg == "--depth-prepass")
+		{
+			config.depthPrepass = true;
+		}
+		else if (arg == "--frames-in-flight")
+		{
+			config.framesInFlight = nextValue();
+			if (config.framesInFlight < 1 || config.framesInFlight > MAX_FRAMES_IN_FLIGHT)
+			{
+				throw std::runtime_error("--frames-in-flight must be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT));
+			}
+		}
+		else if (arg == "--present-mode")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			std::string name = argv[++i];
+			auto entry = std::find_if(std::begin(PRESENT_MODE_NAMES), std::end(PRESENT_MODE_NAMES), [&](const auto& e) { return name == e.first; });
+			if (entry == std::end(PRESENT_MODE_NAMES))
+			{
+				throw std::runtime_error("Unknown present mode " + name);
+			}
+			config.presentMode = entry->second;
+		}
+		else if (arg == "--sync")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			std::string mode = argv[++i];
+			if (mode != "timeline" && mode != "fence")
+			{
+				throw std::runtime_error("Unknown sync mode " + mode);
+			}
+			config.timelineSync = mode == "timeline";
+		}
+		else if (arg == "--materials")
+		{
+			config.materialCount = std::max(1u, std::min(nextValue(), MAX_MATERIALS));
+		}
+		else if (arg == "--texture")
+		{
+			if (i + 1 >= argc)
+			{
+				throw std::runtime_error("Missing value for " + arg);
+			}
+			config.textureFiles.push_back(argv[++i]);
+		}
+		else if (arg == "--stream-textures")
+		{
+			config.streamedTextureCount = nextValue();
+		}
+		else if (arg == "--texture-size")
+		{
+			config.textureSize = std::max(1u, nextValue());
+		}
+		else if (arg == "--texture-budget")
+		{
+			config.textureBudgetKiB = std::max(1u, nextValue());
+		}
+		else if (arg == "--device-bench")
+		{
+			config.deviceBenchmark = true;
+		}
+		else if (arg == "--record-threads")
+		{
+			config.recordThreads = std::max(1u, nextValue());
+		}
+		else
+		{
+			throw std::runtime_error("Unknown option " + arg);
+		}
+	}
+
+	// the overdraw benchmark counts fragment shader invocations
+	if (config.benchmark == "overdraw")
+	{
+		config.pipelineStatistics = true;
+	}
+
+	return config;
+}
 
+int main(int argc, char** argv)
+{
 	try
 	{
-		app.Run();
+		AppConfig config = parseArgs(argc, argv);
+		if (config.benchmark == "latency")
+		{
+			// frames in flight and the present mode are fixed when the swapchain and sync objects are created,
+			// so every setting runs in its own application
+			for (uint32_t framesInFlight = 1; framesInFlight <= MAX_FRAMES_IN_FLIGHT; framesInFlight++)
+			{
+				for (const auto& entry : PRESENT_MODE_NAMES)
+				{
+					AppConfig setting = config;
+					setting.framesInFlight = framesInFlight;
+					setting.presentMode = entry.second;
+
+					HelloTriangleApplication app(setting);
+					app.Run();
+
+					// nothing is presented offscreen, one run per frames-in-flight value is enough
+					if (config.headless)
+						break;
+				}
+			}
+		}
+		else
+		{
+			HelloTriangleApplication app(config);
+			app.Run();
+		}
 	}
 	catch (const std::exception& e)
 	{
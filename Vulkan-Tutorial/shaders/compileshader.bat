@@ -1,3 +1,5 @@
 C:\VulkanSDK\1.1.130.0\Bin\glslc.exe shader.vert -o vert.spv
 C:\VulkanSDK\1.1.130.0\Bin\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.1.130.0\Bin\glslc.exe cull.comp -o cull.spv
+C:\VulkanSDK\1.1.130.0\Bin\glslc.exe devicebench.comp -o devicebench.spv
 pause
\ No newline at end of file
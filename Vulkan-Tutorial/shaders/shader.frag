@@ -2,10 +2,41 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) flat in uint fragMaterial;
+layout(location = 2) in vec2 fragUV;
+layout(location = 3) flat in uint fragTexture;
 
 layout(location = 0) out vec4 outColor;
 
+// SHADER_FEATURE_* bits, set per pipeline variant
+layout(constant_id = 0) const uint shaderFeatures = 1u;
+const uint FEATURE_GRAYSCALE = 2u;
+
+// bindless table sizes, matching the descriptor set layout
+layout(constant_id = 1) const uint TEXTURE_CAPACITY = 16u;
+layout(constant_id = 2) const uint BUFFER_CAPACITY = 4u;
+const uint MATERIAL_TABLE_SLOT = 0u;
+
+struct Material
+{
+	vec4 tint;
+};
+
+// bindless table shared by every draw, indexed by material ID
+layout(set = 1, binding = 0) uniform sampler2D textures[TEXTURE_CAPACITY];
+layout(std430, set = 1, binding = 1) readonly buffer MaterialTable
+{
+	Material materials[];
+} buffers[BUFFER_CAPACITY];
+
 void main()
 {
-	outColor = vec4(fragColor, 1.0);
+	// material and texture come from push constants, so both indices are uniform across the draw
+	Material material = buffers[MATERIAL_TABLE_SLOT].materials[fragMaterial];
+	vec3 color = fragColor * material.tint.rgb * texture(textures[fragTexture], fragUV).rgb;
+	if ((shaderFeatures & FEATURE_GRAYSCALE) != 0u)
+	{
+		color = vec3(dot(color, vec3(0.299, 0.587, 0.114)));
+	}
+	outColor = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -5,11 +5,51 @@
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 
+// per-instance inputs
+layout(location = 2) in vec2 inInstanceOffset;
+layout(location = 3) in float inInstanceScale;
+layout(location = 4) in vec3 inInstanceColor;
+
+// per-frame data from the uniform ring, bound with a dynamic offset
+layout(set = 0, binding = 0) uniform FrameUniforms
+{
+	vec2 viewScale;
+	vec2 viewOffset;
+	float time;
+	uint frameNumber;
+} frame;
+
+// per-draw transform applied before the view, the draw's material and texture
+layout(push_constant) uniform DrawConstants
+{
+	vec2 offset;
+	vec2 scale;
+	uint materialId;
+	uint textureIndex;
+	float depth;
+	float depthStep;
+} draw;
+
+// SHADER_FEATURE_* bits, set per pipeline variant
+layout(constant_id = 0) const uint shaderFeatures = 1u;
+const uint FEATURE_INSTANCE_COLOR = 1u;
+
 // outputs
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) flat out uint fragMaterial;
+layout(location = 2) out vec2 fragUV;
+layout(location = 3) flat out uint fragTexture;
+
+// the depth pre-pass and the EQUAL-tested shading pass must compute bit-identical depths
+invariant gl_Position;
 
 void main()
 {
-	gl_Position = vec4(inPosition, 0.0, 1.0);
-	fragColor = inColor;
+	vec2 position = (inPosition * inInstanceScale + inInstanceOffset) * draw.scale + draw.offset;
+	float depth = draw.depth - float(gl_InstanceIndex) * draw.depthStep;
+	gl_Position = vec4(position * frame.viewScale + frame.viewOffset, depth, 1.0);
+	fragColor = (shaderFeatures & FEATURE_INSTANCE_COLOR) != 0u ? inColor * inInstanceColor : inColor;
+	fragMaterial = draw.materialId;
+	fragTexture = draw.textureIndex;
+	fragUV = inPosition * 0.5 + 0.5;
 }
\ No newline at end of file